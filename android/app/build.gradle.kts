@@ -77,4 +77,7 @@ dependencies {
     // Core AndroidX.
     implementation("androidx.core:core-ktx:1.15.0")
     implementation("androidx.lifecycle:lifecycle-runtime-ktx:2.8.7")
+
+    // JVM unit tests (./gradlew test), e.g. the decoder's golden vectors.
+    testImplementation("junit:junit:4.13.2")
 }
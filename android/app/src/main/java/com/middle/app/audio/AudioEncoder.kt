@@ -15,14 +15,14 @@ private const val CODEC_TIMEOUT_MICROSECONDS = 10_000L
 object AudioEncoder {
 
     /**
-     * Encode signed 16-bit little-endian PCM (mono, 16kHz) into an M4A file
-     * using Android's built-in MediaCodec AAC encoder.
+     * Encode signed 16-bit little-endian mono PCM into an M4A file using
+     * Android's built-in MediaCodec AAC encoder.
      *
      * We use AAC/M4A instead of MP3 because Android has no built-in MP3
      * encoder, and the OpenAI transcription API accepts M4A just fine.
      */
-    fun encodeToM4a(pcm16: ByteArray, outputFile: File) {
-        val format = MediaFormat.createAudioFormat(MediaFormat.MIMETYPE_AUDIO_AAC, SAMPLE_RATE, 1)
+    fun encodeToM4a(pcm16: ByteArray, outputFile: File, sampleRate: Int = SAMPLE_RATE) {
+        val format = MediaFormat.createAudioFormat(MediaFormat.MIMETYPE_AUDIO_AAC, sampleRate, 1)
         format.setInteger(MediaFormat.KEY_AAC_PROFILE, MediaCodecInfo.CodecProfileLevel.AACObjectLC)
         format.setInteger(MediaFormat.KEY_BIT_RATE, AAC_BIT_RATE)
 
@@ -55,7 +55,7 @@ object AudioEncoder {
                         } else {
                             val chunkSize = minOf(remaining, inputBuffer.capacity())
                             inputBuffer.put(pcm16, inputOffset, chunkSize)
-                            val presentationTimeUs = (inputOffset.toLong() / 2) * 1_000_000 / SAMPLE_RATE
+                            val presentationTimeUs = (inputOffset.toLong() / 2) * 1_000_000 / sampleRate
                             codec.queueInputBuffer(inputIndex, 0, chunkSize, presentationTimeUs, 0)
                             inputOffset += chunkSize
                         }
@@ -105,7 +105,7 @@ object AudioEncoder {
     fun encodeFromIma(imaFileData: ByteArray, outputFile: File) {
         val pcm16 = ImaAdpcmDecoder.decodeFile(imaFileData)
         Log.d(TAG, "[SyncDebug] decodeFile() produced ${pcm16.size} PCM bytes.")
-        encodeToM4a(pcm16, outputFile)
+        encodeToM4a(pcm16, outputFile, ImaAdpcmDecoder.sampleRate(imaFileData))
         Log.d(TAG, "[SyncDebug] encodeToM4a() wrote ${outputFile.length()} bytes to ${outputFile.absolutePath}.")
     }
 
@@ -1,10 +1,29 @@
 package com.middle.app.audio
 
+import java.io.ByteArrayOutputStream
 import java.nio.ByteBuffer
 import java.nio.ByteOrder
 
-/** Size of the IMA ADPCM file header (little-endian uint32 sample count). */
-const val IMA_HEADER_SIZE = 4
+/** Size of the version 1 file header (little-endian uint32 sample count). */
+const val IMA_V1_HEADER_SIZE = 4
+
+/**
+ * Version 2 files start with this magic, then a version byte, a codec byte,
+ * uint16 samples per block and uint32 sample count. The payload is split into
+ * blocks that each begin with their own decoder state. Version 3 adds silence
+ * blocks: a block whose reserved byte is [IMA_BLOCK_SILENCE] holds a uint32
+ * count of zero samples instead of audio. Version 4 is version 3 with a
+ * uint32 sample rate after the header, for firmware built with a rate other
+ * than [SAMPLE_RATE].
+ */
+private val IMA_V2_MAGIC = byteArrayOf('M'.code.toByte(), 'D'.code.toByte(), 'L'.code.toByte(), 'A'.code.toByte())
+const val IMA_V2_HEADER_SIZE = 12
+const val IMA_V4_HEADER_SIZE = 16
+const val IMA_BLOCK_HEADER_SIZE = 4
+const val IMA_BLOCK_SILENCE = 0x01
+
+/** Codec ID from the version 2 header. IMA ADPCM is the only one so far. */
+const val CODEC_IMA_ADPCM = 0
 
 private val STEP_TABLE = intArrayOf(
     7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37,
@@ -22,27 +41,110 @@ private val INDEX_TABLE = intArrayOf(
 
 object ImaAdpcmDecoder {
 
+    private fun hasBlockHeader(imaFileData: ByteArray): Boolean =
+        imaFileData.size >= IMA_V2_HEADER_SIZE &&
+            imaFileData.copyOfRange(0, IMA_V2_MAGIC.size).contentEquals(IMA_V2_MAGIC)
+
+    /** The sample rate of an .ima file, which only version 4 stores. */
+    fun sampleRate(imaFileData: ByteArray): Int {
+        if (!hasBlockHeader(imaFileData) || imaFileData[IMA_V2_MAGIC.size].toInt() != 4) {
+            return SAMPLE_RATE
+        }
+        require(imaFileData.size >= IMA_V4_HEADER_SIZE) { "Truncated version 4 .ima header." }
+        return ByteBuffer.wrap(imaFileData, IMA_V2_HEADER_SIZE, 4)
+            .order(ByteOrder.LITTLE_ENDIAN)
+            .int
+    }
+
     /**
-     * Decode a complete IMA ADPCM file (4-byte header + packed nibbles) into
-     * signed 16-bit little-endian PCM suitable for encoding or playback.
+     * Decode a complete IMA ADPCM file (version 1, 2, 3 or 4) into signed
+     * 16-bit little-endian PCM suitable for encoding or playback.
      */
     fun decodeFile(imaFileData: ByteArray): ByteArray {
-        val sampleCount = ByteBuffer.wrap(imaFileData, 0, IMA_HEADER_SIZE)
+        if (!hasBlockHeader(imaFileData)) {
+            val sampleCount = ByteBuffer.wrap(imaFileData, 0, IMA_V1_HEADER_SIZE)
+                .order(ByteOrder.LITTLE_ENDIAN)
+                .int
+            val adpcmPayload = imaFileData.copyOfRange(IMA_V1_HEADER_SIZE, imaFileData.size)
+            return decodeAdpcm(adpcmPayload, sampleCount)
+        }
+
+        val header = ByteBuffer.wrap(imaFileData, IMA_V2_MAGIC.size, IMA_V2_HEADER_SIZE - IMA_V2_MAGIC.size)
             .order(ByteOrder.LITTLE_ENDIAN)
-            .int
-        val adpcmPayload = imaFileData.copyOfRange(IMA_HEADER_SIZE, imaFileData.size)
-        return decodeAdpcm(adpcmPayload, sampleCount)
+        val version = header.get().toInt() and 0xFF
+        require(version in 2..4) { "Unsupported .ima format version $version." }
+        val codec = header.get().toInt() and 0xFF
+        require(codec == CODEC_IMA_ADPCM) { "Unsupported codec $codec." }
+        val samplesPerBlock = header.short.toInt() and 0xFFFF
+        val sampleCount = header.int
+        return decodeBlocks(
+            imaFileData,
+            headerSize = if (version == 4) IMA_V4_HEADER_SIZE else IMA_V2_HEADER_SIZE,
+            samplesPerBlock,
+            sampleCount,
+            hasSilenceBlocks = version != 2,
+        )
+    }
+
+    /**
+     * Decode the blocks of a version 2 file. Each block restarts from the
+     * state in its header, so a damaged block only affects its own samples.
+     */
+    private fun decodeBlocks(
+        imaFileData: ByteArray,
+        headerSize: Int,
+        samplesPerBlock: Int,
+        sampleCount: Int,
+        hasSilenceBlocks: Boolean,
+    ): ByteArray {
+        val blockSize = IMA_BLOCK_HEADER_SIZE + samplesPerBlock / 2
+        val output = ByteArrayOutputStream(sampleCount * 2)
+        var remaining = sampleCount
+        var offset = headerSize
+        while (remaining > 0 && offset + IMA_BLOCK_HEADER_SIZE < imaFileData.size) {
+            val end = minOf(offset + blockSize, imaFileData.size)
+            val blockHeader = ByteBuffer.wrap(imaFileData, offset, IMA_BLOCK_HEADER_SIZE)
+                .order(ByteOrder.LITTLE_ENDIAN)
+            val predictedSample = blockHeader.short.toInt()
+            val stepIndex = (blockHeader.get().toInt() and 0xFF).coerceAtMost(88)
+            val flags = blockHeader.get().toInt() and 0xFF
+            if (hasSilenceBlocks && (flags and IMA_BLOCK_SILENCE) != 0) {
+                if (offset + IMA_BLOCK_HEADER_SIZE + 4 > imaFileData.size) break
+                val silentSamples = ByteBuffer.wrap(imaFileData, offset + IMA_BLOCK_HEADER_SIZE, 4)
+                    .order(ByteOrder.LITTLE_ENDIAN)
+                    .int
+                    .toLong()
+                    .and(0xFFFFFFFFL)
+                    .coerceAtMost(remaining.toLong())
+                    .toInt()
+                output.write(ByteArray(silentSamples * 2))
+                remaining -= silentSamples
+                offset += blockSize
+                continue
+            }
+            val blockSamples = minOf(samplesPerBlock, remaining)
+            val payload = imaFileData.copyOfRange(offset + IMA_BLOCK_HEADER_SIZE, end)
+            output.write(decodeAdpcm(payload, blockSamples, predictedSample, stepIndex))
+            remaining -= blockSamples
+            offset += blockSize
+        }
+        return output.toByteArray()
     }
 
     /**
      * Decode IMA ADPCM packed nibbles to signed 16-bit little-endian PCM.
      *
      * Each byte contains two nibbles (low nibble first). This mirrors the
-     * encoder in the firmware exactly.
+     * encoder in the firmware exactly, starting from the given state.
      */
-    fun decodeAdpcm(data: ByteArray, sampleCount: Int): ByteArray {
-        var predictedSample = 0
-        var stepIndex = 0
+    fun decodeAdpcm(
+        data: ByteArray,
+        sampleCount: Int,
+        initialPredictedSample: Int = 0,
+        initialStepIndex: Int = 0,
+    ): ByteArray {
+        var predictedSample = initialPredictedSample
+        var stepIndex = initialStepIndex
         val output = ByteArray(sampleCount * 2)
         var writePosition = 0
 
@@ -9,11 +9,75 @@ val CHARACTERISTIC_AUDIO_DATA_UUID: UUID = UUID.fromString("19b10003-e8f2-537e-4
 val CHARACTERISTIC_COMMAND_UUID: UUID = UUID.fromString("19b10004-e8f2-537e-4f6c-d104768a1214")
 val CHARACTERISTIC_VOLTAGE_UUID: UUID = UUID.fromString("19b10005-e8f2-537e-4f6c-d104768a1214")
 val CHARACTERISTIC_PAIRING_UUID: UUID = UUID.fromString("19b10006-e8f2-537e-4f6c-d104768a1214")
+val CHARACTERISTIC_STATS_UUID: UUID = UUID.fromString("19b10007-e8f2-537e-4f6c-d104768a1214")
+
+// Fields of the Stats characteristic, each a uint32 LE, in firmware order.
+// Newer firmware may append fields.
+val STATS_FIELDS = listOf(
+    "recordings",
+    "ring_high_water_bytes",
+    "ring_dropped_bytes",
+    "flash_max_stall_microseconds",
+    "i2s_read_errors",
+    "notify_retries",
+    "notify_failures",
+    "stream_bytes_per_second",
+    "wake_to_first_sample_microseconds",
+    "wake_to_first_kept_sample_microseconds",
+    "capture_buffer_bytes",
+    "idle_milliseconds",
+    "recording_milliseconds",
+    "streaming_milliseconds",
+    "streamed_bytes",
+    "live_recordings",
+    "live_abandoned",
+    "encrypted_chunks",
+    "encrypt_microseconds",
+)
 
 const val COMMAND_REQUEST_NEXT: Byte = 0x01
 const val COMMAND_ACK_RECEIVED: Byte = 0x02
 const val COMMAND_SYNC_DONE: Byte = 0x03
 const val COMMAND_START_STREAM: Byte = 0x04
+const val COMMAND_STREAM_ALL: Byte = 0x07
+const val COMMAND_ACK_IDS: Byte = 0x08
+const val COMMAND_START_STREAM_FRAMED: Byte = 0x0A
+const val COMMAND_ENCRYPT: Byte = 0x0E
+
+// Firmware that supports transport encryption appends a 16-byte nonce to the
+// pairing status. ENCRYPT carries the client's 16-byte nonce; the session key
+// is the first 16 bytes of HMAC-SHA256(token, label + pendant nonce + client
+// nonce). Recording bytes are then AES-128-CTR encrypted, the counter block
+// being the uint32 BE recording ID, four zero bytes and the uint64 BE file
+// offset / 16. Headers, sequence numbers and CRCs stay in the clear; CRCs
+// cover the plaintext.
+const val TRANSPORT_NONCE_SIZE = 16
+const val TRANSPORT_KEY_SIZE = 16
+val TRANSPORT_KEY_LABEL = "middle transport".toByteArray(Charsets.US_ASCII)
+
+// STREAM_ALL frames: uint32 LE recording ID, uint32 LE size, the file bytes,
+// then a uint32 LE CRC-32 of those bytes. ID 0 with size 0 ends the batch.
+// STREAM_ALL may carry a uint32 LE recording ID and offset to resume from;
+// that recording's frame then holds only the bytes from the offset on.
+const val BULK_FRAME_HEADER_SIZE = 8
+const val BULK_FRAME_TRAILER_SIZE = 4
+const val BULK_ACK_MAX_IDS = 16
+const val BULK_FIRST_CHUNK_TIMEOUT_MILLIS = 2_000L
+
+// START_STREAM_FRAMED takes up to FRAMED_RANGES_PER_COMMAND pairs of uint32
+// LE offset and length (0 = to the end). Each notification starts with a
+// uint32 LE sequence number counted in bytes (the file offset of its data);
+// sequence 0xFFFFFFFF marks a window packet carrying uint32 LE offset, length
+// and CRC-32 of the window's bytes. Gaps closer than FRAMED_COALESCE_BYTES
+// are requested as one range.
+const val FRAMED_PACKET_HEADER_SIZE = 4
+const val FRAMED_WINDOW_SEQUENCE = -1
+const val FRAMED_WINDOW_PACKET_SIZE = 16
+const val FRAMED_RANGES_PER_COMMAND = 8
+const val FRAMED_COMMANDS_PER_ROUND = 4
+const val FRAMED_COALESCE_BYTES = 256
+const val FRAMED_MAX_RETRANSMIT_ROUNDS = 10
+const val FRAMED_STALL_TIMEOUT_MILLIS = 2_000L
 
 const val REQUESTED_MTU = 517
 const val MAX_FILE_TRANSFER_ATTEMPTS = 3
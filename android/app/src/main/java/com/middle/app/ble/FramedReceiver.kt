@@ -0,0 +1,145 @@
+package com.middle.app.ble
+
+import java.nio.ByteBuffer
+import java.nio.ByteOrder
+import java.util.zip.CRC32
+
+/**
+ * Reassembles a START_STREAM_FRAMED transfer. Bytes only count as received
+ * once a window CRC covering them matches. A window that arrives with gaps is
+ * kept, so only the gaps need sending again. Data is decrypted with [cipher]
+ * if the session is encrypted. Mirrors FramedReceiver in sync.py.
+ */
+class FramedReceiver(
+    size: Int,
+    prefix: ByteArray,
+    private val cipher: TransportCipher? = null,
+    private val recordingId: Int = 0,
+) {
+
+    private class Window(val offset: Int, val length: Int, val crc: Int) {
+        val end: Int get() = offset + length
+    }
+
+    val data = ByteArray(size)
+
+    // True where bytes arrived but no matching window CRC has covered them.
+    private val arrived = BooleanArray(size)
+    private val verified = BooleanArray(size)
+
+    // Windows still waiting for gaps.
+    private val windows = mutableListOf<Window>()
+
+    var verifiedBytes = prefix.size
+        private set
+
+    /** End of the latest window packet, to tell when a request is done. */
+    var lastWindowEnd = -1
+
+    init {
+        prefix.copyInto(data)
+        verified.fill(true, 0, prefix.size)
+    }
+
+    fun feed(packet: ByteArray) {
+        if (packet.size < FRAMED_PACKET_HEADER_SIZE) return
+        val buffer = ByteBuffer.wrap(packet).order(ByteOrder.LITTLE_ENDIAN)
+        val sequence = buffer.int
+        if (sequence == FRAMED_WINDOW_SEQUENCE) {
+            if (packet.size < FRAMED_WINDOW_PACKET_SIZE) return
+            val window = Window(buffer.int, buffer.int, buffer.int)
+            lastWindowEnd = window.end
+            if (window.offset < 0 || window.length < 0 || window.end > data.size) return
+            windows.add(window)
+            checkWindows(window.offset, window.end)
+            return
+        }
+        val end = sequence + packet.size - FRAMED_PACKET_HEADER_SIZE
+        // Never overwrite checked bytes with a retransmitted copy.
+        if (sequence < 0 || end > data.size || find(verified, false, sequence, end) < 0) return
+        packet.copyInto(data, sequence, FRAMED_PACKET_HEADER_SIZE, packet.size)
+        cipher?.crypt(recordingId, sequence, data, sequence, end - sequence)
+        arrived.fill(true, sequence, end)
+        checkWindows(sequence, end)
+    }
+
+    /**
+     * Settle every stored window overlapping [start, end) that has no gaps
+     * left: verify it, or forget its bytes if the CRC fails.
+     */
+    private fun checkWindows(start: Int, end: Int) {
+        val iterator = windows.iterator()
+        while (iterator.hasNext()) {
+            val window = iterator.next()
+            if (window.end <= start || window.offset >= end) continue
+            val unchecked = find(verified, false, window.offset, window.end)
+            if (unchecked >= 0 && find(arrived, false, unchecked, window.end) >= 0) continue
+            iterator.remove()
+            if (unchecked < 0) continue
+            val crc = CRC32().apply { update(data, window.offset, window.length) }.value.toInt()
+            if (crc == window.crc) {
+                for (index in window.offset until window.end) {
+                    if (!verified[index]) verifiedBytes++
+                }
+                verified.fill(true, window.offset, window.end)
+            } else {
+                arrived.fill(false, window.offset, window.end)
+            }
+        }
+    }
+
+    fun isComplete(): Boolean = verifiedBytes == data.size
+
+    /** Length of the leading run of checked bytes. */
+    fun verifiedPrefix(): Int = find(verified, false, 0, data.size).let { if (it < 0) data.size else it }
+
+    /**
+     * Up to [limit] (offset, length) runs that need sending again: the gaps
+     * inside stored windows, and every other unchecked byte.
+     */
+    fun missingRanges(limit: Int): List<Pair<Int, Int>> {
+        val ranges = mutableListOf<Pair<Int, Int>>()
+        fun add(start: Int, end: Int) {
+            if (start >= end) return
+            val last = ranges.lastOrNull()
+            if (last != null && start - (last.first + last.second) < FRAMED_COALESCE_BYTES) {
+                ranges[ranges.size - 1] = last.first to (end - last.first)
+            } else {
+                ranges.add(start to (end - start))
+            }
+        }
+
+        val sortedWindows = windows.sortedBy { it.offset }
+        var position = find(verified, false, 0, data.size)
+        while (position >= 0 && ranges.size <= limit) {
+            var runEnd = find(verified, true, position, data.size)
+            if (runEnd < 0) runEnd = data.size
+            for (window in sortedWindows) {
+                val windowEnd = minOf(window.end, runEnd)
+                if (windowEnd <= position || window.offset >= runEnd) continue
+                if (window.offset > position) {
+                    add(position, window.offset)
+                    position = window.offset
+                }
+                var gap = find(arrived, false, position, windowEnd)
+                while (gap >= 0) {
+                    var gapEnd = find(arrived, true, gap, windowEnd)
+                    if (gapEnd < 0) gapEnd = windowEnd
+                    add(gap, gapEnd)
+                    gap = find(arrived, false, gapEnd, windowEnd)
+                }
+                position = windowEnd
+            }
+            add(position, runEnd)
+            position = find(verified, false, runEnd, data.size)
+        }
+        return ranges.take(limit)
+    }
+
+    private fun find(flags: BooleanArray, value: Boolean, from: Int, to: Int): Int {
+        for (index in from until to) {
+            if (flags[index] == value) return index
+        }
+        return -1
+    }
+}
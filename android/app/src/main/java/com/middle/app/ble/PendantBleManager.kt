@@ -5,11 +5,16 @@ import android.bluetooth.BluetoothGatt
 import android.bluetooth.BluetoothGattCharacteristic
 import android.content.Context
 import android.util.Log
+import com.middle.app.data.PartialTransferStore
 import kotlinx.coroutines.CancellationException
 import kotlinx.coroutines.CompletableDeferred
 import kotlinx.coroutines.TimeoutCancellationException
+import kotlinx.coroutines.channels.Channel
 import kotlinx.coroutines.withTimeout
+import kotlinx.coroutines.withTimeoutOrNull
 import no.nordicsemi.android.ble.BleManager
+import no.nordicsemi.android.ble.ConnectionPriorityRequest
+import no.nordicsemi.android.ble.PhyRequest
 import no.nordicsemi.android.ble.data.Data
 import no.nordicsemi.android.ble.ktx.suspend
 import no.nordicsemi.android.ble.observer.ConnectionObserver
@@ -17,7 +22,9 @@ import java.io.ByteArrayOutputStream
 import java.io.IOException
 import java.nio.ByteBuffer
 import java.nio.ByteOrder
+import java.security.SecureRandom
 import java.util.concurrent.atomic.AtomicReference
+import java.util.zip.CRC32
 
 /**
  * Manages the BLE connection to the Middle pendant and implements the
@@ -30,21 +37,36 @@ class PendantBleManager(context: Context) : BleManager(context) {
     private var audioDataCharacteristic: BluetoothGattCharacteristic? = null
     private var commandCharacteristic: BluetoothGattCharacteristic? = null
     private var voltageCharacteristic: BluetoothGattCharacteristic? = null
+    private var statsCharacteristic: BluetoothGattCharacteristic? = null
     private var pairingCharacteristic: BluetoothGattCharacteristic? = null
 
+    private val partialStore = PartialTransferStore(context)
+
     // Holds the active transfer state so the notification callback (set once per
     // session) can write to whichever file is currently being received.
     private val activeTransfer = AtomicReference<TransferState?>(null)
 
+    // What the pairing handshake learned, for startEncryption(). The nonce is
+    // null on firmware without transport encryption.
+    private var pendantNonce: ByteArray? = null
+    private var pairingToken: ByteArray? = null
+
+    // Set once the session is encrypted; cleared on disconnect.
+    @Volatile
+    private var cipher: TransportCipher? = null
+
     init {
         // Fail the active transfer immediately on disconnect rather than waiting
         // for the 45s TRANSFER_TOTAL_TIMEOUT_MILLIS to expire. The library calls
         // onDeviceDisconnected on the main thread; completeExceptionally is thread-safe.
         setConnectionObserver(object : ConnectionObserver {
             override fun onDeviceDisconnected(device: BluetoothDevice, reason: Int) {
-                activeTransfer.get()?.deferred?.completeExceptionally(
+                cipher = null
+                val state = activeTransfer.get()
+                state?.deferred?.completeExceptionally(
                     IOException("Pendant disconnected during transfer")
                 )
+                state?.signal?.close(IOException("Pendant disconnected during transfer"))
             }
             override fun onDeviceConnecting(device: BluetoothDevice) = Unit
             override fun onDeviceConnected(device: BluetoothDevice) = Unit
@@ -58,8 +80,89 @@ class PendantBleManager(context: Context) : BleManager(context) {
         val buffer: ByteArrayOutputStream,
         val deferred: CompletableDeferred<ByteArray>,
         val expectedSize: Int,
+        // Set for STREAM_ALL transfers, which end on the end-of-batch frame
+        // rather than at a known size.
+        val parser: BulkFrameParser? = null,
+        val firstChunk: CompletableDeferred<Unit>? = null,
+        // Set for START_STREAM_FRAMED transfers; signal wakes the waiting
+        // coroutine on every packet.
+        val framed: FramedReceiver? = null,
+        val signal: Channel<Unit>? = null,
     )
 
+    /** A recording received through STREAM_ALL whose checksum matched. */
+    class PendingRecording(val id: Int, val data: ByteArray)
+
+    /**
+     * Splits the STREAM_ALL byte stream into recordings as it arrives.
+     * [resumePrefix] is prepended to the frame for [resumeId], which only
+     * carries the bytes the previous attempt didn't get.
+     */
+    private class BulkFrameParser(
+        private val resumeId: Int = 0,
+        private val resumePrefix: ByteArray = ByteArray(0),
+        private val cipher: TransportCipher? = null,
+    ) {
+        private var buffer = ByteArray(0)
+        val recordings = mutableListOf<PendingRecording>()
+        val corruptIds = mutableListOf<Int>()
+        var totalBytes = 0L
+            private set
+        var finished = false
+            private set
+
+        fun feed(chunk: ByteArray) {
+            buffer += chunk
+            totalBytes += chunk.size
+            var offset = 0
+            while (!finished && buffer.size - offset >= BULK_FRAME_HEADER_SIZE) {
+                val header = ByteBuffer.wrap(buffer, offset, BULK_FRAME_HEADER_SIZE)
+                    .order(ByteOrder.LITTLE_ENDIAN)
+                val id = header.int
+                val size = header.int
+                if (id == 0 && size == 0) {
+                    finished = true
+                    break
+                }
+                val frameSize = BULK_FRAME_HEADER_SIZE + size + BULK_FRAME_TRAILER_SIZE
+                if (buffer.size - offset < frameSize) break
+                val dataStart = offset + BULK_FRAME_HEADER_SIZE
+                val data = decrypt(id, buffer.copyOfRange(dataStart, dataStart + size))
+                val expectedCrc = ByteBuffer.wrap(buffer, dataStart + size, BULK_FRAME_TRAILER_SIZE)
+                    .order(ByteOrder.LITTLE_ENDIAN)
+                    .int
+                val crc = CRC32().apply { update(data) }.value.toInt()
+                if (crc == expectedCrc) {
+                    val assembled = if (id == resumeId) resumePrefix + data else data
+                    recordings.add(PendingRecording(id, assembled))
+                } else {
+                    corruptIds.add(id)
+                }
+                offset += frameSize
+            }
+            if (offset > 0) {
+                buffer = buffer.copyOfRange(offset, buffer.size)
+            }
+        }
+
+        /** The ID and bytes so far of a frame cut off mid-transfer, if any. */
+        fun interruptedFrame(): Pair<Int, ByteArray>? {
+            if (finished || buffer.size < BULK_FRAME_HEADER_SIZE) return null
+            val header = ByteBuffer.wrap(buffer, 0, BULK_FRAME_HEADER_SIZE).order(ByteOrder.LITTLE_ENDIAN)
+            val id = header.int
+            val size = header.int
+            val end = minOf(buffer.size, BULK_FRAME_HEADER_SIZE + size)
+            val data = decrypt(id, buffer.copyOfRange(BULK_FRAME_HEADER_SIZE, end))
+            return id to (if (id == resumeId) resumePrefix + data else data)
+        }
+
+        /** Decrypts a frame's bytes, which start at its file's resume offset. */
+        private fun decrypt(id: Int, data: ByteArray): ByteArray {
+            cipher?.crypt(id, if (id == resumeId) resumePrefix.size else 0, data)
+            return data
+        }
+    }
+
     override fun isRequiredServiceSupported(gatt: BluetoothGatt): Boolean {
         val service = gatt.getService(SERVICE_UUID) ?: return false
         fileCountCharacteristic = service.getCharacteristic(CHARACTERISTIC_FILE_COUNT_UUID)
@@ -68,6 +171,8 @@ class PendantBleManager(context: Context) : BleManager(context) {
         commandCharacteristic = service.getCharacteristic(CHARACTERISTIC_COMMAND_UUID)
         // Voltage is optional — older firmware may not expose it.
         voltageCharacteristic = service.getCharacteristic(CHARACTERISTIC_VOLTAGE_UUID)
+        // So is the stats characteristic.
+        statsCharacteristic = service.getCharacteristic(CHARACTERISTIC_STATS_UUID)
         pairingCharacteristic = service.getCharacteristic(CHARACTERISTIC_PAIRING_UUID)
         return fileCountCharacteristic != null
             && fileInfoCharacteristic != null
@@ -82,6 +187,7 @@ class PendantBleManager(context: Context) : BleManager(context) {
         audioDataCharacteristic = null
         commandCharacteristic = null
         voltageCharacteristic = null
+        statsCharacteristic = null
         pairingCharacteristic = null
     }
 
@@ -102,6 +208,29 @@ class PendantBleManager(context: Context) : BleManager(context) {
             .useAutoConnect(false)
             .suspend()
         withTimeout(GATT_OPERATION_TIMEOUT_MILLIS) { requestMtu(REQUESTED_MTU).suspend() }
+        requestHighThroughputLink()
+    }
+
+    /**
+     * Ask for LE 2M PHY and a short connection interval for the transfer,
+     * matching what the firmware requests after pairing. Both are best
+     * effort: the phone may refuse, so results are only logged.
+     */
+    private fun requestHighThroughputLink() {
+        setPreferredPhy(
+            PhyRequest.PHY_LE_2M_MASK,
+            PhyRequest.PHY_LE_2M_MASK,
+            PhyRequest.PHY_OPTION_NO_PREFERRED,
+        )
+            .with { _, txPhy, rxPhy -> Log.d(TAG, "PHY negotiated: tx=$txPhy rx=$rxPhy.") }
+            .fail { _, status -> Log.w(TAG, "2M PHY request failed with status $status.") }
+            .enqueue()
+        requestConnectionPriority(ConnectionPriorityRequest.CONNECTION_PRIORITY_HIGH)
+            .with { _, interval, latency, timeout ->
+                Log.d(TAG, "Connection parameters: interval=${interval * 1.25}ms latency=$latency timeout=${timeout * 10}ms.")
+            }
+            .fail { _, status -> Log.w(TAG, "Connection priority request failed with status $status.") }
+            .enqueue()
     }
 
     /**
@@ -112,7 +241,13 @@ class PendantBleManager(context: Context) : BleManager(context) {
         val characteristic = pairingCharacteristic
             ?: throw IllegalStateException("Not connected or service not discovered.")
         val data = withTimeout(GATT_OPERATION_TIMEOUT_MILLIS) { readCharacteristic(characteristic).suspend() }
-        return (data.value?.firstOrNull()?.toInt() ?: 0) and 0xFF
+        val value = data.value
+        pendantNonce = if (value != null && value.size >= 1 + TRANSPORT_NONCE_SIZE) {
+            value.copyOfRange(1, 1 + TRANSPORT_NONCE_SIZE)
+        } else {
+            null
+        }
+        return (value?.firstOrNull()?.toInt() ?: 0) and 0xFF
     }
 
     /**
@@ -130,6 +265,21 @@ class PendantBleManager(context: Context) : BleManager(context) {
                 BluetoothGattCharacteristic.WRITE_TYPE_DEFAULT,
             ).suspend()
         }
+        pairingToken = token
+    }
+
+    /**
+     * Turns on transport encryption for the rest of the session, after the
+     * token has been written. Returns false, leaving the transfer in the
+     * clear, if the firmware predates it.
+     */
+    suspend fun startEncryption(): Boolean {
+        val nonce = pendantNonce ?: return false
+        val token = pairingToken ?: return false
+        val clientNonce = ByteArray(TRANSPORT_NONCE_SIZE).also { SecureRandom().nextBytes(it) }
+        writeCommand(byteArrayOf(COMMAND_ENCRYPT) + clientNonce)
+        cipher = TransportCipher(token, nonce, clientNonce)
+        return true
     }
 
     suspend fun readFileCount(): Int {
@@ -142,13 +292,20 @@ class PendantBleManager(context: Context) : BleManager(context) {
             .toInt() and 0xFFFF
     }
 
-    suspend fun readFileInfo(): Int {
+    /** File size plus, on firmware that reports it, the recording ID. */
+    class FileInfo(val size: Int, val recordingId: Int?)
+
+    suspend fun readFileInfo(): FileInfo {
         val characteristic = fileInfoCharacteristic
             ?: throw IllegalStateException("Not connected or service not discovered.")
         val data = withTimeout(GATT_OPERATION_TIMEOUT_MILLIS) { readCharacteristic(characteristic).suspend() }
-        return ByteBuffer.wrap(data.value!!)
-            .order(ByteOrder.LITTLE_ENDIAN)
-            .int
+        val value = data.value!!
+        val buffer = ByteBuffer.wrap(value).order(ByteOrder.LITTLE_ENDIAN)
+        val size = buffer.int
+        // Older firmware reports only the size. Without the ID there is no way
+        // to match a partial download, so such transfers never resume.
+        val recordingId = if (value.size >= 8) buffer.int else null
+        return FileInfo(size, recordingId)
     }
 
     /**
@@ -165,13 +322,33 @@ class PendantBleManager(context: Context) : BleManager(context) {
             .toInt() and 0xFFFF
     }
 
+    /**
+     * Reads the pendant's performance counters, named after [STATS_FIELDS].
+     * Returns null if the characteristic is absent (older firmware).
+     */
+    suspend fun readStats(): Map<String, Long>? {
+        val characteristic = statsCharacteristic ?: return null
+        val data = withTimeout(GATT_OPERATION_TIMEOUT_MILLIS) { readCharacteristic(characteristic).suspend() }
+        val buffer = ByteBuffer.wrap(data.value ?: return null).order(ByteOrder.LITTLE_ENDIAN)
+        val stats = linkedMapOf<String, Long>()
+        for (name in STATS_FIELDS) {
+            if (buffer.remaining() < 4) break
+            stats[name] = buffer.int.toLong() and 0xFFFFFFFFL
+        }
+        return stats
+    }
+
     private suspend fun writeCommand(command: Byte) {
+        writeCommand(byteArrayOf(command))
+    }
+
+    private suspend fun writeCommand(payload: ByteArray) {
         val characteristic = commandCharacteristic
             ?: throw IllegalStateException("Not connected or service not discovered.")
         withTimeout(GATT_OPERATION_TIMEOUT_MILLIS) {
             writeCharacteristic(
                 characteristic,
-                byteArrayOf(command),
+                payload,
                 BluetoothGattCharacteristic.WRITE_TYPE_DEFAULT,
             ).suspend()
         }
@@ -189,6 +366,19 @@ class PendantBleManager(context: Context) : BleManager(context) {
         setNotificationCallback(audioCharacteristic).with { _: BluetoothDevice, data: Data ->
             val chunk = data.value ?: return@with
             val state = activeTransfer.get() ?: return@with
+            state.firstChunk?.complete(Unit)
+            if (state.framed != null) {
+                state.framed.feed(chunk)
+                state.signal?.trySend(Unit)
+                return@with
+            }
+            if (state.parser != null) {
+                state.parser.feed(chunk)
+                if (state.parser.finished) {
+                    state.deferred.complete(ByteArray(0))
+                }
+                return@with
+            }
             state.buffer.write(chunk)
             if (state.expectedSize > 0 && state.buffer.size() >= state.expectedSize) {
                 state.deferred.complete(state.buffer.toByteArray())
@@ -214,7 +404,10 @@ class PendantBleManager(context: Context) : BleManager(context) {
      * enableAudioNotifications() / disableAudioNotifications().
      *
      * Returns the raw IMA ADPCM file data (header + payload), or null if
-     * the file is empty (corrupt or aborted recording).
+     * the file is empty (corrupt or aborted recording). Firmware that
+     * reports a recording ID streams in framed mode: lost or corrupt ranges
+     * are requested again, and a failed attempt saves its verified prefix so
+     * the next one (in this session or after a reconnect) resumes there.
      */
     suspend fun requestNextFile(): ByteArray? {
         for (attempt in 1..MAX_FILE_TRANSFER_ATTEMPTS) {
@@ -224,6 +417,8 @@ class PendantBleManager(context: Context) : BleManager(context) {
 
             val buffer = ByteArrayOutputStream()
             val transferComplete = CompletableDeferred<ByteArray>()
+            var recordingId: Int? = null
+            var framedReceiver: FramedReceiver? = null
             // Publish the fresh state before sending the command so no chunk
             // can arrive between the command write and the state swap.
             activeTransfer.set(TransferState(buffer, transferComplete, 0))
@@ -236,7 +431,8 @@ class PendantBleManager(context: Context) : BleManager(context) {
                     // matching the 100ms sleep in sync.py.
                     kotlinx.coroutines.delay(100)
 
-                    val expectedSize = readFileInfo()
+                    val fileInfo = readFileInfo()
+                    val expectedSize = fileInfo.size
                     Log.d(TAG, "Expecting $expectedSize bytes.")
 
                     // Empty files are corrupt or aborted recordings; signal null
@@ -246,6 +442,22 @@ class PendantBleManager(context: Context) : BleManager(context) {
                         return@withTimeout null
                     }
 
+                    recordingId = fileInfo.recordingId
+                    val id = recordingId
+                    if (id != null) {
+                        var prefix = partialStore.load(id)
+                        if (prefix.size >= expectedSize) prefix = ByteArray(0)
+                        val receiver = FramedReceiver(expectedSize, prefix, cipher, id)
+                        framedReceiver = receiver
+                        val signal = Channel<Unit>(Channel.CONFLATED)
+                        activeTransfer.set(
+                            TransferState(buffer, transferComplete, expectedSize, framed = receiver, signal = signal)
+                        )
+                        Log.d(TAG, "[SyncDebug] START_STREAM_FRAMED from byte ${receiver.verifiedPrefix()}.")
+                        receiveFramed(receiver, signal)
+                        return@withTimeout receiver.data
+                    }
+
                     // Update expectedSize in the active state so the callback can
                     // complete the deferred once enough bytes have arrived.
                     activeTransfer.set(TransferState(buffer, transferComplete, expectedSize))
@@ -265,12 +477,19 @@ class PendantBleManager(context: Context) : BleManager(context) {
                     Log.d(TAG, "[SyncDebug] transferComplete.await() returned ${data.size} bytes received.")
                     data.copyOfRange(0, expectedSize)
                 }
+                recordingId?.let { partialStore.discard(it) }
                 // null means the file was empty — return immediately without retrying.
                 return result
             } catch (exception: Exception) {
                 if (exception is CancellationException && exception !is TimeoutCancellationException) throw exception
                 val expectedSize = activeTransfer.get()?.expectedSize ?: 0
-                Log.w(TAG, "[SyncDebug] Transfer failed: received ${buffer.size()} of $expectedSize bytes. $exception")
+                val receiver = framedReceiver
+                val receivedBytes = receiver?.verifiedBytes ?: buffer.size()
+                Log.w(TAG, "[SyncDebug] Transfer failed: received $receivedBytes of $expectedSize bytes. $exception")
+                val id = recordingId
+                if (receiver != null && id != null) {
+                    partialStore.save(id, receiver.data.copyOfRange(0, receiver.verifiedPrefix()))
+                }
             } finally {
                 activeTransfer.set(null)
             }
@@ -281,6 +500,103 @@ class PendantBleManager(context: Context) : BleManager(context) {
         )
     }
 
+    /**
+     * Stream the prepared file in framed mode, then request whatever is
+     * missing or corrupt until [receiver] is complete. A round ends when the
+     * window closing its last range arrives, or on a stall. Mirrors
+     * receive_framed() in sync.py.
+     */
+    private suspend fun receiveFramed(receiver: FramedReceiver, signal: Channel<Unit>) {
+        var ranges = listOf(receiver.verifiedPrefix() to 0)
+        for (round in 0..FRAMED_MAX_RETRANSMIT_ROUNDS) {
+            if (round > 0) {
+                ranges = receiver.missingRanges(FRAMED_RANGES_PER_COMMAND * FRAMED_COMMANDS_PER_ROUND)
+                Log.d(TAG, "[SyncDebug] Re-requesting ${ranges.size} range(s), ${ranges.sumOf { it.second }} bytes.")
+            }
+            val (lastOffset, lastLength) = ranges.last()
+            val roundEnd = if (lastLength == 0) receiver.data.size else lastOffset + lastLength
+            receiver.lastWindowEnd = -1
+            for (batch in ranges.chunked(FRAMED_RANGES_PER_COMMAND)) {
+                val command = ByteBuffer.allocate(1 + batch.size * 8).order(ByteOrder.LITTLE_ENDIAN)
+                command.put(COMMAND_START_STREAM_FRAMED)
+                batch.forEach { (offset, length) -> command.putInt(offset).putInt(length) }
+                writeCommand(command.array())
+            }
+            while (!receiver.isComplete() && receiver.lastWindowEnd != roundEnd) {
+                withTimeoutOrNull(FRAMED_STALL_TIMEOUT_MILLIS) { signal.receive() } ?: break
+            }
+            if (receiver.isComplete()) return
+        }
+        throw IOException("Retransmission rounds exhausted.")
+    }
+
+    /**
+     * Download every pending recording with a single STREAM_ALL command.
+     * Nothing is deleted on the pendant until acknowledgeFiles() is called
+     * with the returned IDs. Returns null if the pendant sends nothing,
+     * i.e. its firmware predates STREAM_ALL. A transfer cut short returns
+     * whichever recordings arrived intact.
+     */
+    suspend fun requestAllFiles(fileCount: Int): List<PendingRecording>? {
+        val partial = partialStore.oldest()
+        val command = if (partial != null) {
+            Log.d(TAG, "Resuming recording ${partial.first} at byte ${partial.second.size}.")
+            ByteBuffer.allocate(9).order(ByteOrder.LITTLE_ENDIAN)
+                .put(COMMAND_STREAM_ALL)
+                .putInt(partial.first)
+                .putInt(partial.second.size)
+                .array()
+        } else {
+            byteArrayOf(COMMAND_STREAM_ALL)
+        }
+        val parser = if (partial != null) {
+            BulkFrameParser(partial.first, partial.second, cipher)
+        } else {
+            BulkFrameParser(cipher = cipher)
+        }
+        val transferComplete = CompletableDeferred<ByteArray>()
+        val firstChunk = CompletableDeferred<Unit>()
+        activeTransfer.set(
+            TransferState(ByteArrayOutputStream(), transferComplete, 0, parser, firstChunk)
+        )
+        val startMillis = System.currentTimeMillis()
+        try {
+            writeCommand(command)
+            if (withTimeoutOrNull(BULK_FIRST_CHUNK_TIMEOUT_MILLIS) { firstChunk.await() } == null) {
+                Log.d(TAG, "STREAM_ALL unsupported, falling back to per-file transfers.")
+                return null
+            }
+            withTimeout(TRANSFER_TOTAL_TIMEOUT_MILLIS * fileCount) { transferComplete.await() }
+        } catch (exception: Exception) {
+            if (exception is CancellationException && exception !is TimeoutCancellationException) throw exception
+            Log.w(TAG, "[SyncDebug] Bulk transfer failed after ${parser.totalBytes} bytes. $exception")
+            parser.interruptedFrame()?.let { (id, data) -> partialStore.save(id, data) }
+        } finally {
+            activeTransfer.set(null)
+        }
+
+        val elapsedMillis = System.currentTimeMillis() - startMillis
+        Log.d(TAG, "[SyncDebug] Bulk transfer: ${parser.recordings.size} recording(s), ${parser.totalBytes} bytes in ${elapsedMillis}ms.")
+        if (parser.corruptIds.isNotEmpty()) {
+            Log.w(TAG, "Checksum mismatch for recording(s) ${parser.corruptIds}, leaving them on the pendant.")
+        }
+        // A finished batch held every pending recording, so any partial left
+        // is either assembled now or stale (e.g. the pendant couldn't resume it).
+        if (parser.finished) partialStore.discardAll()
+        return parser.recordings.toList()
+    }
+
+    /** Tell the pendant it may delete the given recordings, in ACK_IDS batches. */
+    suspend fun acknowledgeFiles(ids: List<Int>) {
+        for (batch in ids.chunked(BULK_ACK_MAX_IDS)) {
+            val payload = ByteBuffer.allocate(1 + batch.size * 4).order(ByteOrder.LITTLE_ENDIAN)
+            payload.put(COMMAND_ACK_IDS)
+            batch.forEach { payload.putInt(it) }
+            Log.d(TAG, "[SyncDebug] Sending ACK_IDS for ${batch.size} recording(s).")
+            writeCommand(payload.array())
+        }
+    }
+
     suspend fun acknowledgeFile() {
         Log.d(TAG, "[SyncDebug] Sending ACK_RECEIVED command.")
         writeCommand(COMMAND_ACK_RECEIVED)
@@ -293,6 +609,7 @@ class PendantBleManager(context: Context) : BleManager(context) {
         } catch (exception: Exception) {
             Log.w(TAG, "SYNC_DONE write failed: $exception")
         }
+        requestConnectionPriority(ConnectionPriorityRequest.CONNECTION_PRIORITY_BALANCED).enqueue()
     }
 
     companion object {
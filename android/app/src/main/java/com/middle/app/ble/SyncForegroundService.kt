@@ -29,6 +29,7 @@ import kotlinx.coroutines.delay
 import kotlinx.coroutines.flow.MutableStateFlow
 import kotlinx.coroutines.flow.StateFlow
 import kotlinx.coroutines.launch
+import java.io.File
 import java.security.SecureRandom
 import java.text.SimpleDateFormat
 import java.util.Date
@@ -49,6 +50,10 @@ class SyncForegroundService : Service() {
     private lateinit var repository: RecordingsRepository
     private lateinit var settings: Settings
 
+    // Set once a transcription fails so the rest of the session skips them.
+    @Volatile
+    private var skipTranscription = false
+
     override fun onCreate() {
         super.onCreate()
         repository = (application as MiddleApplication).repository
@@ -218,6 +223,12 @@ class SyncForegroundService : Service() {
                 }
             }
 
+            if (manager.startEncryption()) {
+                Log.d(TAG, "[sync] transport encryption on.")
+            } else {
+                Log.d(TAG, "[sync] transport encryption unavailable (older firmware).")
+            }
+
             val millivolts = manager.readVoltageMillivolts()
             if (millivolts != null) {
                 val volts = millivolts / 1000.0
@@ -232,6 +243,13 @@ class SyncForegroundService : Service() {
                 Log.d(TAG, "Voltage characteristic not available.")
             }
 
+            val stats = manager.readStats()
+            if (stats != null) {
+                Log.d(TAG, "Device stats: ${stats.entries.joinToString { "${it.key}=${it.value}" }}")
+            } else {
+                Log.d(TAG, "Stats characteristic not available.")
+            }
+
             updateNotification(getString(R.string.sync_notification_syncing))
             val fileCount = manager.readFileCount()
             Log.d(TAG, "[SyncDebug] readFileCount() returned $fileCount.")
@@ -241,15 +259,28 @@ class SyncForegroundService : Service() {
                 return
             }
 
-            var skipTranscription = false
+            skipTranscription = false
 
             // Enable notifications once for the whole session to avoid rapid
             // CCCD churn that destabilises the GATT link between files.
             manager.enableAudioNotifications()
             try {
-                for (i in 0 until fileCount) {
-                    Log.d(TAG, "Requesting file ${i + 1}/$fileCount...")
-                    updateNotification("Syncing file ${i + 1}/$fileCount...")
+                // Whatever bulk could not deliver (a frame that failed its CRC,
+                // or firmware without STREAM_ALL) goes through the per-file
+                // framed path, which retransmits only the damaged ranges.
+                var perFileCount = fileCount
+                val bulkRecordings = manager.requestAllFiles(fileCount)
+                if (bulkRecordings != null) {
+                    saveBulkRecordings(manager, bulkRecordings)
+                    delay(100)
+                    perFileCount = manager.readFileCount()
+                    Log.d(TAG, "[SyncDebug] $perFileCount file(s) left after bulk transfer.")
+                }
+                // Keeps filenames unique against the bulk ones saved this second.
+                val firstIndex = bulkRecordings?.size ?: 0
+                for (i in 0 until perFileCount) {
+                    Log.d(TAG, "Requesting file ${i + 1}/$perFileCount...")
+                    updateNotification("Syncing file ${i + 1}/$perFileCount...")
 
                     val imaData = manager.requestNextFile()
                     Log.d(TAG, "[SyncDebug] requestNextFile() returned ${if (imaData == null) "null" else "${imaData.size} bytes"}.")
@@ -257,78 +288,25 @@ class SyncForegroundService : Service() {
                     // Empty files are corrupt or aborted recordings. ACK to delete
                     // them from the pendant and continue to the next file.
                     if (imaData == null) {
-                        Log.d(TAG, "[SyncDebug] Skipping empty file ${i + 1}/$fileCount, sending ACK.")
+                        Log.d(TAG, "[SyncDebug] Skipping empty file ${i + 1}/$perFileCount, sending ACK.")
                         manager.acknowledgeFile()
-                        Log.d(TAG, "[SyncDebug] ACK sent for empty file ${i + 1}/$fileCount.")
+                        Log.d(TAG, "[SyncDebug] ACK sent for empty file ${i + 1}/$perFileCount.")
                         delay(300)
                         continue
                     }
 
                     val timestamp = SimpleDateFormat("yyyyMMdd_HHmmss", Locale.US).format(Date())
-                    val filename = "recording_${timestamp}_$i.m4a"
+                    val filename = "recording_${timestamp}_${firstIndex + i}.m4a"
                     val audioFile = repository.saveEncodedRecording(imaData, filename)
                     Log.d(TAG, "[SyncDebug] saveEncodedRecording() returned path=${audioFile.absolutePath} size=${audioFile.length()} bytes.")
 
                     manager.acknowledgeFile()
-                    Log.d(TAG, "[SyncDebug] ACK sent for file ${i + 1}/$fileCount.")
+                    Log.d(TAG, "[SyncDebug] ACK sent for file ${i + 1}/$perFileCount.")
                     // Brief pause between files to let the pendant settle before
                     // the next COMMAND_REQUEST_NEXT, reducing GATT instability.
                     delay(300)
 
-                    if (!skipTranscription && settings.transcriptionEnabled) {
-                        val provider = settings.transcriptionProvider
-                        val apiKey = getSelectedProviderApiKey()
-                        if (apiKey.isEmpty()) {
-                            val message = "Transcription skipped: missing ${providerDisplayName(provider)} API key"
-                            Log.w(TAG, message)
-                            WebhookLog.error("$message ($filename)")
-                            updateNotification(message)
-                            skipTranscription = true
-                        } else {
-                            scope.launch(Dispatchers.IO) {
-                                val client = TranscriptionClient(provider, apiKey)
-                                val text = client.transcribe(audioFile)
-                                if (text != null) {
-                                    repository.saveTranscript(text, audioFile)
-                                    Log.d(TAG, "Saved transcript for $filename.")
-
-                                    val webhookUrl = settings.webhookUrl.trim()
-                                    if (settings.webhookEnabled && webhookUrl.isNotEmpty()) {
-                                        val template = settings.webhookBodyTemplate.ifBlank {
-                                            Settings.DEFAULT_WEBHOOK_BODY_TEMPLATE
-                                        }
-                                        WebhookLog.info("POST $webhookUrl ($filename)")
-                                        val appRetryQueue = (application as MiddleApplication).retryQueue
-                                        try {
-                                            val result = WebhookClient.post(webhookUrl, text, template)
-                                            if (result.success) {
-                                                Log.d(TAG, "Webhook POST succeeded for $filename.")
-                                                WebhookLog.info("${result.code} OK ($filename)")
-                                            } else {
-                                                Log.w(TAG, "Webhook POST failed with status ${result.code} for $filename.")
-                                                WebhookLog.error("${result.code} ${result.message} ($filename): ${result.body}")
-                                                if (result.code !in 400..499) {
-                                                    appRetryQueue.enqueue(text, webhookUrl, template, filename)
-                                                }
-                                            }
-                                        } catch (exception: Exception) {
-                                            Log.w(TAG, "Webhook POST error for $filename: $exception")
-                                            WebhookLog.error("$filename: ${exception::class.simpleName}: ${exception.message}")
-                                            appRetryQueue.enqueue(text, webhookUrl, template, filename)
-                                        }
-                                    }
-                                } else {
-                                    // Disable further transcription attempts this
-                                    // session if the first one fails, same as sync.py.
-                                    val message = "Transcription failed (${providerDisplayName(provider)})"
-                                    Log.w(TAG, message)
-                                    WebhookLog.error("$message ($filename)")
-                                    updateNotification(message)
-                                    skipTranscription = true
-                                }
-                            }
-                        }
-                    }
+                    transcribeInBackground(audioFile, filename)
                 }
 
                 val remainingFileCount = manager.readFileCount()
@@ -354,6 +332,91 @@ class SyncForegroundService : Service() {
         }
     }
 
+    /**
+     * Save everything STREAM_ALL delivered, then ACK it in batches so the
+     * pendant deletes only what was saved. Empty files are ACKed unsaved,
+     * same as the per-file path.
+     */
+    private suspend fun saveBulkRecordings(
+        manager: PendantBleManager,
+        recordings: List<PendantBleManager.PendingRecording>,
+    ) {
+        val saved = mutableListOf<Pair<File, String>>()
+        for ((index, recording) in recordings.withIndex()) {
+            if (recording.data.isEmpty()) continue
+            val timestamp = SimpleDateFormat("yyyyMMdd_HHmmss", Locale.US).format(Date())
+            val filename = "recording_${timestamp}_$index.m4a"
+            val audioFile = repository.saveEncodedRecording(recording.data, filename)
+            Log.d(TAG, "[SyncDebug] saveEncodedRecording() returned path=${audioFile.absolutePath} size=${audioFile.length()} bytes.")
+            saved.add(audioFile to filename)
+        }
+        manager.acknowledgeFiles(recordings.map { it.id })
+        for ((audioFile, filename) in saved) {
+            transcribeInBackground(audioFile, filename)
+        }
+    }
+
+    /**
+     * Transcribe a saved recording on the IO dispatcher and post the text to
+     * the webhook if one is configured.
+     */
+    private fun transcribeInBackground(audioFile: File, filename: String) {
+        if (!skipTranscription && settings.transcriptionEnabled) {
+            val provider = settings.transcriptionProvider
+            val apiKey = getSelectedProviderApiKey()
+            if (apiKey.isEmpty()) {
+                val message = "Transcription skipped: missing ${providerDisplayName(provider)} API key"
+                Log.w(TAG, message)
+                WebhookLog.error("$message ($filename)")
+                updateNotification(message)
+                skipTranscription = true
+            } else {
+                scope.launch(Dispatchers.IO) {
+                    val client = TranscriptionClient(provider, apiKey)
+                    val text = client.transcribe(audioFile)
+                    if (text != null) {
+                        repository.saveTranscript(text, audioFile)
+                        Log.d(TAG, "Saved transcript for $filename.")
+
+                        val webhookUrl = settings.webhookUrl.trim()
+                        if (settings.webhookEnabled && webhookUrl.isNotEmpty()) {
+                            val template = settings.webhookBodyTemplate.ifBlank {
+                                Settings.DEFAULT_WEBHOOK_BODY_TEMPLATE
+                            }
+                            WebhookLog.info("POST $webhookUrl ($filename)")
+                            val appRetryQueue = (application as MiddleApplication).retryQueue
+                            try {
+                                val result = WebhookClient.post(webhookUrl, text, template)
+                                if (result.success) {
+                                    Log.d(TAG, "Webhook POST succeeded for $filename.")
+                                    WebhookLog.info("${result.code} OK ($filename)")
+                                } else {
+                                    Log.w(TAG, "Webhook POST failed with status ${result.code} for $filename.")
+                                    WebhookLog.error("${result.code} ${result.message} ($filename): ${result.body}")
+                                    if (result.code !in 400..499) {
+                                        appRetryQueue.enqueue(text, webhookUrl, template, filename)
+                                    }
+                                }
+                            } catch (exception: Exception) {
+                                Log.w(TAG, "Webhook POST error for $filename: $exception")
+                                WebhookLog.error("$filename: ${exception::class.simpleName}: ${exception.message}")
+                                appRetryQueue.enqueue(text, webhookUrl, template, filename)
+                            }
+                        }
+                    } else {
+                        // Disable further transcription attempts this
+                        // session if the first one fails, same as sync.py.
+                        val message = "Transcription failed (${providerDisplayName(provider)})"
+                        Log.w(TAG, message)
+                        WebhookLog.error("$message ($filename)")
+                        updateNotification(message)
+                        skipTranscription = true
+                    }
+                }
+            }
+        }
+    }
+
     private fun maybePostBatteryLowNotification(millivolts: Int) {
         if (millivolts >= BATTERY_LOW_THRESHOLD_MV) return
         val now = System.currentTimeMillis()
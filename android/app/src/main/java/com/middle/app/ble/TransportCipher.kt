@@ -0,0 +1,45 @@
+package com.middle.app.ble
+
+import java.nio.ByteBuffer
+import javax.crypto.Cipher
+import javax.crypto.Mac
+import javax.crypto.spec.IvParameterSpec
+import javax.crypto.spec.SecretKeySpec
+
+/**
+ * Decrypts recording bytes from an encrypted session. CTR is its own
+ * inverse, and any byte can be decrypted on its own given its recording ID
+ * and file offset. Mirrors TransportCipher in sync.py.
+ */
+class TransportCipher(token: ByteArray, pendantNonce: ByteArray, clientNonce: ByteArray) {
+
+    private val key: SecretKeySpec
+    private val aes = Cipher.getInstance("AES/CTR/NoPadding")
+
+    init {
+        val mac = Mac.getInstance("HmacSHA256")
+        mac.init(SecretKeySpec(token, "HmacSHA256"))
+        mac.update(TRANSPORT_KEY_LABEL)
+        mac.update(pendantNonce)
+        mac.update(clientNonce)
+        key = SecretKeySpec(mac.doFinal().copyOf(TRANSPORT_KEY_SIZE), "AES")
+    }
+
+    /**
+     * Decrypts, in place, [length] bytes of [buffer] from [start], which sit
+     * at [offset] in recording [recordingId]'s file.
+     */
+    fun crypt(recordingId: Int, offset: Int, buffer: ByteArray, start: Int = 0, length: Int = buffer.size - start) {
+        if (length == 0) return
+        val counter = ByteBuffer.allocate(16)
+            .putInt(recordingId)
+            .putInt(0)
+            .putLong((offset / 16).toLong())
+            .array()
+        aes.init(Cipher.DECRYPT_MODE, key, IvParameterSpec(counter))
+        // Throw away the keystream in front of the offset within its block.
+        val skip = offset % 16
+        if (skip > 0) aes.update(ByteArray(skip))
+        aes.doFinal(buffer, start, length, buffer, start)
+    }
+}
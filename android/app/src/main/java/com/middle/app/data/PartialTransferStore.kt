@@ -0,0 +1,49 @@
+package com.middle.app.data
+
+import android.content.Context
+import android.util.Log
+import java.io.File
+
+private const val TAG = "PartialTransferStore"
+
+/**
+ * Bytes of interrupted pendant transfers, keyed by recording ID, so the next
+ * attempt (even after a reconnect) resumes instead of starting over.
+ * Mirrors the .partial directory used by sync.py.
+ */
+class PartialTransferStore(context: Context) {
+
+    private val partialDirectory = File(context.filesDir, "partial").also { it.mkdirs() }
+
+    private fun fileFor(recordingId: Int) = File(partialDirectory, "rec_%06d.part".format(recordingId))
+
+    /** Returns the saved bytes for [recordingId], or an empty array. */
+    fun load(recordingId: Int): ByteArray {
+        val file = fileFor(recordingId)
+        return if (file.exists()) file.readBytes() else ByteArray(0)
+    }
+
+    /** Returns the lowest-ID partial transfer on disk, if any. */
+    fun oldest(): Pair<Int, ByteArray>? {
+        val recordingId = partialDirectory
+            .listFiles { file -> file.extension == "part" }
+            ?.mapNotNull { it.nameWithoutExtension.removePrefix("rec_").toIntOrNull() }
+            ?.minOrNull()
+            ?: return null
+        return recordingId to load(recordingId)
+    }
+
+    fun save(recordingId: Int, data: ByteArray) {
+        if (data.isEmpty()) return
+        fileFor(recordingId).writeBytes(data)
+        Log.d(TAG, "Saved ${data.size} bytes of recording $recordingId for resuming.")
+    }
+
+    fun discard(recordingId: Int) {
+        fileFor(recordingId).delete()
+    }
+
+    fun discardAll() {
+        partialDirectory.listFiles { file -> file.extension == "part" }?.forEach { it.delete() }
+    }
+}
@@ -0,0 +1,34 @@
+package com.middle.app.audio
+
+import java.io.File
+import org.junit.Assert.assertArrayEquals
+import org.junit.Assert.assertEquals
+import org.junit.Test
+
+/**
+ * Checks [ImaAdpcmDecoder] against the golden vectors in the repository's
+ * test/golden directory, which the firmware's native tests and
+ * tools/check_golden.sh (ima_to_wav and sync.py) check too: each .ima file
+ * must decode to exactly the signed 16-bit LE samples in its .pcm twin.
+ */
+class ImaAdpcmDecoderTest {
+
+    // Gradle runs unit tests from the module directory, android/app.
+    private val goldenDirectory = File("../../test/golden")
+
+    private fun golden(name: String): ByteArray = File(goldenDirectory, name).readBytes()
+
+    @Test
+    fun decodesGatedVersion3Golden() {
+        val ima = golden("gated_v3.ima")
+        assertArrayEquals(golden("gated_v3.pcm"), ImaAdpcmDecoder.decodeFile(ima))
+        assertEquals(SAMPLE_RATE, ImaAdpcmDecoder.sampleRate(ima))
+    }
+
+    @Test
+    fun decodesVersion4GoldenAtItsRate() {
+        val ima = golden("rate_v4.ima")
+        assertArrayEquals(golden("rate_v4.pcm"), ImaAdpcmDecoder.decodeFile(ima))
+        assertEquals(24000, ImaAdpcmDecoder.sampleRate(ima))
+    }
+}
@@ -0,0 +1,421 @@
+// IMA ADPCM encoder and decoder and the .ima recording format. Nothing here
+// touches hardware or Arduino, so the firmware and host tools (see tools/)
+// share one copy of the tables and algorithm. Multi-byte fields are read and
+// written in host order, which is little-endian on the ESP32 and on every
+// host we decode on.
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// IMA ADPCM step size table — indexed by step_index (0..88).
+static const int16_t adpcm_step_table[89] = {
+    7,     8,     9,     10,    11,    12,    13,    14,    16,    17,
+    19,    21,    23,    25,    28,    31,    34,    37,    41,    45,
+    50,    55,    60,    66,    73,    80,    88,    97,    107,   118,
+    130,   143,   157,   173,   190,   209,   230,   253,   279,   307,
+    337,   371,   408,   449,   494,   544,   598,   658,   724,   796,
+    876,   963,   1060,  1166,  1282,  1411,  1552,  1707,  1878,  2066,
+    2272,  2499,  2749,  3024,  3327,  3660,  4026,  4428,  4871,  5358,
+    5894,  6484,  7132,  7845,  8630,  9493,  10442, 11487, 12635, 13899,
+    15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767};
+
+// Maps each encoded nibble to a step_index adjustment.
+static const int8_t adpcm_index_table[16] = {-1, -1, -1, -1, 2, 4, 6, 8,
+                                              -1, -1, -1, -1, 2, 4, 6, 8};
+
+struct adpcm_state {
+  int16_t predicted_sample;
+  uint8_t step_index;
+};
+
+// Encode one 16-bit signed PCM sample into a 4-bit IMA ADPCM nibble.
+inline uint8_t adpcm_encode_sample(int16_t sample, adpcm_state &state) {
+  int32_t difference = sample - state.predicted_sample;
+  uint8_t nibble = 0;
+  if (difference < 0) {
+    nibble = 8;
+    difference = -difference;
+  }
+
+  int16_t step = adpcm_step_table[state.step_index];
+  // Quantize the difference against the current step size. Each bit in the
+  // nibble represents whether the difference exceeds successively halved
+  // fractions of the step.
+  int32_t delta = step >> 3;
+  if (difference >= step) {
+    nibble |= 4;
+    difference -= step;
+    delta += step;
+  }
+  step >>= 1;
+  if (difference >= step) {
+    nibble |= 2;
+    difference -= step;
+    delta += step;
+  }
+  step >>= 1;
+  if (difference >= step) {
+    nibble |= 1;
+    delta += step;
+  }
+
+  // Apply the reconstructed delta so the decoder stays in sync with us. Clamp
+  // in 32 bits, as the decoders do; an int16 accumulator would wrap instead.
+  int32_t predicted = state.predicted_sample;
+  if (nibble & 8) {
+    predicted -= delta;
+  } else {
+    predicted += delta;
+  }
+  if (predicted > 32767) {
+    predicted = 32767;
+  } else if (predicted < -32768) {
+    predicted = -32768;
+  }
+  state.predicted_sample = (int16_t)predicted;
+
+  int new_index = state.step_index + adpcm_index_table[nibble];
+  if (new_index < 0) {
+    new_index = 0;
+  } else if (new_index > 88) {
+    new_index = 88;
+  }
+  state.step_index = (uint8_t)new_index;
+
+  return nibble;
+}
+
+// Recording file format, version 2: a 12-byte header followed by fixed-size
+// blocks. Each block begins with the encoder state at its first sample
+// (predicted sample as int16 LE, step index, one reserved byte), like IMA/DVI
+// WAV blocks, so a corrupted byte only damages its own block and decoders can
+// start at any block boundary. Version 1 files (a bare uint32 sample count and
+// one continuous nibble stream) are told apart by the magic and still decoded
+// here and by the Android app.
+//
+// Version 3 is version 2 plus silence blocks, written by the voice activity
+// gate: a block whose reserved byte is adpcm_block_silence holds no audio,
+// just a uint32 LE count of zero samples for the decoder to emit. It still
+// takes a whole block slot so later blocks stay at fixed offsets. Files
+// without silence blocks keep version 2, and older decoders reject version 3
+// instead of playing noise.
+//
+// Version 4 is version 3 with a uint32 LE sample rate after the header, for
+// builds recording at a rate other than the default 16 kHz. Default-rate
+// builds keep writing versions 2 and 3, which every decoder reads.
+static const uint8_t recording_format_magic[4] = {'M', 'D', 'L', 'A'};
+static const uint8_t recording_format_version = 2;
+static const uint8_t recording_format_version_gated = 3;
+static const uint8_t recording_format_version_rate = 4;
+static const uint32_t recording_default_sample_rate = 16000;
+static const uint8_t adpcm_block_silence = 0x01;
+
+// Codec IDs, stored in the header byte that version 2 files left at zero.
+static const uint8_t codec_ima_adpcm = 0;
+
+static const size_t adpcm_block_bytes = 512;
+static const size_t adpcm_block_header_bytes = 4;
+static const uint16_t adpcm_samples_per_block =
+    (adpcm_block_bytes - adpcm_block_header_bytes) * 2;
+
+struct __attribute__((packed)) recording_header {
+  uint8_t magic[4];
+  uint8_t version;
+  uint8_t codec;
+  uint16_t samples_per_block;
+  uint32_t sample_count;
+};
+
+inline recording_header
+make_recording_header(uint32_t sample_count,
+                      uint8_t version = recording_format_version,
+                      uint8_t codec = codec_ima_adpcm) {
+  recording_header header = {};
+  memcpy(header.magic, recording_format_magic, sizeof(header.magic));
+  header.version = version;
+  header.codec = codec;
+  header.samples_per_block = adpcm_samples_per_block;
+  header.sample_count = sample_count;
+  return header;
+}
+
+// The header as a version 4 file stores it.
+struct __attribute__((packed)) recording_header_with_rate {
+  recording_header header;
+  uint32_t sample_rate;
+};
+
+// Bytes before the first block of a version 2, 3 or 4 file.
+inline size_t recording_header_bytes(uint8_t version) {
+  return version == recording_format_version_rate
+             ? sizeof(recording_header_with_rate)
+             : sizeof(recording_header);
+}
+
+// Number of samples stored in `data_bytes` of block payload, counting the
+// trailing partial block.
+inline uint32_t adpcm_samples_in_payload(size_t data_bytes) {
+  uint32_t samples = (data_bytes / adpcm_block_bytes) * adpcm_samples_per_block;
+  size_t remainder = data_bytes % adpcm_block_bytes;
+  if (remainder > adpcm_block_header_bytes) {
+    samples += (remainder - adpcm_block_header_bytes) * 2;
+  }
+  return samples;
+}
+
+// Streaming encoder state carried across I2S buffers: the ADPCM predictor,
+// where we are within the current block, and a half-filled output byte.
+struct adpcm_block_encoder {
+  adpcm_state state;
+  uint16_t block_sample_index;
+  bool nibble_pending;
+  uint8_t packed_byte;
+};
+
+// Largest output of one adpcm_encode_frames() call: a byte per two samples,
+// plus a block header for every block started (at most one per buffer).
+constexpr size_t adpcm_encoded_bytes_max(size_t frame_count) {
+  return (frame_count + 1) / 2 + 1 +
+         (frame_count / adpcm_samples_per_block + 1) * adpcm_block_header_bytes;
+}
+
+inline size_t adpcm_write_block_header(const adpcm_state &state, uint8_t *out) {
+  uint16_t predicted = (uint16_t)state.predicted_sample;
+  out[0] = predicted & 0xFF;
+  out[1] = predicted >> 8;
+  out[2] = state.step_index;
+  out[3] = 0;
+  return adpcm_block_header_bytes;
+}
+
+// Encodes `frame_count` I2S frames into packed nibbles plus block headers.
+// `slot_format::sample(frames, i)` gives frame i's 16-bit sample (see
+// capture_pipeline.h). Returns the number of bytes written to `out`, which
+// must hold adpcm_encoded_bytes_max(frame_count).
+//
+// Bit-exact with adpcm_encode_sample(), but keeps the predictor in registers
+// for the whole buffer and quantizes with masks instead of branches, which
+// the Xtensa core turns into conditional moves and a CLAMPS.
+template <typename slot_format>
+inline size_t adpcm_encode_frames(const typename slot_format::word *frames,
+                                  size_t frame_count,
+                                  adpcm_block_encoder &encoder, uint8_t *out) {
+  uint8_t *cursor = out;
+  int32_t predicted = encoder.state.predicted_sample;
+  int32_t step_index = encoder.state.step_index;
+  uint16_t block_sample_index = encoder.block_sample_index;
+  bool nibble_pending = encoder.nibble_pending;
+  uint8_t packed_byte = encoder.packed_byte;
+
+  for (size_t i = 0; i < frame_count; i++) {
+    if (block_sample_index == 0) {
+      adpcm_state block_state = {(int16_t)predicted, (uint8_t)step_index};
+      cursor += adpcm_write_block_header(block_state, cursor);
+    }
+
+    int32_t difference = slot_format::sample(frames, i) - predicted;
+    // All ones when the difference is negative, zero otherwise.
+    int32_t sign = difference >> 31;
+    difference = (difference ^ sign) - sign;
+
+    int32_t step = adpcm_step_table[step_index];
+    int32_t delta = step >> 3;
+    int32_t mask = -(int32_t)(difference >= step);
+    uint32_t nibble = mask & 4;
+    difference -= step & mask;
+    delta += step & mask;
+    step >>= 1;
+    mask = -(int32_t)(difference >= step);
+    nibble |= mask & 2;
+    difference -= step & mask;
+    delta += step & mask;
+    step >>= 1;
+    mask = -(int32_t)(difference >= step);
+    nibble |= mask & 1;
+    delta += step & mask;
+    nibble |= sign & 8;
+
+    predicted += (delta ^ sign) - sign;
+    predicted = predicted > 32767 ? 32767
+                                  : (predicted < -32768 ? -32768 : predicted);
+    step_index += adpcm_index_table[nibble];
+    step_index = step_index > 88 ? 88 : (step_index < 0 ? 0 : step_index);
+
+    // Pack two nibbles per byte, low nibble first.
+    if (nibble_pending) {
+      *cursor++ = packed_byte | (uint8_t)(nibble << 4);
+    } else {
+      packed_byte = (uint8_t)nibble;
+    }
+    nibble_pending = !nibble_pending;
+
+    if (++block_sample_index == adpcm_samples_per_block) {
+      block_sample_index = 0;
+    }
+  }
+
+  encoder.state.predicted_sample = (int16_t)predicted;
+  encoder.state.step_index = (uint8_t)step_index;
+  encoder.block_sample_index = block_sample_index;
+  encoder.nibble_pending = nibble_pending;
+  encoder.packed_byte = packed_byte;
+  return cursor - out;
+}
+
+// Reference path: same output as adpcm_encode_frames(), one
+// adpcm_encode_sample() call per sample.
+template <typename slot_format>
+inline size_t
+adpcm_encode_frames_scalar(const typename slot_format::word *frames,
+                           size_t frame_count, adpcm_block_encoder &encoder,
+                           uint8_t *out) {
+  uint8_t *cursor = out;
+  for (size_t i = 0; i < frame_count; i++) {
+    if (encoder.block_sample_index == 0) {
+      cursor += adpcm_write_block_header(encoder.state, cursor);
+    }
+    int16_t sample_16 = (int16_t)slot_format::sample(frames, i);
+    uint8_t nibble = adpcm_encode_sample(sample_16, encoder.state);
+    if (!encoder.nibble_pending) {
+      encoder.packed_byte = nibble & 0x0F;
+      encoder.nibble_pending = true;
+    } else {
+      *cursor++ = encoder.packed_byte | (nibble << 4);
+      encoder.nibble_pending = false;
+    }
+    if (++encoder.block_sample_index == adpcm_samples_per_block) {
+      encoder.block_sample_index = 0;
+    }
+  }
+  return cursor - out;
+}
+
+// Size of the version 1 header: a bare uint32 sample count.
+static const size_t recording_v1_header_bytes = 4;
+
+// Decodes up to `sample_count` samples of packed nibbles (low nibble first)
+// starting from `state`, stopping early if `data` runs out. Returns the
+// number of samples written to `out`. The inverse of adpcm_encode_sample(),
+// bit-exact with ImaAdpcmDecoder.kt.
+inline size_t adpcm_decode_nibbles(const uint8_t *data, size_t data_bytes,
+                                   size_t sample_count, adpcm_state state,
+                                   int16_t *out) {
+  if (sample_count > data_bytes * 2) {
+    sample_count = data_bytes * 2;
+  }
+  int32_t predicted = state.predicted_sample;
+  int32_t step_index = state.step_index > 88 ? 88 : state.step_index;
+  for (size_t i = 0; i < sample_count; i++) {
+    uint32_t nibble = (data[i / 2] >> ((i & 1) * 4)) & 0x0F;
+    int32_t step = adpcm_step_table[step_index];
+    int32_t delta = step >> 3;
+    if (nibble & 4) {
+      delta += step;
+    }
+    if (nibble & 2) {
+      delta += step >> 1;
+    }
+    if (nibble & 1) {
+      delta += step >> 2;
+    }
+    predicted += (nibble & 8) ? -delta : delta;
+    predicted = predicted > 32767 ? 32767
+                                  : (predicted < -32768 ? -32768 : predicted);
+    out[i] = (int16_t)predicted;
+    step_index += adpcm_index_table[nibble];
+    step_index = step_index > 88 ? 88 : (step_index < 0 ? 0 : step_index);
+  }
+  return sample_count;
+}
+
+// Sample count from the header of a version 1 to 4 file, or -1 if the file
+// is truncated, a version this code doesn't know, or another codec.
+inline long recording_sample_count(const uint8_t *file, size_t size) {
+  if (size >= sizeof(recording_header) &&
+      memcmp(file, recording_format_magic, sizeof(recording_format_magic)) == 0) {
+    recording_header header;
+    memcpy(&header, file, sizeof(header));
+    if ((header.version != recording_format_version &&
+         header.version != recording_format_version_gated &&
+         header.version != recording_format_version_rate) ||
+        header.codec != codec_ima_adpcm || header.samples_per_block == 0 ||
+        size < recording_header_bytes(header.version)) {
+      return -1;
+    }
+    return header.sample_count;
+  }
+  if (size < recording_v1_header_bytes) {
+    return -1;
+  }
+  uint32_t sample_count;
+  memcpy(&sample_count, file, sizeof(sample_count));
+  return sample_count;
+}
+
+// Sample rate of a file that recording_sample_count() accepts.
+inline uint32_t recording_sample_rate(const uint8_t *file, size_t size) {
+  if (size >= sizeof(recording_header_with_rate) &&
+      memcmp(file, recording_format_magic, sizeof(recording_format_magic)) == 0 &&
+      file[sizeof(recording_format_magic)] == recording_format_version_rate) {
+    uint32_t sample_rate;
+    memcpy(&sample_rate, file + sizeof(recording_header), sizeof(sample_rate));
+    return sample_rate;
+  }
+  return recording_default_sample_rate;
+}
+
+// Decodes a whole recording into `out`, which must hold
+// recording_sample_count() samples. Silence blocks become zeros. Returns the
+// number of samples written, which is short if the file is truncated, or -1
+// if recording_sample_count() rejects the file.
+inline long recording_decode(const uint8_t *file, size_t size, int16_t *out) {
+  long total = recording_sample_count(file, size);
+  if (total < 0) {
+    return -1;
+  }
+  if (memcmp(file, recording_format_magic, sizeof(recording_format_magic)) != 0 ||
+      size < sizeof(recording_header)) {
+    return (long)adpcm_decode_nibbles(file + recording_v1_header_bytes,
+                                      size - recording_v1_header_bytes,
+                                      (size_t)total, adpcm_state{0, 0}, out);
+  }
+
+  recording_header header;
+  memcpy(&header, file, sizeof(header));
+  size_t block_bytes = adpcm_block_header_bytes + header.samples_per_block / 2;
+  bool gated = header.version != recording_format_version;
+  size_t remaining = (size_t)total;
+  size_t written = 0;
+  for (size_t offset = recording_header_bytes(header.version);
+       remaining > 0 && offset + adpcm_block_header_bytes < size;
+       offset += block_bytes) {
+    const uint8_t *block = file + offset;
+    size_t available = size - offset < block_bytes ? size - offset : block_bytes;
+    if (gated && (block[3] & adpcm_block_silence)) {
+      if (available < adpcm_block_header_bytes + sizeof(uint32_t)) {
+        break;
+      }
+      uint32_t silent;
+      memcpy(&silent, block + adpcm_block_header_bytes, sizeof(silent));
+      size_t count = silent < remaining ? silent : remaining;
+      memset(out + written, 0, count * sizeof(int16_t));
+      written += count;
+      remaining -= count;
+      continue;
+    }
+    adpcm_state state;
+    memcpy(&state.predicted_sample, block, sizeof(state.predicted_sample));
+    state.step_index = block[2];
+    size_t count = remaining < header.samples_per_block
+                       ? remaining
+                       : header.samples_per_block;
+    size_t decoded = adpcm_decode_nibbles(
+        block + adpcm_block_header_bytes, available - adpcm_block_header_bytes,
+        count, state, out + written);
+    written += decoded;
+    remaining -= count;
+  }
+  return (long)written;
+}
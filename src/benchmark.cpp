@@ -0,0 +1,90 @@
+#include "benchmark.h"
+
+#include <esp_random.h>
+
+#include "firmware.h"
+#include "live_stream.h"
+
+uint32_t benchmark_length = 0;
+static uint8_t benchmark_pattern[stream_buffer_bytes];
+
+// When the notify loop sent the first and latest benchmark packets, the
+// longest gap between two, and the bytes handed to NimBLE.
+struct benchmark_timing {
+  uint32_t first;
+  uint32_t last;
+  uint32_t longest_gap;
+  uint32_t bytes;
+  uint32_t packets;
+};
+
+static benchmark_timing benchmark_sends = {};
+
+void benchmark_packet_fill(uint8_t *out, uint32_t offset, size_t count) {
+  // The send time is filled in by benchmark_stamp().
+  uint32_t header[2] = {offset, 0};
+  memcpy(out, header, sizeof(header));
+  memcpy(out + sizeof(header), benchmark_pattern, count);
+}
+
+void benchmark_stamp(struct os_mbuf *packet) {
+  uint32_t now = micros();
+  if (benchmark_sends.packets == 0) {
+    benchmark_sends.first = now;
+  } else if (now - benchmark_sends.last > benchmark_sends.longest_gap) {
+    benchmark_sends.longest_gap = now - benchmark_sends.last;
+  }
+  benchmark_sends.last = now;
+  benchmark_sends.bytes += OS_MBUF_PKTLEN(packet);
+  benchmark_sends.packets++;
+  memcpy(packet->om_data + sizeof(uint32_t), &now, sizeof(now));
+}
+
+void run_benchmark(const uint8_t *payload, size_t length) {
+  if (!client_connected || ble_server == nullptr || !stream_pipeline_init()) {
+    return;
+  }
+  stream_prepared_file_release();
+  uint8_t kind = length >= 1 ? payload[0] : benchmark_kind_link;
+  uint32_t bytes = 0;
+  if (length >= 1 + sizeof(bytes)) {
+    memcpy(&bytes, payload + 1, sizeof(bytes));
+  }
+  if (bytes == 0) {
+    bytes = BENCHMARK_DEFAULT_BYTES;
+  }
+  uint16_t connection_id = ble_server->getConnId();
+  benchmark_result result = {};
+  result.sequence = stream_window_sequence;
+  result.kind = kind;
+  if (kind == benchmark_kind_flash) {
+    benchmark_flash_read(bytes, stream_chunk_size(connection_id), result);
+  } else {
+    esp_fill_random(benchmark_pattern, sizeof(benchmark_pattern));
+    benchmark_length = bytes;
+    benchmark_sends = {};
+    run_stream_pipeline(stream_mode_benchmark);
+    result.bytes = benchmark_sends.bytes;
+    result.packets = notify_stats.sent;
+    result.microseconds = benchmark_sends.last - benchmark_sends.first;
+    result.longest_microseconds = benchmark_sends.longest_gap;
+    result.retries = notify_stats.retries;
+    result.failures = notify_stats.failures;
+  }
+  link_parameters link = read_link_parameters(connection_id);
+  result.interval = link.interval;
+  result.mtu = link.mtu;
+  result.phy = link.tx_phy | (link.rx_phy << 8);
+  DBG("[ble] benchmark %s: %lu bytes, %lu packets in %lu us\r\n",
+      kind == benchmark_kind_flash ? "flash" : "link",
+      (unsigned long)result.bytes, (unsigned long)result.packets,
+      (unsigned long)result.microseconds);
+
+  // 44 bytes, more than one notification holds below an MTU of 47.
+  if (!send_split_notification(connection_id,
+                               audio_data_characteristic->getHandle(),
+                               (const uint8_t *)&result, sizeof(result),
+                               stream_chunk_size(connection_id))) {
+    DBG("[ble] could not send the benchmark result\r\n");
+  }
+}
@@ -0,0 +1,65 @@
+// BENCHMARK measures the link apart from flash and the codec. Its payload is
+// a kind byte and a uint32 LE byte count (0 for BENCHMARK_DEFAULT_BYTES).
+// The link kind streams that many bytes of random data through the same
+// reader, pool and notify loop as a recording. Each notification starts with
+// a uint32 LE sequence number counted in bytes, as in framed mode, and the
+// uint32 LE micros() at which the notify loop handed it to NimBLE, so the
+// client can see how long packets wait in the stack. The flash kind reads up
+// to that many bytes of the stored recordings in stream-sized reads and
+// sends nothing else. Either way a benchmark_result packet ends the run.
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct os_mbuf;
+
+#ifndef BENCHMARK_DEFAULT_BYTES
+#define BENCHMARK_DEFAULT_BYTES (256 * 1024)
+#endif
+static const uint8_t benchmark_kind_link = 0;
+static const uint8_t benchmark_kind_flash = 1;
+static const size_t benchmark_packet_header_bytes = 8;
+
+// Ends a benchmark, after its data if any: sequence stream_window_sequence,
+// then these fields as uint32 LE, split as send_split_notification() does.
+// For the flash kind, `packets` counts reads, `microseconds` spans all of
+// them including opening the files, and `longest_microseconds` is the
+// slowest read; retries and failures are 0.
+struct benchmark_result {
+  uint32_t sequence;
+  uint32_t kind;
+  uint32_t bytes;
+  uint32_t packets;
+  // First to last send, and the longest gap between two sends.
+  uint32_t microseconds;
+  uint32_t longest_microseconds;
+  // Pool waits and failed notifications.
+  uint32_t retries;
+  uint32_t failures;
+  // Connection interval in 1.25 ms units, MTU, and TX PHY | RX PHY << 8.
+  uint32_t interval;
+  uint32_t mtu;
+  uint32_t phy;
+};
+
+// Bytes the link benchmark in progress streams, for the stream reader.
+extern uint32_t benchmark_length;
+
+// Writes the benchmark packet for `offset` to `out`: the header, then `count`
+// bytes of the pattern. `out` has room for benchmark_packet_header_bytes +
+// `count`.
+void benchmark_packet_fill(uint8_t *out, uint32_t offset, size_t count);
+
+// Writes the send time into a benchmark packet just before it goes to
+// NimBLE.
+void benchmark_stamp(struct os_mbuf *packet);
+
+// Runs the BENCHMARK in a command payload.
+void run_benchmark(const uint8_t *payload, size_t length);
+
+// Reads up to `length` bytes of the stored recordings the way the stream
+// reader does, one notification's worth at a time, without sending any.
+// Defined in main.cpp, next to the recording store.
+void benchmark_flash_read(uint32_t length, size_t read_size,
+                          benchmark_result &result);
@@ -0,0 +1,96 @@
+// Compile-time description of the recording chain: where the microphone's
+// samples sit in an I2S buffer, the sample rate, the codec, and the buffer
+// sizes that follow from them. Standard C++ only.
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Slot formats say how frames are laid out in an I2S read and how a 16-bit
+// sample comes out of one. The INMP441 sends 24-bit audio left-justified in a
+// 32-bit slot, so >> 16 yields a signed 16-bit sample. `word` is the DMA
+// element type and `data_bits` the I2S data bit width.
+//
+// Stereo: each frame holds the data slot on the left and an empty slot on the
+// right, so half of every read is thrown away.
+struct i2s_slot_stereo32 {
+  typedef int32_t word;
+  static constexpr const char *name = "stereo 32-bit";
+  static constexpr size_t words_per_frame = 2;
+  static constexpr bool stereo = true;
+  static constexpr uint32_t data_bits = 32;
+
+  static int32_t sample(const word *frames, size_t index) {
+    return frames[index * words_per_frame] >> 16;
+  }
+};
+
+// Mono: only the left slot is received, one 32-bit word a frame.
+struct i2s_slot_mono32 {
+  typedef int32_t word;
+  static constexpr const char *name = "mono 32-bit";
+  static constexpr size_t words_per_frame = 1;
+  static constexpr bool stereo = false;
+  static constexpr uint32_t data_bits = 32;
+
+  static int32_t sample(const word *frames, size_t index) {
+    return frames[index] >> 16;
+  }
+};
+
+// Mono with 16-bit data in a 32-bit slot: the I2S peripheral keeps the top
+// half of each slot, which is the same sample the >> 16 above gives, so DMA
+// delivers ready-made 16-bit samples.
+struct i2s_slot_mono16 {
+  typedef int16_t word;
+  static constexpr const char *name = "mono 16-bit";
+  static constexpr size_t words_per_frame = 1;
+  static constexpr bool stereo = false;
+  static constexpr uint32_t data_bits = 16;
+
+  static int32_t sample(const word *frames, size_t index) {
+    return frames[index];
+  }
+};
+
+// A codec is a type with static members: `id` and `name`; `begin()`, which
+// resets it for a new recording; `encode<slot_format>(frames, frame_count,
+// out)`, which returns the bytes written; `finish(out)` for what it still
+// holds at the end; `frames_to_block_end()` (0 on a block boundary);
+// `samples_in_payload(bytes)`; and the constexpr `encoded_bytes_max(frames)`
+// and `encoded_bytes_per_second(rate)`.
+//
+// Everything is a type or a constant here, so the sampling loop compiles to
+// one fully inlined path per build with no per-buffer or per-sample dispatch.
+template <typename slot_format, uint32_t rate, typename codec_type,
+          size_t frames_per_read>
+struct capture_pipeline {
+  typedef slot_format slot;
+  typedef typename slot::word word;
+  typedef codec_type codec;
+
+  static constexpr uint32_t sample_rate = rate;
+  // One i2s_channel_read() call.
+  static constexpr size_t read_frames = frames_per_read;
+  static constexpr size_t frame_bytes = slot::words_per_frame * sizeof(word);
+  static constexpr size_t read_words = read_frames * slot::words_per_frame;
+  static constexpr size_t read_bytes = read_words * sizeof(word);
+  static constexpr uint32_t read_milliseconds =
+      (uint32_t)(read_frames * 1000 / sample_rate);
+  // Largest encode() output for one read.
+  static constexpr size_t encoded_bytes_max =
+      codec::encoded_bytes_max(read_frames);
+  static constexpr uint32_t encoded_bytes_per_second =
+      codec::encoded_bytes_per_second(sample_rate);
+
+  static constexpr size_t samples_in_milliseconds(uint32_t milliseconds) {
+    return (size_t)((uint64_t)sample_rate * milliseconds / 1000);
+  }
+
+  static size_t encode(const word *frames, size_t frame_count,
+                       uint8_t *out) {
+    return codec::template encode<slot>(frames, frame_count, out);
+  }
+
+  static_assert(read_milliseconds > 0, "an I2S read must span at least 1 ms");
+};
@@ -0,0 +1,148 @@
+// What main.cpp shares with the firmware modules beside it
+// (transport_crypto.cpp, live_stream.cpp, benchmark.cpp): the debug log, the
+// performance counters, the BLE connection state and the notification
+// pipeline. Arduino and ESP-IDF only; the portable headers don't include it.
+#pragma once
+
+#include <Arduino.h>
+#include <BLEServer.h>
+#include <os/os_mbuf.h>
+
+#ifndef DEBUG
+#define DEBUG 0
+#endif
+
+#if DEBUG
+  #define DBG(...) Serial.printf(__VA_ARGS__)
+#else
+  #define DBG(...)
+#endif
+
+// Performance counters, kept in RTC memory so they survive deep sleep and
+// reset on a cold boot (which includes flashing new firmware). DBG() is
+// compiled out of production builds, so this is how a client sees how close
+// the device runs to its limits. The Stats characteristic serves every field
+// after the magic as uint32 LE, in order; new fields only ever go at the end.
+static const uint32_t device_stats_magic = 0x5453444d; // "MDST"
+
+// What the device is doing while awake; see power_profile_enter().
+enum power_profile : uint8_t {
+  power_profile_idle,
+  power_profile_recording,
+  power_profile_streaming,
+  power_profile_count,
+};
+
+struct device_stats {
+  uint32_t magic;
+  uint32_t recordings;
+  // Worst cases across all recordings.
+  uint32_t ring_high_water_bytes;
+  uint32_t ring_dropped_bytes;
+  uint32_t flash_max_stall_microseconds;
+  uint32_t i2s_read_errors;
+  // Totals across all streams.
+  uint32_t notify_retries;
+  uint32_t notify_failures;
+  // From the most recent stream and recording.
+  uint32_t stream_bytes_per_second;
+  uint32_t wake_to_first_sample_microseconds;
+  // Includes the startup discard, so this is when recorded audio begins.
+  uint32_t wake_to_first_kept_sample_microseconds;
+  // Size of the capture ring allocated at boot.
+  uint32_t capture_buffer_bytes;
+  // Totals, for working out energy per recorded minute and per synced MB
+  // from a bench measurement of each profile's current.
+  uint32_t power_profile_milliseconds[power_profile_count];
+  uint32_t streamed_bytes;
+  // Recordings streamed live to completion, and live streams given up on.
+  uint32_t live_recordings;
+  uint32_t live_abandoned;
+  // Transport encryption totals: chunks encrypted and the time spent, so
+  // the client can work out the cost per chunk.
+  uint32_t encrypted_chunks;
+  uint32_t encrypt_microseconds;
+};
+
+extern device_stats stats;
+
+void power_profile_enter(power_profile profile);
+
+extern BLEServer *ble_server;
+extern BLECharacteristic *audio_data_characteristic;
+
+extern volatile bool client_connected;
+extern volatile bool connection_authenticated;
+// Set by LIVE_SUBSCRIBE until the client disconnects.
+extern volatile bool live_subscribed;
+
+void enter_high_throughput_mode();
+
+// PHY, connection interval (in 1.25 ms units) and MTU of a connection.
+struct link_parameters {
+  uint8_t tx_phy;
+  uint8_t rx_phy;
+  uint16_t interval;
+  uint16_t mtu;
+};
+
+link_parameters read_link_parameters(uint16_t connection_id);
+
+// Notification flow control. Every notification is built in an mbuf from a
+// pool of its own, filled straight from flash by stream_reader_task(). NimBLE
+// returns an mbuf to that pool once the controller has sent it, so the pool
+// size caps what is in flight and queued. When the pool runs dry the reader
+// waits a tick for NimBLE to free one rather than copying anything.
+#ifndef NOTIFY_WINDOW
+#define NOTIFY_WINDOW 12
+#endif
+// NimBLE still takes one msys mbuf per notification for the ATT header and
+// chains the payload after it, so the sender also waits until at least this
+// many msys mbufs are free. That keeps a congested link from failing
+// notifications with BLE_HS_ENOMEM and leaves mbufs for the client's command
+// writes.
+#ifndef NOTIFY_MSYS_RESERVE
+#define NOTIFY_MSYS_RESERVE 4
+#endif
+// Longest the notify loop waits for the next packet before the stream gives
+// up; the pool only stays full this long if the link has stalled.
+#ifndef NOTIFY_TIMEOUT_MILLISECONDS
+#define NOTIFY_TIMEOUT_MILLISECONDS 1000
+#endif
+
+struct notify_statistics {
+  uint32_t sent;
+  // Ticks the reader waited for NimBLE to free a pool mbuf, and ticks the
+  // sender waited for free msys mbufs.
+  uint32_t retries;
+  uint32_t failures;
+  uint32_t wait_microseconds;
+};
+
+extern notify_statistics notify_stats;
+
+void notify_flow_control_reset();
+bool send_notification(uint16_t connection_id, uint16_t attribute_handle,
+                       struct os_mbuf *packet);
+
+// The streaming pipeline's packet pool and packet layout; see
+// stream_reader_task() and START_STREAM_FRAMED in main.cpp.
+static const size_t stream_buffer_bytes = 512;
+static const size_t stream_packet_header_bytes = 4;
+static const uint32_t stream_window_sequence = 0xffffffff;
+
+extern struct os_mbuf_pool stream_mbuf_pool;
+
+enum stream_mode {
+  stream_mode_file,    // pending_stream_file as-is (START_STREAM[_AT])
+  stream_mode_framed,  // a range of pending_stream_file (START_STREAM_FRAMED)
+  stream_mode_all,     // every indexed recording (STREAM_ALL)
+  stream_mode_benchmark,  // synthetic packets (BENCHMARK)
+};
+
+bool stream_pipeline_init();
+size_t stream_chunk_size(uint16_t connection_id);
+void run_stream_pipeline(stream_mode mode);
+// Closes the file prepared for streaming, if any, before something else uses
+// the link.
+void stream_prepared_file_release();
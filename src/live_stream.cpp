@@ -0,0 +1,183 @@
+#include "live_stream.h"
+
+#include <esp_rom_crc.h>
+
+#include "firmware.h"
+#include "transport_crypto.h"
+
+spsc_ring<uint8_t, LIVE_BUFFER_BYTES> live_ring;
+std::atomic<bool> live_capturing{false};
+std::atomic<bool> live_failed{false};
+std::atomic<uint32_t> live_recording_id{0};
+
+static SemaphoreHandle_t live_sender_done = nullptr;
+static uint16_t live_connection_id = 0;
+static uint16_t live_attribute_handle = 0;
+static size_t live_chunk_size = 0;
+static size_t live_header_size = 0;
+// File offset of the next live byte, and the CRC-32 of those sent so far.
+static uint32_t live_offset = 0;
+static uint32_t live_crc = 0;
+
+// Like stream_packet_get() in main.cpp, but gives up once the pool has stayed
+// empty for NOTIFY_TIMEOUT_MILLISECONDS: live_ring keeps filling meanwhile.
+static struct os_mbuf *live_packet_get() {
+  unsigned long wait_start = millis();
+  while (client_connected) {
+    struct os_mbuf *packet = os_mbuf_get_pkthdr(&stream_mbuf_pool, 0);
+    if (packet != nullptr) {
+      return packet;
+    }
+    if (millis() - wait_start >= NOTIFY_TIMEOUT_MILLISECONDS) {
+      break;
+    }
+    notify_stats.retries++;
+    vTaskDelay(1);
+  }
+  return nullptr;
+}
+
+bool send_split_notification(uint16_t connection_id, uint16_t attribute_handle,
+                             const uint8_t *data, size_t size,
+                             size_t chunk_size) {
+  for (size_t done = 0; done < size;) {
+    size_t part = size - done;
+    if (part > chunk_size) {
+      part = chunk_size;
+    }
+    struct os_mbuf *packet = live_packet_get();
+    if (packet == nullptr) {
+      return false;
+    }
+    memcpy(packet->om_data, data + done, part);
+    os_mbuf_extend(packet, part);
+    if (!send_notification(connection_id, attribute_handle, packet)) {
+      return false;
+    }
+    done += part;
+  }
+  return true;
+}
+
+// Sends live_ring as full packets while capture runs, then whatever is left
+// once record_and_save() clears live_capturing. Any failure abandons the live
+// copy for the rest of the recording.
+static void live_sender_task(void *) {
+  size_t payload_max = live_chunk_size - stream_packet_header_bytes;
+  // Encryption is keyed by the recording ID, which the flash writer assigns
+  // once it has opened the file, usually well before the first packet fills.
+  uint32_t id = live_recording_id.load(std::memory_order_acquire);
+  while (transport_encrypted && id == 0 && !live_failed) {
+    if (!live_capturing.load(std::memory_order_acquire)) {
+      live_failed = true;
+      break;
+    }
+    vTaskDelay(1);
+    id = live_recording_id.load(std::memory_order_acquire);
+  }
+  while (!live_failed) {
+    // Read the flag before the size, as in flash_writer_drain().
+    bool finishing = !live_capturing.load(std::memory_order_acquire);
+    size_t pending = live_ring.size();
+    if (finishing && pending == 0) {
+      break;
+    }
+    if (!finishing && pending < payload_max) {
+      vTaskDelay(1);
+      continue;
+    }
+    struct os_mbuf *packet = live_packet_get();
+    if (packet == nullptr) {
+      live_failed = true;
+      break;
+    }
+    size_t count = (pending < payload_max) ? pending : payload_max;
+    uint8_t *data = packet->om_data + stream_packet_header_bytes;
+    memcpy(packet->om_data, &live_offset, sizeof(live_offset));
+    for (size_t copied = 0; copied < count;) {
+      size_t contiguous = 0;
+      const uint8_t *source = live_ring.peek_contiguous(contiguous);
+      if (contiguous > count - copied) {
+        contiguous = count - copied;
+      }
+      memcpy(data + copied, source, contiguous);
+      live_ring.commit(contiguous);
+      copied += contiguous;
+    }
+    os_mbuf_extend(packet, stream_packet_header_bytes + count);
+    live_crc = esp_rom_crc32_le(live_crc, data, count);
+    transport_crypt(id, live_offset, data, count);
+    if (!send_notification(live_connection_id, live_attribute_handle, packet)) {
+      live_failed = true;
+      break;
+    }
+    live_offset += count;
+  }
+  xSemaphoreGive(live_sender_done);
+  vTaskDelete(nullptr);
+}
+
+bool live_stream_begin(size_t header_size) {
+  if (!live_subscribed || !client_connected || !connection_authenticated ||
+      ble_server == nullptr || !stream_pipeline_init()) {
+    return false;
+  }
+  if (live_sender_done == nullptr) {
+    live_sender_done = xSemaphoreCreateBinary();
+    if (live_sender_done == nullptr) {
+      return false;
+    }
+  }
+  live_connection_id = ble_server->getConnId();
+  live_attribute_handle = audio_data_characteristic->getHandle();
+  live_chunk_size = stream_chunk_size(live_connection_id);
+  live_header_size = header_size;
+  live_offset = header_size;
+  live_crc = 0;
+  live_ring.reset();
+  live_failed = false;
+  notify_flow_control_reset();
+  // 8 KB/s needs the fast interval; the client's SYNC_DONE relaxes it again.
+  enter_high_throughput_mode();
+  live_capturing = true;
+  if (xTaskCreatePinnedToCore(live_sender_task, "live_tx", 4096, nullptr, 1,
+                              nullptr, 0) != pdPASS) {
+    DBG("[ble] live sender task creation failed\r\n");
+    live_capturing = false;
+    return false;
+  }
+  DBG("[ble] streaming recording live\r\n");
+  return true;
+}
+
+void live_stream_end(uint32_t id, const recording_header_with_rate *header) {
+  xSemaphoreTake(live_sender_done, portMAX_DELAY);
+  bool complete = header != nullptr && !live_failed;
+  uint8_t end[4 * sizeof(uint32_t) + sizeof(recording_header_with_rate)];
+  size_t end_size = sizeof(live_abort_sequence);
+  if (complete) {
+    uint32_t fields[4] = {live_end_sequence, id, live_offset, live_crc};
+    memcpy(end, fields, sizeof(fields));
+    memcpy(end + sizeof(fields), header, live_header_size);
+    transport_crypt(id, 0, end + sizeof(fields), live_header_size);
+    end_size = sizeof(fields) + live_header_size;
+  } else {
+    memcpy(end, &live_abort_sequence, sizeof(live_abort_sequence));
+  }
+  complete = send_split_notification(live_connection_id, live_attribute_handle,
+                                     end, end_size, live_chunk_size) &&
+             complete;
+  DBG("[ble] live stream %s after %lu bytes (%lu packets, %lu pool waits)\r\n",
+      complete ? "complete" : "abandoned",
+      (unsigned long)(live_offset - live_header_size),
+      (unsigned long)notify_stats.sent, (unsigned long)notify_stats.retries);
+  stats.notify_retries += notify_stats.retries;
+  stats.notify_failures += notify_stats.failures;
+  stats.streamed_bytes += live_offset - live_header_size;
+  if (complete) {
+    stats.live_recordings++;
+  } else {
+    stats.live_abandoned++;
+  }
+}
+
@@ -0,0 +1,59 @@
+// Live streaming (LIVE_SUBSCRIBE). While a client that sent LIVE_SUBSCRIBE is
+// connected, push_encoded() in main.cpp also copies every encoded byte into
+// live_ring, and live_sender_task() on core 0 sends it as notifications. The
+// flash copy is written as usual and stays the fallback, so the tap never
+// waits: if the link falls behind and live_ring fills, the live copy is
+// abandoned. 8 KB is about a second of audio.
+//
+// Each live notification starts with a uint32 LE file offset, as in framed
+// mode, followed by the recording's bytes from just past the header. The
+// header itself is only known once the recording is finalized, so the stream
+// ends with an end packet: sequence live_end_sequence, then uint32 LE
+// recording ID, file size and CRC-32 of every byte after the header, then the
+// header. At small MTUs that doesn't fit one notification, so it is split at
+// the notification size and the rest of the header arrives in the following
+// notifications, without an offset. A live stream that can't keep up, loses
+// a packet or ends in a discarded or failed recording ends with just
+// live_abort_sequence instead; the flash copy, if any, then syncs as usual.
+// Nothing is retransmitted live.
+#pragma once
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "adpcm.h"
+#include "spsc_ring.h"
+
+#ifndef LIVE_BUFFER_BYTES
+#define LIVE_BUFFER_BYTES 8192
+#endif
+
+static const uint32_t live_end_sequence = 0xffffffff;
+static const uint32_t live_abort_sequence = 0xfffffffe;
+
+extern spsc_ring<uint8_t, LIVE_BUFFER_BYTES> live_ring;
+extern std::atomic<bool> live_capturing;
+extern std::atomic<bool> live_failed;
+// ID of the recording being captured, published by the flash writer on core 0
+// once the file is open; 0 until then (IDs start at 1). The live sender keys
+// encryption by it.
+extern std::atomic<uint32_t> live_recording_id;
+
+// Starts a live stream for the recording about to be captured, whose header
+// will be `header_size` bytes, if a subscribed client is connected. Called
+// before capture starts.
+bool live_stream_begin(size_t header_size);
+
+// Waits for the live sender to drain, then sends the end packet for `id`
+// with `header`, or the abort packet if `header` is null or the live copy
+// fell behind. Called once the recording is finalized.
+void live_stream_end(uint32_t id, const recording_header_with_rate *header);
+
+// Sends a control message (a live end packet or a benchmark result) in
+// notifications of at most `chunk_size` bytes. Messages longer than one
+// notification continue in the next ones as bare bytes; the client knows
+// each message's length from its sequence.
+bool send_split_notification(uint16_t connection_id, uint16_t attribute_handle,
+                             const uint8_t *data, size_t size,
+                             size_t chunk_size);
@@ -1,4 +1,5 @@
 #include <Arduino.h>
+#include <atomic>
 #include <BLEDevice.h>
 #include <BLEServer.h>
 #include <BLEUtils.h>
@@ -6,7 +7,13 @@
 #include <driver/gpio.h>
 #include <driver/i2s_std.h>
 #include <driver/rtc_io.h>
+#include <esp_cpu.h>
+#include <esp_heap_caps.h>
+#include <esp_partition.h>
+#include <esp_pm.h>
+#include <esp_rom_crc.h>
 #include <esp_sleep.h>
+#include <hal/gpio_ll.h>
 #include <soc/rtc_cntl_reg.h>
 // NimBLE API for direct notification calls with congestion retry. The Arduino
 // BLE wrapper calls ble_gatts_notify_custom but silently aborts on non-zero
@@ -14,17 +21,30 @@
 // ourselves so we can retry instead of losing data.
 #include <host/ble_gatt.h>
 #include <host/ble_hs_mbuf.h>
+#include <os/os_mbuf.h>
+// Raw NimBLE GAP/HCI calls for PHY, data length and connection interval
+// requests, which the Arduino wrapper doesn't expose.
+#include <host/ble_gap.h>
+#include <host/ble_hs_hci.h>
 #include <nvs.h>
 #include <nvs_flash.h>
 
-#ifndef DEBUG
-#define DEBUG 0
-#endif
-
-#if DEBUG
-  #define DBG(...) Serial.printf(__VA_ARGS__)
-#else
-  #define DBG(...)
+#include "adpcm.h"
+#include "benchmark.h"
+#include "capture_pipeline.h"
+#include "firmware.h"
+#include "live_stream.h"
+#include "recording_log.h"
+#include "recording_name.h"
+#include "spsc_ring.h"
+#include "transport_crypto.h"
+
+// Set to 1 to encode with the batch kernel instead of the per-sample
+// reference path. Both write identical bytes (test_adpcm checks this), but the
+// kernel has only been timed on the host. It becomes the default once the
+// DEBUG cycle counts on the ESP32-S3 show it is faster there.
+#ifndef ADPCM_BATCH_ENCODE
+#define ADPCM_BATCH_ENCODE 0
 #endif
 
 static const int pin_button = 2;
@@ -36,140 +56,344 @@ static const int pin_i2s_sck = 6;
 static const int pin_i2s_ws = 5;
 static const int pin_i2s_sd = 7;
 
-static const int sample_rate = 16000;
+// Sample rate of recordings. Default-rate files are version 2 or 3; any
+// other rate is stored in a version 4 header (see adpcm.h).
+#ifndef SAMPLE_RATE
+#define SAMPLE_RATE 16000
+#endif
 static const unsigned long minimum_recording_milliseconds = 1000;
 
+// Where recordings are kept; see recording_file below.
+#define RECORDING_STORE_LITTLEFS 0
+#define RECORDING_STORE_LOG 1
+#ifndef RECORDING_STORE
+#define RECORDING_STORE RECORDING_STORE_LITTLEFS
+#endif
+
+// Codec selection; see recording_codec below.
+#ifndef RECORDING_CODEC
+#define RECORDING_CODEC 0
+#endif
+
+// Codecs for recordings, in the form capture_pipeline.h describes. A codec
+// writes self-contained blocks, so decoders can start at any block and the
+// voice activity gate can put silence blocks between them. Its ID goes in
+// the file header.
+static adpcm_block_encoder adpcm_encoder;
+
+struct ima_adpcm_codec {
+  static constexpr uint8_t id = codec_ima_adpcm;
+  static constexpr const char *name =
+      ADPCM_BATCH_ENCODE ? "ima-adpcm batch" : "ima-adpcm scalar";
+
+  static void begin() { adpcm_encoder = {}; }
+
+  template <typename slot_format>
+  static size_t encode(const typename slot_format::word *frames,
+                       size_t frame_count, uint8_t *out) {
+#if ADPCM_BATCH_ENCODE
+    return adpcm_encode_frames<slot_format>(frames, frame_count, adpcm_encoder,
+                                            out);
+#else
+    return adpcm_encode_frames_scalar<slot_format>(frames, frame_count,
+                                                   adpcm_encoder, out);
+#endif
+  }
+
+  // Flushes the trailing nibble if the sample count was odd.
+  static size_t finish(uint8_t *out) {
+    if (!adpcm_encoder.nibble_pending) {
+      return 0;
+    }
+    out[0] = adpcm_encoder.packed_byte;
+    adpcm_encoder.nibble_pending = false;
+    return 1;
+  }
+
+  static size_t frames_to_block_end() {
+    if (adpcm_encoder.block_sample_index == 0) {
+      return 0;
+    }
+    return adpcm_samples_per_block - adpcm_encoder.block_sample_index;
+  }
+
+  static uint32_t samples_in_payload(size_t bytes) {
+    return adpcm_samples_in_payload(bytes);
+  }
+
+  static constexpr size_t encoded_bytes_max(size_t frame_count) {
+    return adpcm_encoded_bytes_max(frame_count);
+  }
+
+  // Four bits a sample, plus each block's header.
+  static constexpr uint32_t encoded_bytes_per_second(uint32_t rate) {
+    return (uint32_t)((uint64_t)rate * adpcm_block_bytes /
+                      adpcm_samples_per_block);
+  }
+};
+
+#if RECORDING_CODEC == 0
+typedef ima_adpcm_codec recording_codec;
+#else
+#error "Unknown RECORDING_CODEC"
+#endif
+
+// How the INMP441's slot is read (see capture_pipeline.h): 0 = stereo 32-bit,
+// 1 = mono 32-bit, 2 = mono 16-bit. Mono reads half the bytes per frame into
+// half the buffer memory, and 16-bit halves them again. The mono formats
+// haven't been run on the pendant yet, so stereo stays the default until they
+// have; DEBUG builds log the CPU and DMA figures to compare.
+#ifndef I2S_SLOT_FORMAT
+#define I2S_SLOT_FORMAT 0
+#endif
+
+#if I2S_SLOT_FORMAT == 0
+typedef i2s_slot_stereo32 capture_slot;
+#elif I2S_SLOT_FORMAT == 1
+typedef i2s_slot_mono32 capture_slot;
+#elif I2S_SLOT_FORMAT == 2
+typedef i2s_slot_mono16 capture_slot;
+#else
+#error "Unknown I2S_SLOT_FORMAT"
+#endif
+
+// The INMP441, SAMPLE_RATE and the codec above. 512 frames is 32 ms at 16 kHz.
+typedef capture_pipeline<capture_slot, SAMPLE_RATE, recording_codec, 512>
+    pipeline;
+
 // Samples to discard after I2S init to skip the INMP441's internal startup
-// transient (~100ms at 16 kHz).
-static const size_t i2s_startup_discard_samples = 1600;
-
-// IMA ADPCM step size table — indexed by step_index (0..88).
-static const int16_t adpcm_step_table[89] = {
-    7,     8,     9,     10,    11,    12,    13,    14,    16,    17,
-    19,    21,    23,    25,    28,    31,    34,    37,    41,    45,
-    50,    55,    60,    66,    73,    80,    88,    97,    107,   118,
-    130,   143,   157,   173,   190,   209,   230,   253,   279,   307,
-    337,   371,   408,   449,   494,   544,   598,   658,   724,   796,
-    876,   963,   1060,  1166,  1282,  1411,  1552,  1707,  1878,  2066,
-    2272,  2499,  2749,  3024,  3327,  3660,  4026,  4428,  4871,  5358,
-    5894,  6484,  7132,  7845,  8630,  9493,  10442, 11487, 12635, 13899,
-    15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767};
-
-// Maps each encoded nibble to a step_index adjustment.
-static const int8_t adpcm_index_table[16] = {-1, -1, -1, -1, 2, 4, 6, 8,
-                                              -1, -1, -1, -1, 2, 4, 6, 8};
-
-struct adpcm_state {
-  int16_t predicted_sample;
-  uint8_t step_index;
+// transient.
+static const size_t i2s_startup_discard_samples =
+    pipeline::samples_in_milliseconds(100);
+
+// The header as this build writes it: the default rate keeps the 12-byte
+// version 2 or 3 header, other rates the version 4 header with the rate.
+static constexpr bool recording_header_has_rate =
+    pipeline::sample_rate != recording_default_sample_rate;
+static constexpr size_t recording_header_size =
+    recording_header_has_rate ? sizeof(recording_header_with_rate)
+                              : sizeof(recording_header);
+
+static recording_header_with_rate make_stored_header(uint32_t sample_count,
+                                                     bool gated) {
+  uint8_t version = gated ? recording_format_version_gated
+                          : recording_format_version;
+  if (recording_header_has_rate) {
+    version = recording_format_version_rate;
+  }
+  recording_header_with_rate stored = {};
+  stored.header =
+      make_recording_header(sample_count, version, recording_codec::id);
+  stored.sample_rate = pipeline::sample_rate;
+  return stored;
+}
+
+// Recordings live on LittleFS by default. RECORDING_STORE_LOG keeps them in
+// the circular log of recording_log.h on the same partition instead: writes
+// are sequential with the erase kept one segment ahead, sync reads are plain
+// linear reads, and there is no directory walk or format-on-failure mount.
+// The log only deletes by marking, so the tail moves once the oldest
+// recordings are acknowledged. Switching stores loses whatever the other one
+// held, so sync first. Either way the firmware sees a recording_file with the
+// handful of File methods it uses, named by its "/rec_<id>.ima" path.
+#if RECORDING_STORE == RECORDING_STORE_LITTLEFS
+typedef File recording_file;
+#elif RECORDING_STORE == RECORDING_STORE_LOG
+static const char *recording_log_partition_label = "spiffs";
+static const char *recording_log_nvs_namespace = "rec_log";
+static const char *recording_log_nvs_key = "pointers";
+
+// recording_log backend on the data partition, with the head and tail saved
+// together in one NVS blob so they can't be torn.
+struct partition_flash {
+  const esp_partition_t *partition;
+
+  uint32_t size() const {
+    return partition->size / recording_log_segment_bytes *
+           recording_log_segment_bytes;
+  }
+  bool read(uint32_t address, void *data, size_t length) {
+    return esp_partition_read(partition, address, data, length) == ESP_OK;
+  }
+  bool write(uint32_t address, const void *data, size_t length) {
+    return esp_partition_write(partition, address, data, length) == ESP_OK;
+  }
+  bool erase_segment(uint32_t address) {
+    return esp_partition_erase_range(partition, address,
+                                     recording_log_segment_bytes) == ESP_OK;
+  }
+  void save(uint32_t head, uint32_t tail) {
+    nvs_handle_t handle;
+    if (nvs_open(recording_log_nvs_namespace, NVS_READWRITE, &handle) !=
+        ESP_OK) {
+      DBG("[flash] could not save log pointers\r\n");
+      return;
+    }
+    uint32_t pointers[2] = {head, tail};
+    nvs_set_blob(handle, recording_log_nvs_key, pointers, sizeof(pointers));
+    nvs_commit(handle);
+    nvs_close(handle);
+  }
 };
 
-// Encode one 16-bit signed PCM sample into a 4-bit IMA ADPCM nibble.
-static uint8_t adpcm_encode_sample(int16_t sample, adpcm_state &state) {
-  int32_t difference = sample - state.predicted_sample;
-  uint8_t nibble = 0;
-  if (difference < 0) {
-    nibble = 8;
-    difference = -difference;
-  }
-
-  int16_t step = adpcm_step_table[state.step_index];
-  // Quantize the difference against the current step size. Each bit in the
-  // nibble represents whether the difference exceeds successively halved
-  // fractions of the step.
-  int32_t delta = step >> 3;
-  if (difference >= step) {
-    nibble |= 4;
-    difference -= step;
-    delta += step;
-  }
-  step >>= 1;
-  if (difference >= step) {
-    nibble |= 2;
-    difference -= step;
-    delta += step;
-  }
-  step >>= 1;
-  if (difference >= step) {
-    nibble |= 1;
-    delta += step;
-  }
-
-  // Apply the reconstructed delta so the decoder stays in sync with us.
-  if (nibble & 8) {
-    state.predicted_sample -= delta;
-  } else {
-    state.predicted_sample += delta;
+static partition_flash recording_log_flash = {nullptr};
+static recording_log<partition_flash, recording_header_size>
+    recording_store_log(recording_log_flash);
+
+// One recording in the log. Writing appends, except that the header can be
+// rewritten before close(), which finalizes the recording.
+class recording_file {
+public:
+  static recording_file for_writing() {
+    recording_file file;
+    file.is_open = true;
+    file.writable = true;
+    return file;
+  }
+
+  static recording_file for_reading(const recording_log_entry &entry) {
+    recording_file file;
+    file.is_open = true;
+    file.entry = entry;
+    return file;
   }
-  if (state.predicted_sample > 32767) {
-    state.predicted_sample = 32767;
-  } else if (state.predicted_sample < -32768) {
-    state.predicted_sample = -32768;
+
+  explicit operator bool() const { return is_open; }
+
+  size_t write(const uint8_t *data, size_t length) {
+    if (!is_open || !writable) {
+      return 0;
+    }
+    if (offset < recording_store_log.written()) {
+      if (!recording_store_log.rewrite_header(offset, data, length)) {
+        return 0;
+      }
+      offset += length;
+      return length;
+    }
+    size_t taken = recording_store_log.append(data, length);
+    offset += taken;
+    return taken;
   }
 
-  int new_index = state.step_index + adpcm_index_table[nibble];
-  if (new_index < 0) {
-    new_index = 0;
-  } else if (new_index > 88) {
-    new_index = 88;
+  size_t read(uint8_t *data, size_t length) {
+    if (!is_open || writable) {
+      return 0;
+    }
+    size_t count = recording_store_log.read(entry, offset, data, length);
+    offset += count;
+    return count;
   }
-  state.step_index = (uint8_t)new_index;
 
-  return nibble;
-}
+  bool seek(uint32_t position) {
+    if (!is_open || position > size()) {
+      return false;
+    }
+    offset = position;
+    return true;
+  }
 
-// Lock-free single-producer single-consumer ring buffer for draining ADPCM
-// output to LittleFS. The sampling loop (producer) and a separate flash-
-// writer FreeRTOS task (consumer) run on different cores so flash page-erase
-// stalls never block sample capture. At 16 kHz ADPCM (8 KB/s), 32 KB gives
-// ~4 seconds of headroom to absorb worst-case LittleFS page-erase stalls.
-static const size_t ring_buffer_capacity = 32768;
-static uint8_t ring_buffer[ring_buffer_capacity];
-static volatile size_t ring_buffer_head = 0; // read index (consumer)
-static volatile size_t ring_buffer_tail = 0; // write index (producer)
+  size_t position() const { return offset; }
 
-static void ring_buffer_reset() {
-  ring_buffer_head = 0;
-  ring_buffer_tail = 0;
-}
+  size_t size() const {
+    return writable ? recording_store_log.written() : entry.length;
+  }
 
-static void ring_buffer_push(uint8_t byte) {
-  size_t next_tail = (ring_buffer_tail + 1) % ring_buffer_capacity;
-  if (next_tail == ring_buffer_head) {
-    // Buffer full — sample lost. Shouldn't happen with the writer task
-    // draining continuously, but prevents corruption if it does.
-    return;
+  void close() {
+    if (is_open && writable) {
+      recording_store_log.finalize();
+    }
+    is_open = false;
   }
-  ring_buffer[ring_buffer_tail] = byte;
-  ring_buffer_tail = next_tail;
-}
+
+private:
+  bool is_open = false;
+  bool writable = false;
+  recording_log_entry entry = {};
+  uint32_t offset = 0;
+};
+#else
+#error "Unknown RECORDING_STORE"
+#endif
+
+// Drains ADPCM output to LittleFS. The sampling loop (producer) and a separate
+// flash-writer FreeRTOS task (consumer) run on different cores so flash
+// page-erase stalls never block sample capture. The ring is allocated on the
+// first recording after boot, from PSRAM when there is any: LittleFS
+// garbage collection stalls get longer as the partition fills, and 1 MB
+// covers about two minutes of them at 8 KB/s ADPCM. Without PSRAM it falls
+// back to 32 KB of internal RAM, about four seconds.
+#ifndef CAPTURE_BUFFER_MAX_BYTES
+#define CAPTURE_BUFFER_MAX_BYTES (1024 * 1024)
+#endif
+static const size_t capture_buffer_fallback_bytes = 32768;
+static spsc_ring<uint8_t> ring_buffer;
 
 // Writer task state — offloads flash writes to core 0 so the sampling
 // loop on core 1 never stalls on LittleFS page erases.
-static volatile bool writer_active = false;
-static volatile bool writer_error = false;
-static volatile bool writer_done = false;
-
-static void flash_writer_task(void *param) {
-  File *file = (File *)param;
-  while (writer_active || ring_buffer_head != ring_buffer_tail) {
-    size_t h = ring_buffer_head;
-    size_t t = ring_buffer_tail;
-    if (h == t) {
-      vTaskDelay(1);
+static std::atomic<bool> writer_active{false};
+static std::atomic<bool> writer_error{false};
+static std::atomic<bool> writer_done{false};
+static TaskHandle_t writer_task_handle = nullptr;
+// Longest single file->write() seen during the current recording.
+static uint32_t writer_max_stall_microseconds = 0;
+
+// LittleFS allocates, erases and programs flash in 4 KB blocks. The writer
+// only writes once a whole block's worth is buffered and ends every write on a
+// file-offset block boundary, so each call fills exactly one fresh block
+// instead of reprogramming a partially written one. Only the final flush
+// writes a short tail.
+static const size_t flash_write_chunk_bytes = 4096;
+// Safety net in case a wakeup is ever missed; normally the producer's
+// notification wakes the writer as soon as a block is ready.
+static const uint32_t flash_writer_wait_milliseconds = 100;
+
+// Writes ring buffer contents to `file` until the producer clears
+// writer_active and the ring is empty, or a write fails.
+static void flash_writer_drain(recording_file *file) {
+  size_t file_offset = file->position();
+  while (true) {
+    // Read the flag before the size: anything pushed before the producer
+    // cleared writer_active is then guaranteed to be seen below.
+    bool finishing = !writer_active.load(std::memory_order_acquire);
+    size_t pending = ring_buffer.size();
+    size_t to_block_end =
+        flash_write_chunk_bytes - file_offset % flash_write_chunk_bytes;
+    if (finishing && pending == 0) {
+      break;
+    }
+    if (!finishing && pending < to_block_end) {
+      ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(flash_writer_wait_milliseconds));
       continue;
     }
-    // Write the largest contiguous chunk available.
-    size_t contiguous = (t > h) ? (t - h) : (ring_buffer_capacity - h);
-    size_t written = file->write(&ring_buffer[h], contiguous);
-    if (written != contiguous) {
-      writer_error = true;
+
+    // Fill up to the next block boundary; a ring wrap can split that into
+    // two writes, which LittleFS's cache merges into one program.
+    size_t remaining = (pending < to_block_end) ? pending : to_block_end;
+    while (remaining > 0) {
+      size_t contiguous = 0;
+      const uint8_t *data = ring_buffer.peek_contiguous(contiguous);
+      if (contiguous > remaining) {
+        contiguous = remaining;
+      }
+      unsigned long write_start = micros();
+      size_t written = file->write(data, contiguous);
+      uint32_t stall = micros() - write_start;
+      if (stall > writer_max_stall_microseconds) {
+        writer_max_stall_microseconds = stall;
+      }
+      if (written != contiguous) {
+        writer_error = true;
+        break;
+      }
+      ring_buffer.commit(written);
+      file_offset += written;
+      remaining -= written;
+    }
+    if (writer_error) {
       break;
     }
-    ring_buffer_head = (h + written) % ring_buffer_capacity;
   }
-  writer_done = true;
-  vTaskDelete(nullptr);
 }
 
 static const char *service_uuid = "19b10000-e8f2-537e-4f6c-d104768a1214";
@@ -185,6 +409,8 @@ static const char *characteristic_voltage_uuid =
     "19b10005-e8f2-537e-4f6c-d104768a1214";
 static const char *characteristic_pairing_uuid =
     "19b10006-e8f2-537e-4f6c-d104768a1214";
+static const char *characteristic_stats_uuid =
+    "19b10007-e8f2-537e-4f6c-d104768a1214";
 
 static const uint8_t command_request_next = 0x01;
 static const uint8_t command_ack_received = 0x02;
@@ -192,56 +418,164 @@ static const uint8_t command_sync_done = 0x03;
 static const uint8_t command_start_stream = 0x04;
 static const uint8_t command_enter_bootloader = 0x05;
 static const uint8_t command_erase_pair_token = 0x06;
+static const uint8_t command_stream_all = 0x07;
+static const uint8_t command_ack_ids = 0x08;
+static const uint8_t command_start_stream_at = 0x09;
+static const uint8_t command_start_stream_framed = 0x0a;
+static const uint8_t command_live_subscribe = 0x0b;
+static const uint8_t command_set_schedule = 0x0c;
+static const uint8_t command_request_id = 0x0d;
+static const uint8_t command_encrypt = 0x0e;
+static const uint8_t command_benchmark = 0x0f;
 
 static const unsigned long ble_keepalive_milliseconds = 10000;
 
-static BLEServer *ble_server = nullptr;
+BLEServer *ble_server = nullptr;
 static BLECharacteristic *file_count_characteristic = nullptr;
 static BLECharacteristic *file_info_characteristic = nullptr;
-static BLECharacteristic *audio_data_characteristic = nullptr;
+BLECharacteristic *audio_data_characteristic = nullptr;
 static BLECharacteristic *voltage_characteristic = nullptr;
 static BLECharacteristic *pairing_characteristic = nullptr;
+static BLECharacteristic *stats_characteristic = nullptr;
 static BLEAdvertising *ble_advertising = nullptr;
 
-// Lock-free single-producer (BLE callback) single-consumer (loop()) command
-// queue. Replaces the old single-byte pending_command which silently dropped
-// commands when a new one arrived before the previous was processed.
-static const size_t command_queue_capacity = 8;
-static volatile uint8_t command_queue[command_queue_capacity];
-static volatile size_t command_queue_head = 0;
-static volatile size_t command_queue_tail = 0;
-
-static void command_queue_push(uint8_t command) {
-  size_t next_tail = (command_queue_tail + 1) % command_queue_capacity;
-  if (next_tail == command_queue_head) {
-    return;
+RTC_DATA_ATTR device_stats stats;
+
+static void device_stats_ensure() {
+  if (stats.magic != device_stats_magic) {
+    stats = {};
+    stats.magic = device_stats_magic;
   }
-  command_queue[command_queue_tail] = command;
-  command_queue_tail = next_tail;
 }
 
-// Returns the next command, or 0 if the queue is empty.
-static uint8_t command_queue_pop() {
-  if (command_queue_head == command_queue_tail) {
-    return 0;
+static void device_stats_publish() {
+  if (stats_characteristic != nullptr) {
+    stats_characteristic->setValue((uint8_t *)&stats + sizeof(stats.magic),
+                                   sizeof(stats) - sizeof(stats.magic));
   }
-  uint8_t command = command_queue[command_queue_head];
-  command_queue_head = (command_queue_head + 1) % command_queue_capacity;
-  return command;
 }
 
-static void command_queue_clear() {
-  command_queue_head = 0;
-  command_queue_tail = 0;
+// Power profiles. Idle (advertising, or connected and waiting for commands)
+// lets the CPU scale down to the crystal clock and light-sleep between BLE
+// events. Recording holds the 80 MHz APB clock, which leaves real-time ADPCM
+// encoding a wide margin, and keeps light sleep off so I2S DMA never stops.
+// Streaming holds the maximum clock and no light sleep. Builds whose SDK has
+// no power management fall back to fixed clocks per profile.
+#ifndef POWER_MAX_CPU_MHZ
+#define POWER_MAX_CPU_MHZ 240
+#endif
+#ifndef POWER_MIN_CPU_MHZ
+#define POWER_MIN_CPU_MHZ 40
+#endif
+static const uint32_t power_fallback_cpu_mhz[power_profile_count] = {
+    80, 80, POWER_MAX_CPU_MHZ};
+
+static bool power_management_enabled = false;
+static esp_pm_lock_handle_t power_lock_apb_max = nullptr;
+static esp_pm_lock_handle_t power_lock_cpu_max = nullptr;
+static esp_pm_lock_handle_t power_lock_no_light_sleep = nullptr;
+static power_profile active_power_profile = power_profile_idle;
+static unsigned long power_profile_start_milliseconds = 0;
+
+static void power_management_init() {
+  esp_pm_config_t config = {};
+  config.max_freq_mhz = POWER_MAX_CPU_MHZ;
+  config.min_freq_mhz = POWER_MIN_CPU_MHZ;
+  config.light_sleep_enable = true;
+  esp_err_t err = esp_pm_configure(&config);
+  if (err != ESP_OK) {
+    // Automatic light sleep needs tickless idle; scaling alone may still work.
+    DBG("[pm] esp_pm_configure with light sleep failed: %d\r\n", err);
+    config.light_sleep_enable = false;
+    err = esp_pm_configure(&config);
+    if (err != ESP_OK) {
+      DBG("[pm] esp_pm_configure failed: %d\r\n", err);
+    }
+  }
+  power_management_enabled =
+      err == ESP_OK &&
+      esp_pm_lock_create(ESP_PM_APB_FREQ_MAX, 0, "rec",
+                         &power_lock_apb_max) == ESP_OK &&
+      esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, "stream",
+                         &power_lock_cpu_max) == ESP_OK &&
+      esp_pm_lock_create(ESP_PM_NO_LIGHT_SLEEP, 0, "awake",
+                         &power_lock_no_light_sleep) == ESP_OK;
+  DBG("[pm] %s (light sleep %s)\r\n",
+      power_management_enabled ? "dynamic frequency scaling"
+                               : "fixed clocks, no power management",
+      power_management_enabled && config.light_sleep_enable ? "on" : "off");
+  power_profile_start_milliseconds = millis();
+  if (!power_management_enabled) {
+    setCpuFrequencyMhz(power_fallback_cpu_mhz[power_profile_idle]);
+  }
+}
+
+// Adds the time since the last switch to the active profile's total.
+static void power_profile_account() {
+  unsigned long now = millis();
+  stats.power_profile_milliseconds[active_power_profile] +=
+      now - power_profile_start_milliseconds;
+  power_profile_start_milliseconds = now;
+}
+
+void power_profile_enter(power_profile profile) {
+  if (profile == active_power_profile) {
+    return;
+  }
+  power_profile_account();
+  if (power_management_enabled) {
+    if (active_power_profile == power_profile_recording) {
+      esp_pm_lock_release(power_lock_apb_max);
+    } else if (active_power_profile == power_profile_streaming) {
+      esp_pm_lock_release(power_lock_cpu_max);
+    }
+    if (active_power_profile != power_profile_idle) {
+      esp_pm_lock_release(power_lock_no_light_sleep);
+    }
+    if (profile != power_profile_idle) {
+      esp_pm_lock_acquire(power_lock_no_light_sleep);
+    }
+    if (profile == power_profile_recording) {
+      esp_pm_lock_acquire(power_lock_apb_max);
+    } else if (profile == power_profile_streaming) {
+      esp_pm_lock_acquire(power_lock_cpu_max);
+    }
+  } else {
+    setCpuFrequencyMhz(power_fallback_cpu_mhz[profile]);
+  }
+  active_power_profile = profile;
 }
-static volatile bool client_connected = false;
-static volatile bool connection_authenticated = false;
+
+// A command write: the opcode byte plus whatever follows it. Payloads are
+// little-endian: ACK_IDS carries up to 16 uint32 recording IDs,
+// START_STREAM_AT a uint32 byte offset, START_STREAM_FRAMED up to 8 ranges of
+// uint32 offset and uint32 length (a length of 0 means to the end), and
+// STREAM_ALL optionally a uint32 recording ID and uint32 offset to resume
+// from.
+static const size_t command_payload_max = 64;
+
+struct ble_command {
+  uint8_t opcode;
+  uint8_t length;
+  uint8_t payload[command_payload_max];
+};
+
+// Single-producer (BLE callback) single-consumer (loop()) command queue.
+// Replaces the old single-byte pending_command which silently dropped
+// commands when a new one arrived before the previous was processed.
+static spsc_ring<ble_command, 8> command_queue;
+
+volatile bool client_connected = false;
+volatile bool connection_authenticated = false;
+volatile bool live_subscribed = false;
 static volatile uint16_t pending_recording_count = 0;
 static volatile bool sleep_requested = false;
-static bool littlefs_ready = false;
-static bool littlefs_mount_attempted = false;
+static bool recording_store_mounted = false;
+static bool recording_store_mount_attempted = false;
 static String current_stream_path = "";
-static File pending_stream_file;
+static recording_file pending_stream_file;
+// Recording ID of pending_stream_file, which keys its encryption.
+static uint32_t pending_stream_id = 0;
 static unsigned long ble_active_until_milliseconds = 0;
 static unsigned long hard_sleep_deadline_milliseconds = 0;
 
@@ -271,13 +605,110 @@ static bool ble_window_active() {
   return (long)(ble_active_until_milliseconds - millis()) > 0;
 }
 
+// loop() blocks on its task notification instead of polling. BLE callbacks
+// and the button interrupt give it; sleep deadlines bound the wait. The
+// backstop only matters if a wakeup is ever missed.
+static TaskHandle_t loop_task_handle = nullptr;
+static const unsigned long loop_backstop_milliseconds = 1000;
+// A press this soon after a release is contact bounce.
+static const unsigned long button_debounce_milliseconds = 20;
+
+static void loop_wake() {
+  if (loop_task_handle != nullptr) {
+    xTaskNotifyGive(loop_task_handle);
+  }
+}
+
+// A level interrupt that flips to the opposite level each time it fires, so
+// it fires once per press and once per release. Unlike an edge, a level also
+// wakes the chip from automatic light sleep. Only inline HAL calls here: the
+// ISR runs from IRAM and may fire while flash is busy.
+static void IRAM_ATTR button_isr() {
+  bool pressed = gpio_ll_get_level(&GPIO, pin_button) == 0;
+  gpio_ll_set_intr_type(&GPIO, pin_button,
+                        pressed ? GPIO_INTR_HIGH_LEVEL : GPIO_INTR_LOW_LEVEL);
+  BaseType_t woken = pdFALSE;
+  vTaskNotifyGiveFromISR(loop_task_handle, &woken);
+  portYIELD_FROM_ISR(woken);
+}
+
+static void button_interrupt_init() {
+  loop_task_handle = xTaskGetCurrentTaskHandle();
+  attachInterrupt(pin_button, button_isr, ONLOW);
+  gpio_wakeup_enable((gpio_num_t)pin_button, GPIO_INTR_LOW_LEVEL);
+  esp_sleep_enable_gpio_wakeup();
+}
+
+// Advertising starts at the fastest interval allowed, so a central that is
+// already scanning finds the pendant within a few events of it waking, then
+// drops to the stack's usual interval for the rest of the window. Intervals
+// are in 0.625 ms units.
+#ifndef FAST_ADVERTISING_MILLISECONDS
+#define FAST_ADVERTISING_MILLISECONDS 400
+#endif
+static const uint16_t fast_advertising_interval = 32;  // 20 ms
+static const uint16_t advertising_interval_min = 48;   // 30 ms
+static const uint16_t advertising_interval_max = 96;   // 60 ms
+static bool fast_advertising = false;
+static unsigned long fast_advertising_until_milliseconds = 0;
+
+// Blocks until something posts a wakeup, the nearest sleep deadline is due,
+// or `limit` milliseconds pass.
+static void loop_wait(unsigned long limit) {
+  unsigned long wait = limit;
+  unsigned long now = millis();
+  if (ble_window_active() && ble_active_until_milliseconds - now < wait) {
+    wait = ble_active_until_milliseconds - now;
+  }
+  if (hard_sleep_deadline_milliseconds != 0 &&
+      (long)(hard_sleep_deadline_milliseconds - now) > 0 &&
+      hard_sleep_deadline_milliseconds - now < wait) {
+    wait = hard_sleep_deadline_milliseconds - now;
+  }
+  if (fast_advertising &&
+      (long)(fast_advertising_until_milliseconds - now) > 0 &&
+      fast_advertising_until_milliseconds - now < wait) {
+    wait = fast_advertising_until_milliseconds - now;
+  }
+  ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(wait) + 1);
+}
+
+static bool advertising_start_fast() {
+  ble_advertising->setMinInterval(fast_advertising_interval);
+  ble_advertising->setMaxInterval(fast_advertising_interval);
+  fast_advertising = true;
+  fast_advertising_until_milliseconds =
+      millis() + FAST_ADVERTISING_MILLISECONDS;
+  return ble_advertising->start();
+}
+
+// Restarts advertising at the usual interval once the fast phase is over.
+static void advertising_end_fast_phase() {
+  if (!fast_advertising ||
+      (long)(millis() - fast_advertising_until_milliseconds) < 0) {
+    return;
+  }
+  fast_advertising = false;
+  ble_advertising->setMinInterval(advertising_interval_min);
+  ble_advertising->setMaxInterval(advertising_interval_max);
+  if (client_connected) {
+    return;
+  }
+  ble_advertising->stop();
+  // A central may have connected in between; advertising has then stopped
+  // for good.
+  if (!client_connected && !ble_advertising->start()) {
+    DBG("[ble] advertising restart failed\r\n");
+  }
+}
+
 static void start_ble_advertising() {
   if (ble_advertising == nullptr) {
     return;
   }
   ble_active_until_milliseconds = millis() + ble_keepalive_milliseconds;
   hard_sleep_deadline_milliseconds = millis() + 30000;
-  if (!ble_advertising->start()) {
+  if (!advertising_start_fast()) {
     DBG("[ble] advertising start failed\r\n");
   }
 }
@@ -290,7 +721,7 @@ static void resume_ble_advertising() {
   if (ble_advertising == nullptr) {
     return;
   }
-  if (!ble_advertising->start()) {
+  if (!advertising_start_fast()) {
     DBG("[ble] advertising resume failed\r\n");
   }
 }
@@ -302,6 +733,7 @@ static void configure_button_wakeup() {
 }
 
 static void enter_deep_sleep() {
+  power_profile_account();
   set_status_led_off();
   if (ble_advertising != nullptr) {
     ble_advertising->stop();
@@ -315,83 +747,286 @@ static void enter_deep_sleep() {
   esp_deep_sleep_start();
 }
 
-static bool ensure_littlefs_ready() {
-  if (littlefs_ready) {
+#if RECORDING_STORE == RECORDING_STORE_LITTLEFS
+static bool recording_store_ready() {
+  if (recording_store_mounted) {
     return true;
   }
-  if (littlefs_mount_attempted) {
+  if (recording_store_mount_attempted) {
     return false;
   }
 
-  littlefs_mount_attempted = true;
-  littlefs_ready = LittleFS.begin(false);
-  if (!littlefs_ready) {
-    littlefs_ready = LittleFS.begin(true);
+  recording_store_mount_attempted = true;
+  recording_store_mounted = LittleFS.begin(false);
+  if (!recording_store_mounted) {
+    recording_store_mounted = LittleFS.begin(true);
   }
-  return littlefs_ready;
+  return recording_store_mounted;
+}
+
+static recording_file recording_store_open(const String &path) {
+  return LittleFS.open(path, FILE_READ);
+}
+
+// `path` must be named by the recording's ID.
+static recording_file recording_store_create(const char *path) {
+  return LittleFS.open(path, FILE_WRITE);
+}
+
+static bool recording_store_remove(const String &path) {
+  return LittleFS.remove(path);
 }
 
-// Extracts the numeric ID from a recording filename like "rec_000012.ima".
-// Returns -1 if the name doesn't match the expected pattern.
-static long parse_recording_id(const String &name) {
-  String stripped = name;
-  if (stripped.startsWith("/")) {
-    stripped = stripped.substring(1);
+// Loops until no recordings remain, collecting paths before deleting to
+// avoid modifying the filesystem while iterating (same pattern as
+// recording_index_rebuild). One pass may not be enough if there are more
+// recordings than the buffer can hold.
+static void recording_store_remove_all() {
+  bool found = true;
+  while (found) {
+    found = false;
+    File root = LittleFS.open("/");
+    File entry = root.openNextFile();
+    String to_remove[32];
+    int remove_count = 0;
+    while (entry && remove_count < 32) {
+      String name = String(entry.name());
+      if (parse_recording_id(name.c_str()) >= 0) {
+        to_remove[remove_count++] = normalize_path(entry.name());
+        found = true;
+      }
+      entry = root.openNextFile();
+    }
+    for (int i = 0; i < remove_count; i++) {
+      bool removed = LittleFS.remove(to_remove[i]);
+      DBG("[flash] remove %s: %s\r\n", to_remove[i].c_str(),
+          removed ? "OK" : "FAILED");
+    }
   }
-  if (!stripped.startsWith("rec_")) {
-    return -1;
+}
+#else
+// Also initializes NVS, which holds the log's pointers: recording starts
+// before setup() gets to nvs_flash_init().
+static bool recording_store_ready() {
+  if (recording_store_mounted) {
+    return true;
   }
-  int dot = stripped.indexOf('.');
-  if (dot < 0) {
-    return -1;
+  if (recording_store_mount_attempted) {
+    return false;
   }
-  String suffix = stripped.substring(dot);
-  if (suffix != ".ima" && suffix != ".raw") {
-    return -1;
+
+  recording_store_mount_attempted = true;
+  recording_log_flash.partition =
+      esp_partition_find_first(ESP_PARTITION_TYPE_DATA,
+                               ESP_PARTITION_SUBTYPE_ANY,
+                               recording_log_partition_label);
+  if (recording_log_flash.partition == nullptr) {
+    DBG("[flash] no \"%s\" partition for the recording log\r\n",
+        recording_log_partition_label);
+    return false;
   }
-  String id_str = stripped.substring(4, dot);
-  if (id_str.length() == 0) {
-    return -1;
+  nvs_flash_init();
+  uint32_t pointers[2] = {0, 0};
+  nvs_handle_t handle;
+  if (nvs_open(recording_log_nvs_namespace, NVS_READONLY, &handle) == ESP_OK) {
+    size_t length = sizeof(pointers);
+    if (nvs_get_blob(handle, recording_log_nvs_key, pointers, &length) !=
+        ESP_OK) {
+      pointers[0] = pointers[1] = 0;
+    }
+    nvs_close(handle);
   }
-  return id_str.toInt();
+  recording_store_log.mount(pointers[0], pointers[1]);
+  DBG("[flash] recording log: %lu of %lu KB used\r\n",
+      (unsigned long)(recording_store_log.used_bytes() / 1024),
+      (unsigned long)(recording_store_log.capacity_bytes() / 1024));
+  recording_store_mounted = true;
+  return true;
 }
 
-// Returns the next available recording ID by scanning existing filenames.
-static long next_recording_id() {
-  if (!ensure_littlefs_ready()) {
-    return 1;
+static recording_file recording_store_open(const String &path) {
+  recording_log_entry entry;
+  long id = parse_recording_id(path.c_str());
+  if (id < 0 || !recording_store_log.find((uint32_t)id, entry)) {
+    return recording_file();
   }
+  return recording_file::for_reading(entry);
+}
 
-  long max_id = 0;
-  File root = LittleFS.open("/");
-  File entry = root.openNextFile();
-  while (entry) {
-    long id = parse_recording_id(String(entry.name()));
-    if (id > max_id) {
-      max_id = id;
-    }
-    entry = root.openNextFile();
+// `path` must be named by the recording's ID.
+static recording_file recording_store_create(const char *path) {
+  long id = parse_recording_id(path);
+  if (id < 0 || !recording_store_log.create((uint32_t)id)) {
+    return recording_file();
   }
-  return max_id + 1;
+  return recording_file::for_writing();
 }
 
-// Remove any 0-byte recording files left behind by failed writes or
-// filesystem corruption. These zombie files can't be streamed or deleted
-// during normal sync, so they cause the transfer loop to repeat forever.
-static void remove_empty_recordings() {
-  if (!ensure_littlefs_ready()) {
+static bool recording_store_remove(const String &path) {
+  long id = parse_recording_id(path.c_str());
+  return id >= 0 && recording_store_log.remove((uint32_t)id);
+}
+
+static void recording_store_remove_all() { recording_store_log.remove_all(); }
+#endif
+
+// Persistent index of the recordings on LittleFS, so sync and boot don't walk
+// the root directory on every REQUEST_NEXT/ACK_RECEIVED. It lives in RTC slow
+// memory, which survives deep sleep but not power loss; a magic/checksum
+// mismatch (cold boot, firmware update, corruption) triggers a rebuild from a
+// single directory scan. IDs are kept sorted ascending, oldest first, with
+// each recording's size alongside for the transfer schedule below.
+//
+// Every recording is at least one second of ADPCM (8 KB), so 512 entries cover
+// a 4 MB partition. If a scan ever finds more, the excess stays on flash and the
+// index is left invalid so each lookup falls back to a rescan.
+static const uint32_t recording_index_magic = 0x5844494d; // "MIDX"
+static const size_t recording_index_capacity = 512;
+// Set on IDs whose file uses the legacy ".raw" suffix instead of ".ima".
+static const uint32_t recording_index_raw_flag = 0x80000000;
+
+// Order in which REQUEST_NEXT and STREAM_ALL hand out recordings. A short
+// wake window may not drain a backlog, so sending the newest or smallest
+// recordings first gets the one the user is waiting for across sooner. The
+// client picks one with SET_SCHEDULE; it is kept in the index, so it lasts
+// until power is lost.
+enum schedule_policy : uint8_t {
+  schedule_oldest_first = 0,
+  schedule_newest_first = 1,
+  schedule_smallest_first = 2,
+  // Smallest first, but each recording counts as SCHEDULE_AGE_WEIGHT_KB
+  // larger per newer recording behind it, so old ones aren't starved.
+  schedule_weighted = 3,
+  schedule_policy_count,
+};
+
+#ifndef SCHEDULE_POLICY
+#define SCHEDULE_POLICY schedule_oldest_first
+#endif
+// 8 KB is about a second of audio.
+#ifndef SCHEDULE_AGE_WEIGHT_KB
+#define SCHEDULE_AGE_WEIGHT_KB 8
+#endif
+
+struct recording_index {
+  uint32_t magic;
+  uint32_t next_id;
+  uint16_t count;
+  uint8_t policy;
+  uint32_t entries[recording_index_capacity];
+  // Size of each entry in KB, rounded up. 0 until a recording is finalized.
+  uint16_t kilobytes[recording_index_capacity];
+  uint32_t checksum;
+};
+
+RTC_DATA_ATTR static recording_index rec_index;
+
+static uint32_t recording_index_compute_checksum() {
+  // FNV-1a over everything except the checksum field itself.
+  const uint8_t *bytes = (const uint8_t *)&rec_index;
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < offsetof(recording_index, checksum); i++) {
+    hash = (hash ^ bytes[i]) * 16777619u;
+  }
+  return hash;
+}
+
+static void recording_index_save() {
+  rec_index.magic = recording_index_magic;
+  rec_index.checksum = recording_index_compute_checksum();
+}
+
+static void recording_index_invalidate() {
+  rec_index.magic = 0;
+}
+
+static bool recording_index_valid() {
+  return rec_index.magic == recording_index_magic &&
+         rec_index.count <= recording_index_capacity &&
+         rec_index.checksum == recording_index_compute_checksum();
+}
+
+static uint32_t recording_index_entry_id(size_t position) {
+  return rec_index.entries[position] & ~recording_index_raw_flag;
+}
+
+static String recording_index_entry_path(size_t position) {
+  char path[40];
+  uint32_t entry = rec_index.entries[position];
+  snprintf(path, sizeof(path), "/rec_%06lu.%s",
+           (unsigned long)(entry & ~recording_index_raw_flag),
+           (entry & recording_index_raw_flag) ? "raw" : "ima");
+  return String(path);
+}
+
+static uint16_t recording_index_kilobytes(size_t bytes) {
+  size_t kilobytes = (bytes + 1023) / 1024;
+  return kilobytes > 0xffff ? 0xffff : (uint16_t)kilobytes;
+}
+
+// Inserts `entry` keeping entries sorted by ID. Returns false if full.
+static bool recording_index_insert(uint32_t entry, size_t bytes) {
+  if (rec_index.count >= recording_index_capacity) {
+    return false;
+  }
+  uint32_t id = entry & ~recording_index_raw_flag;
+  size_t position = rec_index.count;
+  while (position > 0 && recording_index_entry_id(position - 1) > id) {
+    rec_index.entries[position] = rec_index.entries[position - 1];
+    rec_index.kilobytes[position] = rec_index.kilobytes[position - 1];
+    position--;
+  }
+  rec_index.entries[position] = entry;
+  rec_index.kilobytes[position] = recording_index_kilobytes(bytes);
+  rec_index.count++;
+  return true;
+}
+
+// Rebuilds the index from a directory scan. Zero-byte recordings left behind
+// by failed writes or filesystem corruption are removed on the way: they can't
+// be streamed or deleted during normal sync, so they'd make the transfer loop
+// repeat forever.
+static void recording_index_rebuild() {
+  bool was_valid = recording_index_valid();
+  uint32_t previous_next_id = was_valid ? rec_index.next_id : 1;
+  uint8_t previous_policy =
+      was_valid ? rec_index.policy : (uint8_t)SCHEDULE_POLICY;
+  memset(&rec_index, 0, sizeof(rec_index));
+  rec_index.next_id = previous_next_id;
+  rec_index.policy = previous_policy;
+  if (!recording_store_ready()) {
     return;
   }
 
-  File root = LittleFS.open("/");
-  File entry = root.openNextFile();
-  // Collect paths first — modifying the filesystem while iterating is unsafe.
+  long max_id = 0;
+  bool overflowed = false;
+#if RECORDING_STORE == RECORDING_STORE_LITTLEFS
+  // Collect empty paths first — modifying the filesystem while iterating is
+  // unsafe.
   String to_remove[32];
   int remove_count = 0;
-  while (entry && remove_count < 32) {
+  File root = LittleFS.open("/");
+  File entry = root.openNextFile();
+  while (entry) {
     String name = String(entry.name());
-    if (parse_recording_id(name) >= 0 && entry.size() == 0) {
-      to_remove[remove_count++] = normalize_path(entry.name());
+    long id = parse_recording_id(name.c_str());
+    if (id >= 0) {
+      if (id > max_id) {
+        max_id = id;
+      }
+      if (entry.size() == 0) {
+        if (remove_count < 32) {
+          to_remove[remove_count++] = normalize_path(entry.name());
+        }
+      } else {
+        uint32_t index_entry = (uint32_t)id;
+        if (name.endsWith(".raw")) {
+          index_entry |= recording_index_raw_flag;
+        }
+        if (!recording_index_insert(index_entry, entry.size())) {
+          overflowed = true;
+        }
+      }
     }
     entry = root.openNextFile();
   }
@@ -399,46 +1034,184 @@ static void remove_empty_recordings() {
   for (int i = 0; i < remove_count; i++) {
     LittleFS.remove(to_remove[i]);
   }
+#else
+  // A header walk from the tail; every log record holds at least a header.
+  recording_store_log.for_each([&](const recording_log_entry &entry) {
+    if ((long)entry.id > max_id) {
+      max_id = entry.id;
+    }
+    if (!recording_index_insert(entry.id, entry.length)) {
+      overflowed = true;
+    }
+  });
+#endif
+
+  rec_index.next_id = (uint32_t)max_id + 1;
+  if (rec_index.next_id < previous_next_id) {
+    rec_index.next_id = previous_next_id;
+  }
+  if (overflowed) {
+    DBG("[flash] recording index full, falling back to scans\r\n");
+    return;
+  }
+  recording_index_save();
 }
 
-static int count_recordings() {
-  if (!ensure_littlefs_ready()) {
-    return 0;
+static void recording_index_ensure() {
+  if (!recording_index_valid()) {
+    recording_index_rebuild();
   }
+}
 
-  int count = 0;
-  File root = LittleFS.open("/");
-  File entry = root.openNextFile();
-  while (entry) {
-    if (parse_recording_id(String(entry.name())) >= 0) {
-      count++;
+// Records a newly created file. Called as soon as the file is opened so a
+// crash mid-recording still leaves it tracked.
+static void recording_index_add(uint32_t id) {
+  recording_index_ensure();
+  if (!recording_index_valid()) {
+    return;
+  }
+  if (!recording_index_insert(id, 0)) {
+    recording_index_invalidate();
+    return;
+  }
+  if (id >= rec_index.next_id) {
+    rec_index.next_id = id + 1;
+  }
+  recording_index_save();
+}
+
+// Drops `id` from the index after its file has been deleted.
+static void recording_index_remove(uint32_t id) {
+  recording_index_ensure();
+  if (!recording_index_valid()) {
+    return;
+  }
+  for (size_t i = 0; i < rec_index.count; i++) {
+    if (recording_index_entry_id(i) == id) {
+      memmove(&rec_index.entries[i], &rec_index.entries[i + 1],
+              (rec_index.count - i - 1) * sizeof(rec_index.entries[0]));
+      memmove(&rec_index.kilobytes[i], &rec_index.kilobytes[i + 1],
+              (rec_index.count - i - 1) * sizeof(rec_index.kilobytes[0]));
+      rec_index.count--;
+      recording_index_save();
+      return;
     }
-    entry = root.openNextFile();
   }
-  return count;
 }
 
-// Returns the path of the oldest recording (lowest numeric ID).
-static String next_recording_path() {
-  if (!ensure_littlefs_ready()) {
-    return "";
+// Returns the index position of `id`, or -1 if it isn't indexed.
+static long recording_index_find(uint32_t id) {
+  recording_index_ensure();
+  if (!recording_index_valid()) {
+    return -1;
+  }
+  for (size_t i = 0; i < rec_index.count; i++) {
+    if (recording_index_entry_id(i) == id) {
+      return (long)i;
+    }
   }
+  return -1;
+}
 
-  long lowest_id = -1;
-  String lowest_path = "";
+// Records the size of `id` once it is finalized.
+static void recording_index_set_size(uint32_t id, size_t bytes) {
+  long position = recording_index_find(id);
+  if (position < 0) {
+    return;
+  }
+  rec_index.kilobytes[position] = recording_index_kilobytes(bytes);
+  recording_index_save();
+}
 
-  File root = LittleFS.open("/");
-  File entry = root.openNextFile();
-  while (entry) {
-    String name = String(entry.name());
-    long id = parse_recording_id(name);
-    if (id >= 0 && (lowest_id < 0 || id < lowest_id)) {
-      lowest_id = id;
-      lowest_path = normalize_path(entry.name());
+// KB added to a recording's size under schedule_weighted.
+static uint32_t recording_schedule_age_cost(size_t position) {
+  return (uint32_t)(rec_index.count - 1 - position) * SCHEDULE_AGE_WEIGHT_KB;
+}
+
+// Whether the recording at `a` goes out before the one at `b` under the
+// current policy. Positions are in ID order, so newer means higher.
+static bool recording_schedule_before(size_t a, size_t b) {
+  switch (rec_index.policy) {
+  case schedule_newest_first:
+    return a > b;
+  case schedule_smallest_first:
+    if (rec_index.kilobytes[a] != rec_index.kilobytes[b]) {
+      return rec_index.kilobytes[a] < rec_index.kilobytes[b];
     }
-    entry = root.openNextFile();
+    return a < b;
+  case schedule_weighted: {
+    uint32_t cost_a = rec_index.kilobytes[a] + recording_schedule_age_cost(a);
+    uint32_t cost_b = rec_index.kilobytes[b] + recording_schedule_age_cost(b);
+    if (cost_a != cost_b) {
+      return cost_a < cost_b;
+    }
+    return a > b;
+  }
+  default:
+    return a < b;
+  }
+}
+
+// Fills `order` with every index position in transfer order. The index is
+// small enough that an insertion sort costs less than the flash reads that
+// follow it.
+static void recording_schedule(uint16_t *order) {
+  for (size_t i = 0; i < rec_index.count; i++) {
+    size_t j = i;
+    while (j > 0 && recording_schedule_before(i, order[j - 1])) {
+      order[j] = order[j - 1];
+      j--;
+    }
+    order[j] = (uint16_t)i;
   }
-  return lowest_path;
+}
+
+static void recording_schedule_set(uint8_t policy) {
+  recording_index_ensure();
+  if (policy >= schedule_policy_count) {
+    DBG("[ble] unknown schedule policy %u\r\n", (unsigned)policy);
+    return;
+  }
+  DBG("[ble] schedule policy %u\r\n", (unsigned)policy);
+  rec_index.policy = policy;
+  if (recording_index_valid()) {
+    recording_index_save();
+  }
+}
+
+// Returns the next available recording ID.
+static long next_recording_id() {
+  recording_index_ensure();
+  return rec_index.next_id;
+}
+
+static int count_recordings() {
+  recording_index_ensure();
+  return rec_index.count;
+}
+
+// Returns the path of the recording the schedule sends next.
+static String next_recording_path() {
+  recording_index_ensure();
+  if (rec_index.count == 0) {
+    return "";
+  }
+  size_t next = 0;
+  for (size_t i = 1; i < rec_index.count; i++) {
+    if (recording_schedule_before(i, next)) {
+      next = i;
+    }
+  }
+  return recording_index_entry_path(next);
+}
+
+// Returns the path of recording `id`, or "" if it isn't indexed.
+static String recording_path_for_id(uint32_t id) {
+  long position = recording_index_find(id);
+  if (position < 0) {
+    return "";
+  }
+  return recording_index_entry_path(position);
 }
 
 static void update_file_count() {
@@ -449,25 +1222,42 @@ static void update_file_count() {
   }
 }
 
-// Buffer size for each i2s_channel_read() call. In stereo mode each frame
-// contains a left and a right 32-bit sample, so 512 frames = 1024 int32_t
-// values and yields 256 usable mono samples (~16ms at 16 kHz).
-static const size_t i2s_read_frames = 512;
+// DMA headroom before the sampling loop falls behind the microphone. Each
+// DMA buffer holds a whole read when it fits the driver's 4092-byte limit, so
+// a read usually takes one descriptor and one interrupt.
+#ifndef I2S_DMA_MILLISECONDS
+#define I2S_DMA_MILLISECONDS 128
+#endif
+static const size_t i2s_dma_buffer_bytes_max = 4092;
+static constexpr uint32_t i2s_dma_frames =
+    pipeline::read_bytes <= i2s_dma_buffer_bytes_max
+        ? pipeline::read_frames
+        : pipeline::read_frames / 2;
+static constexpr uint32_t i2s_dma_descriptors =
+    (pipeline::samples_in_milliseconds(I2S_DMA_MILLISECONDS) +
+     i2s_dma_frames - 1) / i2s_dma_frames;
+static_assert(i2s_dma_frames * pipeline::frame_bytes <=
+                  i2s_dma_buffer_bytes_max,
+              "an I2S DMA buffer must fit 4092 bytes");
+static_assert(i2s_dma_descriptors >= 2, "I2S_DMA_MILLISECONDS is too short");
 
 static i2s_chan_handle_t i2s_rx_channel = nullptr;
 
 static bool i2s_init() {
   i2s_chan_config_t channel_config = I2S_CHANNEL_DEFAULT_CONFIG(
       I2S_NUM_AUTO, I2S_ROLE_MASTER);
+  channel_config.dma_desc_num = i2s_dma_descriptors;
+  channel_config.dma_frame_num = i2s_dma_frames;
   if (i2s_new_channel(&channel_config, nullptr, &i2s_rx_channel) != ESP_OK) {
     DBG("[rec] i2s_new_channel failed\r\n");
     return false;
   }
 
   i2s_std_config_t std_config = {
-      .clk_cfg = I2S_STD_CLK_DEFAULT_CONFIG(sample_rate),
-      .slot_cfg = I2S_STD_PHILIPS_SLOT_DEFAULT_CONFIG(I2S_DATA_BIT_WIDTH_32BIT,
-                                                       I2S_SLOT_MODE_STEREO),
+      .clk_cfg = I2S_STD_CLK_DEFAULT_CONFIG(pipeline::sample_rate),
+      .slot_cfg = I2S_STD_PHILIPS_SLOT_DEFAULT_CONFIG(
+          (i2s_data_bit_width_t)pipeline::slot::data_bits,
+          pipeline::slot::stereo ? I2S_SLOT_MODE_STEREO : I2S_SLOT_MODE_MONO),
       .gpio_cfg = {
           .mclk = I2S_GPIO_UNUSED,
           .bclk = (gpio_num_t)pin_i2s_sck,
@@ -482,6 +1272,12 @@ static bool i2s_init() {
       },
   };
 
+  // The INMP441 needs 64 clocks a frame whatever the data width, and its L/R
+  // pin puts it in the left slot.
+  std_config.slot_cfg.slot_bit_width = I2S_SLOT_BIT_WIDTH_32BIT;
+  std_config.slot_cfg.ws_width = I2S_SLOT_BIT_WIDTH_32BIT;
+  std_config.slot_cfg.slot_mask = I2S_STD_SLOT_LEFT;
+
   if (i2s_channel_init_std_mode(i2s_rx_channel, &std_config) != ESP_OK) {
     DBG("[rec] i2s_channel_init_std_mode failed\r\n");
     i2s_del_channel(i2s_rx_channel);
@@ -507,76 +1303,375 @@ static void i2s_deinit() {
   }
 }
 
-static bool record_and_save() {
-  bool recording_saved = false;
+// Sizes the ring from the largest free PSRAM block, rounded down to a power
+// of two. The allocation lasts until the next deep sleep.
+static void capture_buffer_ensure() {
+  if (ring_buffer.attached()) {
+    return;
+  }
+  size_t capacity = 0;
+  size_t largest = heap_caps_get_largest_free_block(MALLOC_CAP_SPIRAM);
+  if (largest >= CAPTURE_BUFFER_MAX_BYTES) {
+    largest = CAPTURE_BUFFER_MAX_BYTES;
+  }
+  if (largest > capture_buffer_fallback_bytes) {
+    capacity = capture_buffer_fallback_bytes;
+    while (capacity * 2 <= largest) {
+      capacity *= 2;
+    }
+  }
+  uint8_t *storage = nullptr;
+  if (capacity > 0) {
+    storage = (uint8_t *)heap_caps_malloc(capacity, MALLOC_CAP_SPIRAM);
+  }
+  bool in_psram = storage != nullptr;
+  if (!in_psram) {
+    capacity = capture_buffer_fallback_bytes;
+    storage = (uint8_t *)heap_caps_malloc(
+        capacity, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+  }
+  if (storage == nullptr) {
+    DBG("[rec] could not allocate a capture buffer\r\n");
+    return;
+  }
+  ring_buffer.attach(storage, capacity);
+  stats.capture_buffer_bytes = capacity;
+  DBG("[rec] capture buffer %lu KB (%s), %lu s of stall headroom\r\n",
+      (unsigned long)(capacity / 1024),
+      in_psram ? "PSRAM" : "internal",
+      (unsigned long)(capacity / pipeline::encoded_bytes_per_second));
+}
 
-  digitalWrite(pin_mic_power, HIGH);
+// The codec writes into this internal-RAM block, which moves to the ring one
+// LittleFS block at a time. The per-buffer encode path then never touches
+// PSRAM, and the ring only gets large sequential copies. A block that doesn't
+// fit is dropped whole; it starts on an ADPCM block boundary, so the rest of
+// the file still decodes.
+static uint8_t capture_staging[flash_write_chunk_bytes];
+static size_t capture_staging_length = 0;
+
+// Moves the staged bytes into the ring and wakes the writer.
+static void capture_staging_flush() {
+  if (capture_staging_length == 0) {
+    return;
+  }
+  ring_buffer.push_span(capture_staging, capture_staging_length);
+  capture_staging_length = 0;
+  size_t queued = ring_buffer.size();
+  if (queued > stats.ring_high_water_bytes) {
+    stats.ring_high_water_bytes = queued;
+  }
+  if (!writer_error && !writer_done.load(std::memory_order_acquire)) {
+    xTaskNotifyGive(writer_task_handle);
+  }
+}
 
-  if (!i2s_init()) {
-    digitalWrite(pin_mic_power, LOW);
+// Queues encoded bytes for the flash writer, and for the live sender when a
+// live stream is running.
+static void push_encoded(const uint8_t *data, size_t length) {
+  if (live_capturing.load(std::memory_order_relaxed) && !live_failed &&
+      !live_ring.push_span(data, length)) {
+    live_failed = true;
+  }
+  while (length > 0) {
+    size_t room = sizeof(capture_staging) - capture_staging_length;
+    size_t chunk = (length < room) ? length : room;
+    memcpy(capture_staging + capture_staging_length, data, chunk);
+    capture_staging_length += chunk;
+    data += chunk;
+    length -= chunk;
+    if (capture_staging_length == sizeof(capture_staging)) {
+      capture_staging_flush();
+    }
+  }
+}
+
+static uint8_t codec_output[pipeline::encoded_bytes_max];
+
+static void encode_to_ring(const pipeline::word *frames, size_t frame_count) {
+  push_encoded(codec_output,
+               pipeline::encode(frames, frame_count, codec_output));
+}
+
+// Optional voice activity gate. Silence that outlasts the hangover is left
+// out of the file and marked with a silence block, so it costs no flash,
+// sync time or transcription while the decoded duration stays the same.
+// Off by default; build with -DVAD_ENABLED=1.
+#ifndef VAD_ENABLED
+#define VAD_ENABLED 0
+#endif
+
+// Mean absolute deviation of an I2S buffer, in 16-bit sample units, above
+// which it counts as speech. Measuring around the buffer mean ignores the
+// microphone's DC offset.
+#ifndef VAD_THRESHOLD
+#define VAD_THRESHOLD 300
+#endif
+
+// Silence still recorded after speech, so word endings aren't clipped.
+#ifndef VAD_HANGOVER_MILLISECONDS
+#define VAD_HANGOVER_MILLISECONDS 500
+#endif
+
+// Silence kept from just before speech resumes, so onsets aren't clipped.
+#ifndef VAD_PREROLL_MILLISECONDS
+#define VAD_PREROLL_MILLISECONDS 128
+#endif
+
+#if VAD_ENABLED
+static const uint32_t vad_buffer_milliseconds = pipeline::read_milliseconds;
+static const uint32_t vad_hangover_buffers =
+    (VAD_HANGOVER_MILLISECONDS + vad_buffer_milliseconds - 1) /
+    vad_buffer_milliseconds;
+static const size_t vad_preroll_buffers =
+    (VAD_PREROLL_MILLISECONDS + vad_buffer_milliseconds - 1) /
+    vad_buffer_milliseconds;
+static_assert(vad_preroll_buffers > 0, "VAD_PREROLL_MILLISECONDS must be > 0");
+
+struct vad_gate {
+  // True while silence is being left out of the file.
+  bool gated;
+  uint32_t hangover_left;
+  // Silent samples left out since the gate closed, not counting the
+  // pre-roll still held.
+  uint32_t gap_samples;
+  // Totals for the current recording.
+  uint32_t silence_blocks;
+  uint32_t silent_samples;
+  // Ring of the most recent silent buffers, replayed when speech resumes.
+  size_t preroll_head;
+  size_t preroll_count;
+  size_t preroll_frames[vad_preroll_buffers];
+};
+
+static pipeline::word vad_preroll[vad_preroll_buffers][pipeline::read_words];
+
+static bool vad_is_speech(const pipeline::word *frames, size_t frame_count) {
+  if (frame_count == 0) {
     return false;
   }
+  int32_t sum = 0;
+  for (size_t i = 0; i < frame_count; i++) {
+    sum += pipeline::slot::sample(frames, i);
+  }
+  int32_t mean = sum / (int32_t)frame_count;
+  uint32_t deviation = 0;
+  for (size_t i = 0; i < frame_count; i++) {
+    int32_t difference = pipeline::slot::sample(frames, i) - mean;
+    deviation += difference < 0 ? -difference : difference;
+  }
+  // Compare sums rather than dividing by the frame count.
+  return deviation > (uint32_t)VAD_THRESHOLD * frame_count;
+}
 
-  do {
-    if (!ensure_littlefs_ready()) {
-      break;
+// Ends a gap: writes its silence block, if any samples were actually left
+// out, and empties the pre-roll (replaying it unless `replay` is false).
+static void vad_close_gap(vad_gate &gate, bool replay) {
+  if (!replay) {
+    for (size_t i = 0; i < gate.preroll_count; i++) {
+      gate.gap_samples +=
+          gate.preroll_frames[(gate.preroll_head + i) % vad_preroll_buffers];
     }
+    gate.preroll_count = 0;
+  }
+  if (gate.gap_samples > 0) {
+    uint8_t block[adpcm_block_bytes] = {};
+    block[3] = adpcm_block_silence;
+    memcpy(block + adpcm_block_header_bytes, &gate.gap_samples,
+           sizeof(gate.gap_samples));
+    push_encoded(block, sizeof(block));
+    gate.silence_blocks++;
+    gate.silent_samples += gate.gap_samples;
+    gate.gap_samples = 0;
+  }
+  for (; gate.preroll_count > 0; gate.preroll_count--) {
+    size_t slot = gate.preroll_head;
+    gate.preroll_head = (gate.preroll_head + 1) % vad_preroll_buffers;
+    encode_to_ring(vad_preroll[slot], gate.preroll_frames[slot]);
+  }
+  gate.gated = false;
+}
 
-    char filename[40];
-    snprintf(filename, sizeof(filename), "/rec_%06ld.ima", next_recording_id());
-
-    File file = LittleFS.open(filename, FILE_WRITE);
-    if (!file) {
-      break;
+// Routes one I2S buffer through the gate: encoded while speech or the
+// hangover lasts, otherwise held as pre-roll and then counted as gap.
+static void vad_process(vad_gate &gate, const pipeline::word *frames,
+                        size_t frame_count) {
+  bool speech = vad_is_speech(frames, frame_count);
+  if (gate.gated) {
+    if (speech) {
+      vad_close_gap(gate, true);
+      gate.hangover_left = vad_hangover_buffers;
+      encode_to_ring(frames, frame_count);
+      return;
     }
+    if (gate.preroll_count == vad_preroll_buffers) {
+      gate.gap_samples += gate.preroll_frames[gate.preroll_head];
+      gate.preroll_head = (gate.preroll_head + 1) % vad_preroll_buffers;
+      gate.preroll_count--;
+    }
+    size_t slot = (gate.preroll_head + gate.preroll_count) % vad_preroll_buffers;
+    memcpy(vad_preroll[slot], frames, frame_count * pipeline::frame_bytes);
+    gate.preroll_frames[slot] = frame_count;
+    gate.preroll_count++;
+    return;
+  }
 
-    // Reserve space for the sample count header — we'll fill it in after
-    // recording finishes, once we know the actual count.
-    uint32_t placeholder = 0;
-    file.write((uint8_t *)&placeholder, sizeof(placeholder));
+  if (speech) {
+    gate.hangover_left = vad_hangover_buffers;
+  } else if (gate.hangover_left > 0) {
+    gate.hangover_left--;
+  }
+  // A silence block must start on a block boundary, so finish the current
+  // block before gating and leave out only the rest of this buffer.
+  size_t to_boundary = pipeline::codec::frames_to_block_end();
+  if (speech || gate.hangover_left > 0 || to_boundary > frame_count) {
+    encode_to_ring(frames, frame_count);
+    return;
+  }
+  encode_to_ring(frames, to_boundary);
+  gate.gated = true;
+  gate.gap_samples = frame_count - to_boundary;
+}
+#endif
 
-    ring_buffer_reset();
-    adpcm_state encoder_state = {0, 0};
+// The file a recording goes to. The writer task fills it in, so mounting
+// LittleFS, allocating the ID (which may rescan the directory) and creating
+// the file all overlap with capture instead of delaying it.
+struct recording_target {
+  recording_file file;
+  uint32_t id;
+  char filename[40];
+  // Set once the file exists with its placeholder header and is indexed.
+  bool opened;
+};
 
-    // Start the flash writer on core 0 so page-erase stalls never block
-    // the sampling loop running here on core 1.
+static recording_target current_recording;
+
+static bool open_recording_file(recording_target &target) {
+  if (!recording_store_ready()) {
+    return false;
+  }
+
+  target.id = (uint32_t)next_recording_id();
+  snprintf(target.filename, sizeof(target.filename), "/rec_%06lu.ima",
+           (unsigned long)target.id);
+
+  target.file = recording_store_create(target.filename);
+  if (!target.file) {
+    return false;
+  }
+
+  // Reserve space for the header — we'll fill in the sample count after
+  // recording finishes, once we know it. A failed header write (storage
+  // full) would leave a 0-byte file, so drop it right away.
+  recording_header_with_rate header = make_stored_header(0, false);
+  if (target.file.write((uint8_t *)&header, recording_header_size) !=
+      recording_header_size) {
+    target.file.close();
+    recording_store_remove(target.filename);
+    return false;
+  }
+  recording_index_add(target.id);
+  target.opened = true;
+  live_recording_id.store(target.id, std::memory_order_release);
+  return true;
+}
+
+// Flash writer on core 0: opens the file, then drains the ring into it. Until
+// the file is open, the ring (about four seconds of audio) holds what the
+// sampling loop has already encoded. A failed open sets writer_error, which
+// ends the recording. The task never deletes itself: the sampling loop may
+// still be notifying it, so it parks once done and record_and_save() deletes
+// it after seeing writer_done.
+static void flash_writer_task(void *param) {
+  recording_target *target = (recording_target *)param;
+  if (open_recording_file(*target)) {
+    flash_writer_drain(&target->file);
+  } else {
+    DBG("[flash] could not create recording file\r\n");
+    writer_error = true;
+  }
+  writer_done.store(true, std::memory_order_release);
+  vTaskSuspend(nullptr);
+}
+
+// Starts capture as soon as the microphone is up; the filesystem work happens
+// on the writer task in parallel. `wake_microseconds` is the micros() reading
+// when the button press was seen (0 when it woke the device), for the
+// wake-to-first-sample counters.
+static bool record_and_save(unsigned long wake_microseconds) {
+  bool recording_saved = false;
+  bool live = false;
+  // The finished header, once the live copy is known to match it.
+  bool live_complete = false;
+  recording_header_with_rate live_header = {};
+
+  power_profile_enter(power_profile_recording);
+  digitalWrite(pin_mic_power, HIGH);
+
+  if (!i2s_init()) {
+    digitalWrite(pin_mic_power, LOW);
+    power_profile_enter(power_profile_idle);
+    return false;
+  }
+
+  do {
+    capture_buffer_ensure();
+    ring_buffer.reset();
+    capture_staging_length = 0;
+    pipeline::codec::begin();
+
+    // Start the flash writer on core 0 so file setup and page-erase stalls
+    // never block the sampling loop running here on core 1.
+    recording_target &target = current_recording;
+    target = recording_target();
+    live_recording_id.store(0, std::memory_order_relaxed);
     writer_active = true;
     writer_error = false;
     writer_done = false;
-    TaskHandle_t writer_handle = nullptr;
-    if (xTaskCreatePinnedToCore(flash_writer_task, "flash_wr", 4096, &file,
-                                1, &writer_handle, 0) != pdPASS) {
-      file.close();
-      LittleFS.remove(filename);
+    writer_max_stall_microseconds = 0;
+    if (xTaskCreatePinnedToCore(flash_writer_task, "flash_wr", 4096, &target,
+                                1, &writer_task_handle, 0) != pdPASS) {
       break;
     }
+    live = live_stream_begin(recording_header_size);
 
-    // In stereo mode each frame has two 32-bit slots (left + right).
-    // The INMP441 outputs 24-bit audio left-justified in the left slot;
-    // >> 16 yields a signed 16-bit sample.
-    static int32_t i2s_buf[i2s_read_frames * 2];
+    // Frames as the pipeline's slot format lays them out; see
+    // capture_pipeline.h.
+    static pipeline::word i2s_buf[pipeline::read_words];
     size_t bytes_read = 0;
 
     // Discard the first ~100ms of samples to skip the INMP441 startup
-    // transient. In stereo mode each frame is two int32_t values (L+R),
-    // so divide by 2 to count mono samples.
+    // transient. Each frame holds one mono sample.
     size_t discarded = 0;
     while (discarded < i2s_startup_discard_samples) {
       esp_err_t err = i2s_channel_read(i2s_rx_channel, i2s_buf, sizeof(i2s_buf),
                                        &bytes_read, portMAX_DELAY);
       if (err != ESP_OK) {
         DBG("[rec] i2s_channel_read error %d in discard loop\r\n", err);
+        stats.i2s_read_errors++;
         break;
       }
-      discarded += bytes_read / sizeof(int32_t) / 2;
+      if (discarded == 0) {
+        stats.wake_to_first_sample_microseconds = micros() - wake_microseconds;
+      }
+      discarded += bytes_read / pipeline::frame_bytes;
     }
+    stats.wake_to_first_kept_sample_microseconds = micros() - wake_microseconds;
+    DBG("[rec] first sample after %lu us, first kept sample after %lu us\r\n",
+        (unsigned long)stats.wake_to_first_sample_microseconds,
+        (unsigned long)stats.wake_to_first_kept_sample_microseconds);
 
     unsigned long record_start_milliseconds = millis();
     uint32_t sample_count = 0;
-    // Tracks whether we're holding an incomplete byte (the low nibble has
-    // been written but the high nibble hasn't arrived yet).
-    bool nibble_pending = false;
-    uint8_t packed_byte = 0;
+#if VAD_ENABLED
+    vad_gate gate = {};
+#endif
+#if DEBUG
+    uint64_t encode_cycles_total = 0;
+    uint32_t encode_cycles_max = 0;
+    uint32_t encode_buffers = 0;
+#endif
 
     while (digitalRead(pin_button) == LOW && !writer_error) {
       esp_err_t err = i2s_channel_read(i2s_rx_channel, i2s_buf,
@@ -584,43 +1679,106 @@ static bool record_and_save() {
                                        portMAX_DELAY);
       if (err != ESP_OK) {
         DBG("[rec] i2s_channel_read error %d\r\n", err);
+        stats.i2s_read_errors++;
         break;
       }
 
-      size_t total_samples = bytes_read / sizeof(int32_t);
-      for (size_t i = 0; i < total_samples; i += 2) {
-        // Stereo interleave: even indices are left channel (INMP441 data).
-        int16_t sample_16 = (int16_t)(i2s_buf[i] >> 16);
-        uint8_t nibble = adpcm_encode_sample(sample_16, encoder_state);
-        sample_count++;
-
-        // Pack two nibbles per byte, low nibble first.
-        if (!nibble_pending) {
-          packed_byte = nibble & 0x0F;
-          nibble_pending = true;
-        } else {
-          packed_byte |= (nibble << 4);
-          ring_buffer_push(packed_byte);
-          nibble_pending = false;
-        }
+      size_t frames = bytes_read / pipeline::frame_bytes;
+#if DEBUG
+      uint32_t encode_start = esp_cpu_get_cycle_count();
+#endif
+#if VAD_ENABLED
+      vad_process(gate, i2s_buf, frames);
+#else
+      encode_to_ring(i2s_buf, frames);
+#endif
+      sample_count += frames;
+#if DEBUG
+      uint32_t encode_cycles = esp_cpu_get_cycle_count() - encode_start;
+      encode_cycles_total += encode_cycles;
+      if (encode_cycles > encode_cycles_max) {
+        encode_cycles_max = encode_cycles;
       }
+      encode_buffers++;
+#endif
     }
 
-    // Flush the trailing nibble if the sample count was odd.
-    if (nibble_pending) {
-      ring_buffer_push(packed_byte);
+#if VAD_ENABLED
+    // Trailing silence becomes one last silence block.
+    if (gate.gated) {
+      vad_close_gap(gate, false);
+    }
+    DBG("[rec] vad: %lu silence block(s), %lu of %lu samples left out\r\n",
+        (unsigned long)gate.silence_blocks, (unsigned long)gate.silent_samples,
+        (unsigned long)sample_count);
+#endif
+    push_encoded(codec_output, pipeline::codec::finish(codec_output));
+    capture_staging_flush();
+#if DEBUG
+    if (encode_buffers > 0) {
+      // Share of the real-time budget (one I2S buffer period) spent
+      // encoding, in tenths of a percent. Anything near 1000 would fall
+      // behind the microphone.
+      uint32_t average_cycles = (uint32_t)(encode_cycles_total / encode_buffers);
+      uint64_t budget_cycles = (uint64_t)getCpuFrequencyMhz() *
+                               pipeline::read_frames * 1000000 /
+                               pipeline::sample_rate;
+      uint32_t average_load = (uint32_t)(average_cycles * 1000ULL / budget_cycles);
+      uint32_t peak_load = (uint32_t)(encode_cycles_max * 1000ULL / budget_cycles);
+      DBG("[rec] encode (%s): %lu cycles/buffer avg, %lu max, "
+          "load %lu.%lu%% avg, %lu.%lu%% peak\r\n",
+          pipeline::codec::name, (unsigned long)average_cycles,
+          (unsigned long)encode_cycles_max,
+          (unsigned long)(average_load / 10), (unsigned long)(average_load % 10),
+          (unsigned long)(peak_load / 10), (unsigned long)(peak_load % 10));
+      // Per second of audio, to compare slot formats across builds.
+      if (sample_count > 0) {
+        DBG("[rec] capture (%s): %lu encode cycles/s of audio, "
+            "%lu DMA bytes/s, %lu x %lu-frame DMA buffers\r\n",
+            pipeline::slot::name,
+            (unsigned long)(encode_cycles_total * pipeline::sample_rate /
+                            sample_count),
+            (unsigned long)(pipeline::sample_rate * pipeline::frame_bytes),
+            (unsigned long)i2s_dma_descriptors,
+            (unsigned long)i2s_dma_frames);
+      }
+    }
+#endif
+    if (ring_buffer.dropped() > 0) {
+      DBG("[rec] ring buffer full, dropped %lu bytes\r\n",
+          (unsigned long)ring_buffer.dropped());
     }
 
-    // Signal the writer task to drain remaining data and wait for it.
-    writer_active = false;
+    // Signal the writer task (and the live sender) to drain remaining data
+    // and wait for the writer.
+    writer_active.store(false, std::memory_order_release);
+    live_capturing.store(false, std::memory_order_release);
+    // A writer that failed (e.g. it could not create the file on a full
+    // filesystem) is no longer waiting for data.
+    if (!writer_error && !writer_done.load(std::memory_order_acquire)) {
+      xTaskNotifyGive(writer_task_handle);
+    }
     while (!writer_done) {
       delay(1);
     }
+    vTaskDelete(writer_task_handle);
+    writer_task_handle = nullptr;
+    DBG("[flash] longest write stall %lu us\r\n",
+        (unsigned long)writer_max_stall_microseconds);
+    stats.ring_dropped_bytes += ring_buffer.dropped();
+    if (writer_max_stall_microseconds > stats.flash_max_stall_microseconds) {
+      stats.flash_max_stall_microseconds = writer_max_stall_microseconds;
+    }
 
+    if (!target.opened) {
+      break;
+    }
+    recording_file &file = target.file;
     unsigned long duration_milliseconds = millis() - record_start_milliseconds;
     if (duration_milliseconds < minimum_recording_milliseconds) {
       file.close();
-      LittleFS.remove(filename);
+      recording_store_remove(target.filename);
+      recording_index_remove(target.id);
       break;
     }
 
@@ -628,21 +1786,44 @@ static bool record_and_save() {
     // encoded into the ring buffer never made it to flash. Recompute the
     // sample count from the actual file size so the header stays consistent.
     if (writer_error) {
-      size_t data_bytes = file.size() - sizeof(uint32_t);
-      sample_count = data_bytes * 2;
+      sample_count =
+          pipeline::codec::samples_in_payload(file.size() -
+                                              recording_header_size);
+#if VAD_ENABLED
+      // Silence blocks hold more samples than their size suggests. This can
+      // overcount, which is harmless: decoders stop at the end of the data.
+      sample_count += gate.silent_samples;
+#endif
     }
 
     // Seek back and write the actual sample count into the header.
+    bool gated = false;
+#if VAD_ENABLED
+    gated = gate.silence_blocks > 0;
+#endif
+    recording_header_with_rate header = make_stored_header(sample_count, gated);
+    // After a flash error the sample count describes the truncated file, not
+    // what was streamed, so the client fetches the flash copy instead.
+    live_header = header;
+    live_complete = !writer_error;
     file.seek(0);
-    file.write((uint8_t *)&sample_count, sizeof(sample_count));
+    file.write((uint8_t *)&header, recording_header_size);
+    size_t file_bytes = file.size();
     file.close();
+    recording_index_set_size(target.id, file_bytes);
 
     recording_saved = true;
+    stats.recordings++;
     update_file_count();
   } while (false);
+  if (live) {
+    live_stream_end(current_recording.id, live_complete ? &live_header : nullptr);
+  }
+  device_stats_publish();
 
   i2s_deinit();
   digitalWrite(pin_mic_power, LOW);
+  power_profile_enter(power_profile_idle);
 
   // Wait for the button to be released before returning. When storage is
   // full the recording loop exits while the button is still held — without
@@ -655,49 +1836,169 @@ static bool record_and_save() {
   return recording_saved;
 }
 
-// Send a BLE notification via NimBLE's ble_gatts_notify_custom(), retrying
-// when the call fails due to mbuf pool exhaustion (BLE_HS_ENOMEM) or other
-// transient congestion. The Arduino BLE wrapper also calls this function
-// internally, but on any non-zero return it aborts the entire transfer —
-// which caused ~70% of file data to be silently lost during streaming.
-static bool send_notification(uint16_t connection_id, uint16_t attribute_handle,
-                              uint8_t *data, int length) {
-  for (int attempt = 0; attempt < 200; attempt++) {
-    // ble_gatts_notify_custom consumes the mbuf regardless of success or
-    // failure, so we must allocate a fresh one on every attempt.
-    struct os_mbuf *om = ble_hs_mbuf_from_flat(data, length);
-    if (om == nullptr) {
-      delay(5);
-      continue;
-    }
+// High-throughput sync mode, requested once a client authenticates: LE 2M
+// PHY, 251-byte link-layer PDUs (Data Length Extension) and a 7.5–15 ms
+// connection interval. SYNC_DONE drops back to a relaxed interval. The
+// central has the final say on all three, so what was actually granted is
+// logged when each stream starts.
+static const uint16_t sync_connection_interval_min = 6;   // 7.5 ms, 1.25 ms units
+static const uint16_t sync_connection_interval_max = 12;  // 15 ms
+static const uint16_t idle_connection_interval_min = 80;  // 100 ms
+static const uint16_t idle_connection_interval_max = 120; // 150 ms
+static const uint16_t connection_supervision_timeout = 400; // 4 s, 10 ms units
+static const uint16_t data_length_tx_octets = 251;
+// Airtime for a 251-byte PDU on the 1M PHY, the largest the spec allows.
+static const uint16_t data_length_tx_time_microseconds = 2120;
+
+static void request_connection_interval(uint16_t connection_id,
+                                        uint16_t interval_min,
+                                        uint16_t interval_max) {
+  ble_gap_upd_params params = {};
+  params.itvl_min = interval_min;
+  params.itvl_max = interval_max;
+  params.latency = 0;
+  params.supervision_timeout = connection_supervision_timeout;
+  int rc = ble_gap_update_params(connection_id, &params);
+  if (rc != 0) {
+    DBG("[ble] connection parameter update failed: %d\r\n", rc);
+  }
+}
 
-    int rc = ble_gatts_notify_custom(connection_id, attribute_handle, om);
-    if (rc == 0) {
-      return true;
+// Set once the fast link has been asked for on this connection, which can
+// happen at connect (see recognize_central()) and again at authentication.
+static volatile bool high_throughput_requested = false;
+
+void enter_high_throughput_mode() {
+  if (ble_server == nullptr || high_throughput_requested) {
+    return;
+  }
+  high_throughput_requested = true;
+  uint16_t connection_id = ble_server->getConnId();
+  int rc = ble_gap_set_prefered_le_phy(connection_id, BLE_GAP_LE_PHY_2M_MASK,
+                                       BLE_GAP_LE_PHY_2M_MASK,
+                                       BLE_GAP_LE_PHY_CODED_ANY);
+  if (rc != 0) {
+    DBG("[ble] 2M PHY request failed: %d\r\n", rc);
+  }
+  rc = ble_hs_hci_util_set_data_len(connection_id, data_length_tx_octets,
+                                    data_length_tx_time_microseconds);
+  if (rc != 0) {
+    DBG("[ble] data length request failed: %d\r\n", rc);
+  }
+  request_connection_interval(connection_id, sync_connection_interval_min,
+                              sync_connection_interval_max);
+}
+
+static void exit_high_throughput_mode() {
+  if (ble_server == nullptr || !client_connected) {
+    return;
+  }
+  high_throughput_requested = false;
+  request_connection_interval(ble_server->getConnId(),
+                              idle_connection_interval_min,
+                              idle_connection_interval_max);
+}
+
+link_parameters read_link_parameters(uint16_t connection_id) {
+  link_parameters link = {};
+  ble_gap_read_le_phy(connection_id, &link.tx_phy, &link.rx_phy);
+  ble_gap_conn_desc descriptor = {};
+  if (ble_gap_conn_find(connection_id, &descriptor) == 0) {
+    link.interval = descriptor.conn_itvl;
+  }
+  link.mtu = ble_server->getPeerMTU(connection_id);
+  return link;
+}
+
+// Logs the PHY, connection interval and MTU currently in effect.
+static void log_link_parameters(uint16_t connection_id) {
+#if DEBUG
+  link_parameters link = read_link_parameters(connection_id);
+  DBG("[ble] link: phy tx=%u rx=%u, interval %u.%02u ms, mtu %u\r\n",
+      link.tx_phy, link.rx_phy, link.interval * 125 / 100,
+      link.interval * 125 % 100, link.mtu);
+#endif
+}
+
+// Notification flow control; see NOTIFY_WINDOW in firmware.h.
+notify_statistics notify_stats = {};
+
+void notify_flow_control_reset() { notify_stats = {}; }
+
+// Send a BLE notification via NimBLE's ble_gatts_notify_custom(). The Arduino
+// BLE wrapper also calls this function internally, but on any non-zero
+// return it aborts the entire transfer — which caused ~70% of file data to be
+// silently lost during streaming. NimBLE consumes `packet` whether or not the
+// call succeeds, so there is nothing to retry with; instead the sender waits
+// for NOTIFY_MSYS_RESERVE free msys mbufs first, and frees `packet` itself if
+// they don't turn up within NOTIFY_TIMEOUT_MILLISECONDS.
+bool send_notification(uint16_t connection_id, uint16_t attribute_handle,
+                       struct os_mbuf *packet) {
+  unsigned long wait_start = micros();
+  unsigned long deadline = millis() + NOTIFY_TIMEOUT_MILLISECONDS;
+  bool waited = false;
+  while (os_msys_num_free() < NOTIFY_MSYS_RESERVE) {
+    notify_stats.retries++;
+    waited = true;
+    if (!client_connected || (long)(millis() - deadline) >= 0) {
+      DBG("[ble] notify gave up waiting for msys mbufs\r\n");
+      os_mbuf_free_chain(packet);
+      notify_stats.failures++;
+      notify_stats.wait_microseconds += micros() - wait_start;
+      return false;
     }
-    // Non-zero means congestion (BLE_HS_ENOMEM = 6, BLE_HS_EBUSY = 15, etc).
-    // Wait briefly for the BLE stack to drain and retry.
-    delay(5);
+    vTaskDelay(1);
   }
-  return false;
+  if (waited) {
+    notify_stats.wait_microseconds += micros() - wait_start;
+  }
+  int rc = ble_gatts_notify_custom(connection_id, attribute_handle, packet);
+  if (rc != 0) {
+    DBG("[ble] notify failed: %d\r\n", rc);
+    notify_stats.failures++;
+    return false;
+  }
+  notify_stats.sent++;
+  return true;
 }
 
-// Opens the next recording file and sets file_info_characteristic so the
-// client can read the file size before streaming begins. The file handle is
+// Opens recording `requested_id`, or the next one by schedule if it is 0, and
+// sets file_info_characteristic to its size and recording ID (two uint32 LE)
+// so the client can read them before streaming begins. The ID lets the client
+// match a partial download from an earlier connection. The file handle is
 // kept open in pending_stream_file for stream_prepared_file() to consume.
-static void prepare_current_file() {
+static void prepare_current_file(uint32_t requested_id) {
   if (!client_connected || ble_server == nullptr) {
     return;
   }
+  if (pending_stream_file) {
+    pending_stream_file.close();
+  }
 
-  current_stream_path = next_recording_path();
+  current_stream_path = requested_id == 0 ? next_recording_path()
+                                          : recording_path_for_id(requested_id);
   if (current_stream_path.length() == 0) {
     uint32_t empty = 0;
     file_info_characteristic->setValue(empty);
     return;
   }
 
-  pending_stream_file = LittleFS.open(current_stream_path, FILE_READ);
+  pending_stream_file = recording_store_open(current_stream_path);
+  if (!pending_stream_file) {
+    // The index pointed at a file that isn't on flash (e.g. a reset between
+    // a delete and the index update). Rescan and retry with the real next
+    // file; reporting 0 here would make the client ACK, deleting it unseen.
+    DBG("[flash] indexed %s missing, rebuilding index\r\n",
+        current_stream_path.c_str());
+    recording_index_rebuild();
+    update_file_count();
+    current_stream_path = requested_id == 0
+                              ? next_recording_path()
+                              : recording_path_for_id(requested_id);
+    if (current_stream_path.length() > 0) {
+      pending_stream_file = recording_store_open(current_stream_path);
+    }
+  }
   if (!pending_stream_file) {
     current_stream_path = "";
     uint32_t empty = 0;
@@ -705,45 +2006,583 @@ static void prepare_current_file() {
     return;
   }
 
-  uint32_t file_size = pending_stream_file.size();
-  file_info_characteristic->setValue(file_size);
+  pending_stream_id = (uint32_t)parse_recording_id(current_stream_path.c_str());
+  uint32_t file_info[2] = {(uint32_t)pending_stream_file.size(),
+                           pending_stream_id};
+  file_info_characteristic->setValue((uint8_t *)file_info, sizeof(file_info));
+}
+
+// Streaming is split into two stages so the radio never idles during a
+// flash read: stream_reader_task() on core 0 reads LittleFS into MTU-sized
+// mbufs from stream_mbuf_pool while run_stream_pipeline() on core 1 hands
+// them to NimBLE through a filled queue; a null entry marks the end of the
+// stream. Each payload byte is copied once, from flash into its mbuf. The
+// pool holds the reader's read-ahead plus NOTIFY_WINDOW packets in flight.
+static const size_t stream_buffer_count = 8;
+static const size_t stream_mbuf_count = stream_buffer_count + NOTIFY_WINDOW;
+static const size_t stream_mbuf_block_bytes =
+    sizeof(struct os_mbuf) + sizeof(struct os_mbuf_pkthdr) +
+    stream_buffer_bytes;
+
+// STREAM_ALL sends every pending recording back to back as frames: an 8-byte
+// header (uint32 LE recording ID, uint32 LE size), the bytes, then a uint32 LE
+// CRC-32 of those bytes. The checksum trails the data so it is computed in the
+// same read pass. A header with ID 0 and size 0 ends the batch; IDs start at
+// 1, so it can't be mistaken for a recording. The resumed recording's frame
+// carries only the bytes from the resume offset on, and its size says so.
+static const size_t stream_frame_header_bytes = 8;
+
+// START_STREAM_FRAMED prefixes every notification with a uint32 LE sequence
+// number counted in bytes: the file offset of its first data byte. After each
+// window of up to stream_window_bytes, a window packet follows: sequence
+// stream_window_sequence, then uint32 LE window offset, length and CRC-32 of
+// the window's bytes. The client re-requests gaps and windows that fail the
+// check as ranges, so a lossy link costs a few packets rather than the file.
+// Ranges are streamed in the order given.
+static const size_t stream_window_bytes = 4096;
+// A framed stream skips a packet that times out, but gives up after this many
+// in a row; the link is then too poor for skipping to help.
+static const int stream_framed_max_failures = 3;
+static const size_t stream_ranges_max = command_payload_max / 8;
+
+static os_membuf_t
+    stream_mbuf_memory[OS_MEMPOOL_SIZE(stream_mbuf_count, stream_mbuf_block_bytes)];
+static struct os_mempool stream_mempool;
+struct os_mbuf_pool stream_mbuf_pool;
+static QueueHandle_t stream_filled_queue = nullptr;
+static SemaphoreHandle_t stream_reader_done = nullptr;
+static std::atomic<bool> stream_reader_stop{false};
+// Set while the reader task owns pending_stream_file, so onDisconnect() must
+// not close it underneath.
+static std::atomic<bool> stream_in_progress{false};
+
+// What the reader streams, where a bulk stream resumes, and the ranges of a
+// framed stream. Set before the reader task is created.
+static stream_mode stream_reader_mode = stream_mode_file;
+static uint32_t stream_resume_id = 0;
+static uint32_t stream_resume_offset = 0;
+static uint32_t stream_ranges[stream_ranges_max][2];
+static size_t stream_range_count = 0;
+
+// The reader's packet in progress, filled up to one notification's worth.
+struct stream_packer {
+  struct os_mbuf *packet;
+  size_t chunk_size;
+};
+
+// Takes an empty packet from the pool, waiting for NimBLE to free one if
+// they're all in use. Returns null once the stream has been stopped.
+static struct os_mbuf *stream_packet_get() {
+  unsigned long wait_start = micros();
+  bool waited = false;
+  while (!stream_reader_stop) {
+    struct os_mbuf *packet = os_mbuf_get_pkthdr(&stream_mbuf_pool, 0);
+    if (packet != nullptr) {
+      if (waited) {
+        notify_stats.wait_microseconds += micros() - wait_start;
+      }
+      return packet;
+    }
+    notify_stats.retries++;
+    waited = true;
+    vTaskDelay(1);
+  }
+  return nullptr;
+}
+
+// Hands the current packet to the notify loop when it's full (or, with
+// `force`, whenever it holds anything), then makes sure a packet with room is
+// available. Returns false once the stream has been stopped.
+static bool stream_packer_flush(stream_packer &packer, bool force) {
+  if (packer.packet != nullptr &&
+      (packer.packet->om_len >= packer.chunk_size ||
+       (force && packer.packet->om_len > 0))) {
+    xQueueSend(stream_filled_queue, &packer.packet, portMAX_DELAY);
+    packer.packet = nullptr;
+  }
+  if (packer.packet == nullptr) {
+    packer.packet = stream_packet_get();
+  }
+  return packer.packet != nullptr;
+}
+
+// Free space at the end of the current packet, which the caller fills and
+// then claims with os_mbuf_extend().
+static uint8_t *stream_packer_tail(stream_packer &packer) {
+  return packer.packet->om_data + packer.packet->om_len;
+}
+
+static bool stream_packer_append(stream_packer &packer, const uint8_t *data,
+                                 size_t length) {
+  while (length > 0) {
+    if (!stream_packer_flush(packer, false)) {
+      return false;
+    }
+    size_t room = packer.chunk_size - packer.packet->om_len;
+    size_t count = (length < room) ? length : room;
+    memcpy(stream_packer_tail(packer), data, count);
+    os_mbuf_extend(packer.packet, count);
+    data += count;
+    length -= count;
+  }
+  return true;
+}
+
+// Sends what is left plus the end marker, or just frees the packet if the
+// stream was stopped.
+static void stream_packer_finish(stream_packer &packer, bool streaming) {
+  if (streaming && packer.packet != nullptr && packer.packet->om_len > 0) {
+    xQueueSend(stream_filled_queue, &packer.packet, portMAX_DELAY);
+    packer.packet = nullptr;
+  }
+  if (packer.packet != nullptr) {
+    os_mbuf_free_chain(packer.packet);
+    packer.packet = nullptr;
+  }
+  if (streaming) {
+    struct os_mbuf *end_of_stream = nullptr;
+    xQueueSend(stream_filled_queue, &end_of_stream, portMAX_DELAY);
+  }
+}
+
+// Reads `file`, recording `id`, straight into pool mbufs until EOF, adding
+// the number of bytes read to `copied` and folding them into `crc` when it's
+// non-null. The CRC covers the plaintext.
+static bool stream_packer_append_file(stream_packer &packer,
+                                      recording_file &file, uint32_t id,
+                                      size_t &copied, uint32_t *crc) {
+  while (true) {
+    if (!stream_packer_flush(packer, false)) {
+      return false;
+    }
+    uint8_t *destination = stream_packer_tail(packer);
+    uint32_t offset = file.position();
+    int bytes_read =
+        file.read(destination, packer.chunk_size - packer.packet->om_len);
+    if (bytes_read <= 0) {
+      return true;
+    }
+    if (crc != nullptr) {
+      *crc = esp_rom_crc32_le(*crc, destination, bytes_read);
+    }
+    transport_crypt(id, offset, destination, bytes_read);
+    os_mbuf_extend(packer.packet, bytes_read);
+    copied += bytes_read;
+  }
+}
+
+// Appends the recording at index `position` as one frame. A short read is
+// padded out to the announced size so the client stays in step; the CRC then
+// fails and the client leaves that recording unacknowledged.
+static bool stream_packer_append_recording(stream_packer &packer,
+                                           size_t position) {
+  String path = recording_index_entry_path(position);
+  recording_file file = recording_store_open(path);
+  if (!file) {
+    DBG("[ble] cannot open %s, skipping\r\n", path.c_str());
+    return true;
+  }
+  uint32_t id = recording_index_entry_id(position);
+  uint32_t size = file.size();
+  if (id == stream_resume_id) {
+    // The client prepends what it already has, so a frame that can't start at
+    // the offset is left out; the client then drops its partial copy and gets
+    // the whole recording next time.
+    if (stream_resume_offset > size || !file.seek(stream_resume_offset)) {
+      DBG("[ble] cannot resume %s at %lu, skipping\r\n", path.c_str(),
+          (unsigned long)stream_resume_offset);
+      file.close();
+      return true;
+    }
+    size -= stream_resume_offset;
+  }
+  uint8_t header[stream_frame_header_bytes];
+  memcpy(header, &id, sizeof(id));
+  memcpy(header + sizeof(id), &size, sizeof(size));
+
+  uint32_t crc = 0;
+  size_t copied = 0;
+  bool streaming = stream_packer_append(packer, header, sizeof(header)) &&
+                   stream_packer_append_file(packer, file, id, copied, &crc);
+  file.close();
+  static const uint8_t padding[64] = {};
+  while (streaming && copied < size) {
+    size_t count = size - copied;
+    if (count > sizeof(padding)) {
+      count = sizeof(padding);
+    }
+    streaming = stream_packer_append(packer, padding, count);
+    copied += count;
+  }
+  return streaming &&
+         stream_packer_append(packer, (const uint8_t *)&crc, sizeof(crc));
+}
+
+// Appends `length` bytes of pending_stream_file from `offset` as framed
+// packets. Packets never straddle a window, so each window's CRC covers whole
+// packets. A range that can't be read is left for the client to ask again.
+static bool stream_packer_append_framed(stream_packer &packer, uint32_t offset,
+                                        uint32_t length) {
+  uint32_t size = pending_stream_file.size();
+  if (offset >= size || !pending_stream_file.seek(offset)) {
+    DBG("[ble] framed seek to %lu failed\r\n", (unsigned long)offset);
+    return true;
+  }
+  if (length == 0 || length > size - offset) {
+    length = size - offset;
+  }
+  uint32_t end = offset + length;
+  while (offset < end) {
+    uint32_t window_offset = offset;
+    uint32_t window_end = offset + stream_window_bytes;
+    if (window_end > end) {
+      window_end = end;
+    }
+    uint32_t crc = 0;
+    while (offset < window_end) {
+      if (!stream_packer_flush(packer, true)) {
+        return false;
+      }
+      uint8_t *data = stream_packer_tail(packer) + stream_packet_header_bytes;
+      size_t count = packer.chunk_size - stream_packet_header_bytes;
+      if (count > window_end - offset) {
+        count = window_end - offset;
+      }
+      int bytes_read = pending_stream_file.read(data, count);
+      if (bytes_read <= 0) {
+        // Short file: close the window early; the client requests the rest.
+        end = window_end = offset;
+        break;
+      }
+      memcpy(stream_packer_tail(packer), &offset, sizeof(offset));
+      os_mbuf_extend(packer.packet, stream_packet_header_bytes + bytes_read);
+      crc = esp_rom_crc32_le(crc, data, bytes_read);
+      transport_crypt(pending_stream_id, offset, data, bytes_read);
+      offset += bytes_read;
+    }
+    if (offset == window_offset) {
+      break;
+    }
+    if (!stream_packer_flush(packer, true)) {
+      return false;
+    }
+    uint32_t window[4] = {stream_window_sequence, window_offset,
+                          offset - window_offset, crc};
+    if (!stream_packer_append(packer, (const uint8_t *)window,
+                              sizeof(window))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Packs `length` bytes of link benchmark packets; see benchmark.h.
+static bool stream_packer_append_benchmark(stream_packer &packer,
+                                           uint32_t length) {
+  uint32_t offset = 0;
+  while (offset < length) {
+    if (!stream_packer_flush(packer, true)) {
+      return false;
+    }
+    size_t count = packer.chunk_size - benchmark_packet_header_bytes;
+    if (count > length - offset) {
+      count = length - offset;
+    }
+    benchmark_packet_fill(stream_packer_tail(packer), offset, count);
+    os_mbuf_extend(packer.packet, benchmark_packet_header_bytes + count);
+    offset += count;
+  }
+  return true;
+}
+
+static void stream_reader_task(void *param) {
+  stream_packer packer = {nullptr, (size_t)param};
+  bool streaming = true;
+  if (stream_reader_mode == stream_mode_framed) {
+    for (size_t i = 0; streaming && i < stream_range_count; i++) {
+      streaming = stream_packer_append_framed(packer, stream_ranges[i][0],
+                                              stream_ranges[i][1]);
+    }
+  } else if (stream_reader_mode == stream_mode_benchmark) {
+    streaming = stream_packer_append_benchmark(packer, benchmark_length);
+  } else if (stream_reader_mode == stream_mode_all) {
+    static uint16_t order[recording_index_capacity];
+    recording_schedule(order);
+    for (size_t i = 0; streaming && i < rec_index.count; i++) {
+      streaming = stream_packer_append_recording(packer, order[i]);
+    }
+    const uint8_t end_of_batch[stream_frame_header_bytes] = {};
+    streaming = streaming &&
+                stream_packer_append(packer, end_of_batch, sizeof(end_of_batch));
+  } else {
+    size_t copied = 0;
+    streaming = stream_packer_append_file(packer, pending_stream_file,
+                                          pending_stream_id, copied, nullptr);
+  }
+  stream_packer_finish(packer, streaming);
+  xSemaphoreGive(stream_reader_done);
+  vTaskDelete(nullptr);
+}
+
+bool stream_pipeline_init() {
+  if (stream_filled_queue != nullptr) {
+    return true;
+  }
+  if (os_mempool_init(&stream_mempool, stream_mbuf_count,
+                      stream_mbuf_block_bytes, stream_mbuf_memory,
+                      "stream") != 0 ||
+      os_mbuf_pool_init(&stream_mbuf_pool, &stream_mempool,
+                        stream_mbuf_block_bytes, stream_mbuf_count) != 0) {
+    DBG("[ble] stream mbuf pool init failed\r\n");
+    return false;
+  }
+  // Deep enough for every pool mbuf plus the end marker, so the reader never
+  // waits on the queue itself.
+  stream_filled_queue =
+      xQueueCreate(stream_mbuf_count + 1, sizeof(struct os_mbuf *));
+  stream_reader_done = xSemaphoreCreateBinary();
+  if (stream_filled_queue == nullptr || stream_reader_done == nullptr) {
+    DBG("[ble] stream pipeline allocation failed\r\n");
+    stream_filled_queue = nullptr;
+    return false;
+  }
+  return true;
+}
+
+// Stops the reader, waits for it to exit and frees the packets it queued but
+// the notify loop never sent.
+static void stream_reader_join() {
+  stream_reader_stop = true;
+  while (xSemaphoreTake(stream_reader_done, pdMS_TO_TICKS(10)) != pdTRUE) {
+  }
+  struct os_mbuf *packet = nullptr;
+  while (xQueueReceive(stream_filled_queue, &packet, 0) == pdTRUE) {
+    if (packet != nullptr) {
+      os_mbuf_free_chain(packet);
+    }
+  }
+}
+
+// BLE notification payload is MTU minus 3 bytes of ATT header. Falls back to
+// 20 if the server reports an unexpectedly low value.
+size_t stream_chunk_size(uint16_t connection_id) {
+  uint16_t mtu = ble_server->getPeerMTU(connection_id);
+  size_t chunk_size = (mtu > 3) ? (mtu - 3) : 20;
+  if (chunk_size > stream_buffer_bytes) {
+    chunk_size = stream_buffer_bytes;
+  }
+  return chunk_size;
+}
+
+// Starts the reader and drains its buffers into notifications until the
+// stream ends or the link drops. The caller has checked the connection and
+// initialised the pipeline.
+void run_stream_pipeline(stream_mode mode) {
+  uint16_t connection_id = ble_server->getConnId();
+  uint16_t attribute_handle = audio_data_characteristic->getHandle();
+
+  log_link_parameters(connection_id);
+  size_t chunk_size = stream_chunk_size(connection_id);
+
+  notify_flow_control_reset();
+  stream_reader_mode = mode;
+  stream_reader_stop = false;
+  stream_in_progress = true;
+  if (xTaskCreatePinnedToCore(stream_reader_task, "stream_rd", 4096,
+                              (void *)chunk_size, 1, nullptr, 0) != pdPASS) {
+    DBG("[ble] stream reader task creation failed\r\n");
+    stream_in_progress = false;
+    return;
+  }
+  power_profile_enter(power_profile_streaming);
+
+  unsigned long stream_start_milliseconds = millis();
+  size_t bytes_sent = 0;
+  int consecutive_failures = 0;
+  while (client_connected) {
+    struct os_mbuf *packet = nullptr;
+    if (xQueueReceive(stream_filled_queue, &packet,
+                      pdMS_TO_TICKS(NOTIFY_TIMEOUT_MILLISECONDS)) != pdTRUE) {
+      DBG("[ble] stream stalled, giving up\r\n");
+      notify_stats.failures++;
+      break;
+    }
+    if (packet == nullptr) {
+      break;
+    }
+    size_t length = OS_MBUF_PKTLEN(packet);
+    if (mode == stream_mode_benchmark) {
+      benchmark_stamp(packet);
+    }
+    bool sent = send_notification(connection_id, attribute_handle, packet);
+    if (sent) {
+      bytes_sent += length;
+    }
+    consecutive_failures = sent ? 0 : consecutive_failures + 1;
+    // Only a framed stream can afford to lose a packet: the client notices
+    // the gap and asks for it again. A benchmark just counts it.
+    bool lossy = mode == stream_mode_framed || mode == stream_mode_benchmark;
+    if (!sent &&
+        (!lossy || consecutive_failures >= stream_framed_max_failures)) {
+      break;
+    }
+  }
+
+  stream_reader_join();
+  stream_in_progress = false;
+  power_profile_enter(power_profile_idle);
+  unsigned long stream_milliseconds = millis() - stream_start_milliseconds;
+  DBG("[ble] streamed %u bytes in %lu ms\r\n", (unsigned)bytes_sent,
+      stream_milliseconds);
+  DBG("[ble] notify: %lu sent, %lu retries, %lu failed, %lu us waiting "
+      "(window %d)\r\n",
+      (unsigned long)notify_stats.sent, (unsigned long)notify_stats.retries,
+      (unsigned long)notify_stats.failures,
+      (unsigned long)notify_stats.wait_microseconds, NOTIFY_WINDOW);
+  stats.notify_retries += notify_stats.retries;
+  stats.notify_failures += notify_stats.failures;
+  stats.streamed_bytes += bytes_sent;
+  if (stream_milliseconds > 0) {
+    stats.stream_bytes_per_second =
+        (uint32_t)((uint64_t)bytes_sent * 1000 / stream_milliseconds);
+  }
+  device_stats_publish();
+}
+
+void stream_prepared_file_release() {
+  if (pending_stream_file) {
+    pending_stream_file.close();
+  }
+  current_stream_path = "";
 }
 
 // Streams the file prepared by prepare_current_file() via BLE notifications,
-// then closes the file handle. No-op if no file was prepared.
-static void stream_prepared_file() {
+// starting `offset` bytes in, then closes the file handle. No-op if no file
+// was prepared.
+static void stream_prepared_file(uint32_t offset) {
   if (!pending_stream_file) {
     DBG("[ble] stream_prepared_file called with no prepared file\r\n");
     return;
   }
 
-  if (!client_connected || ble_server == nullptr) {
-    pending_stream_file.close();
-    return;
+  if (offset > 0 && !pending_stream_file.seek(offset)) {
+    DBG("[ble] seek to %lu failed\r\n", (unsigned long)offset);
+  } else if (client_connected && ble_server != nullptr &&
+             stream_pipeline_init()) {
+    DBG("[ble] streaming from offset %lu\r\n", (unsigned long)offset);
+    run_stream_pipeline(stream_mode_file);
   }
+  pending_stream_file.close();
+}
 
-  uint16_t connection_id = ble_server->getConnId();
-  uint16_t attribute_handle = audio_data_characteristic->getHandle();
+// Streams the (offset, length) ranges packed in a START_STREAM_FRAMED payload
+// from the prepared file in framed mode (see stream_packet_header_bytes). The
+// file stays open so the client can ask for more ranges; ACK_RECEIVED, the
+// next REQUEST_NEXT or a disconnect closes it.
+static void stream_prepared_ranges(const uint8_t *payload, size_t length) {
+  if (!pending_stream_file) {
+    DBG("[ble] stream_prepared_ranges called with no prepared file\r\n");
+    return;
+  }
+  if (!client_connected || ble_server == nullptr || !stream_pipeline_init()) {
+    return;
+  }
+  // A bare START_STREAM_FRAMED streams the whole file.
+  memset(stream_ranges, 0, sizeof(stream_ranges));
+  stream_range_count = length / sizeof(stream_ranges[0]);
+  if (stream_range_count == 0) {
+    stream_range_count = 1;
+  }
+  memcpy(stream_ranges, payload,
+         (length / sizeof(stream_ranges[0])) * sizeof(stream_ranges[0]));
+  DBG("[ble] streaming %u framed range(s) from %lu\r\n",
+      (unsigned)stream_range_count, (unsigned long)stream_ranges[0][0]);
+  run_stream_pipeline(stream_mode_framed);
+}
 
-  // BLE notification payload is MTU minus 3 bytes of ATT header. Fall back to
-  // 20 if the server reports an unexpectedly low value.
-  uint16_t mtu = ble_server->getPeerMTU(connection_id);
-  int chunk_size = (mtu > 3) ? (mtu - 3) : 20;
-  uint8_t chunk[512];
-  if (chunk_size > (int)sizeof(chunk)) {
-    chunk_size = sizeof(chunk);
+// Streams every pending recording in one go, framed as described at
+// stream_frame_header_bytes, skipping the first `resume_offset` bytes of
+// recording `resume_id` (0 resumes nothing). Nothing is deleted here: the
+// client removes what it received intact with ACK_IDS, so a dropped link
+// loses nothing.
+static void stream_all_recordings(uint32_t resume_id, uint32_t resume_offset) {
+  if (!client_connected || ble_server == nullptr || !stream_pipeline_init() ||
+      !recording_store_ready()) {
+    return;
   }
+  stream_prepared_file_release();
+  recording_index_ensure();
+  DBG("[ble] streaming %u recordings\r\n", (unsigned)rec_index.count);
+  stream_resume_id = resume_id;
+  stream_resume_offset = resume_offset;
+  run_stream_pipeline(stream_mode_all);
+}
 
-  while (pending_stream_file.available() && client_connected) {
-    int bytes_read = pending_stream_file.read(chunk, chunk_size);
-    if (bytes_read > 0) {
-      if (!send_notification(connection_id, attribute_handle, chunk,
-                             bytes_read)) {
+// The BENCHMARK flash kind, kept here with the recording store it reads.
+void benchmark_flash_read(uint32_t length, size_t read_size,
+                          benchmark_result &result) {
+  if (!recording_store_ready()) {
+    return;
+  }
+  recording_index_ensure();
+  // The clocks of a real stream's reader.
+  power_profile_enter(power_profile_streaming);
+  uint8_t buffer[stream_buffer_bytes];
+  uint32_t start = micros();
+  for (size_t i = 0; i < rec_index.count && result.bytes < length; i++) {
+    recording_file file = recording_store_open(recording_index_entry_path(i));
+    if (!file) {
+      continue;
+    }
+    while (result.bytes < length) {
+      size_t count = read_size;
+      if (count > length - result.bytes) {
+        count = length - result.bytes;
+      }
+      uint32_t read_start = micros();
+      int bytes_read = file.read(buffer, count);
+      uint32_t read_microseconds = micros() - read_start;
+      if (bytes_read <= 0) {
         break;
       }
+      result.bytes += bytes_read;
+      result.packets++;
+      if (read_microseconds > result.longest_microseconds) {
+        result.longest_microseconds = read_microseconds;
+      }
     }
+    file.close();
   }
-  pending_stream_file.close();
+  result.microseconds = micros() - start;
+  power_profile_enter(power_profile_idle);
+}
+
+// Deletes each recording named in an ACK_IDS payload. IDs that aren't indexed
+// (already deleted, or a repeated ACK) are ignored, so retrying is safe.
+static void acknowledge_recordings(const uint8_t *payload, size_t length) {
+  stream_prepared_file_release();
+  bool failed = false;
+  for (size_t offset = 0; offset + sizeof(uint32_t) <= length;
+       offset += sizeof(uint32_t)) {
+    uint32_t id;
+    memcpy(&id, payload + offset, sizeof(id));
+    long position = recording_index_find(id);
+    if (position < 0) {
+      continue;
+    }
+    String path = recording_index_entry_path(position);
+    bool removed = recording_store_remove(path);
+    DBG("[ble] remove %s: %s\r\n", path.c_str(), removed ? "OK" : "FAILED");
+    if (removed) {
+      recording_index_remove(id);
+    } else {
+      failed = true;
+    }
+  }
+  if (failed) {
+    recording_index_rebuild();
+  }
+  update_file_count();
 }
 
 static uint16_t read_battery_millivolts() {
@@ -767,6 +2606,8 @@ static uint16_t read_battery_millivolts() {
 static const size_t pairing_token_length = 16;
 static const char *nvs_namespace = "middle";
 static const char *nvs_key_pair_token = "pair_token";
+// Identity address of the central that last authenticated.
+static const char *nvs_key_pair_central = "pair_central";
 
 // Reads the stored pairing token from NVS into `out_token`. Returns true if a
 // token was found (pendant is claimed), false if absent (unclaimed).
@@ -813,7 +2654,8 @@ static bool nvs_write_pair_token(const uint8_t token[pairing_token_length]) {
   return true;
 }
 
-// Erases the pair token from NVS, unpairing the pendant.
+// Erases the pair token and the cached central from NVS, unpairing the
+// pendant.
 static bool nvs_erase_pair_token() {
   nvs_handle_t handle;
   esp_err_t err = nvs_open(nvs_namespace, NVS_READWRITE, &handle);
@@ -822,6 +2664,8 @@ static bool nvs_erase_pair_token() {
     return false;
   }
   err = nvs_erase_key(handle, nvs_key_pair_token);
+  // The cached central goes with the token; it may never have been written.
+  nvs_erase_key(handle, nvs_key_pair_central);
   if (err == ESP_OK) {
     err = nvs_commit(handle);
   }
@@ -834,16 +2678,83 @@ static bool nvs_erase_pair_token() {
   return true;
 }
 
+// The central that last authenticated, cached from NVS by init_ble(). When it
+// connects again, the fast link is requested straight away rather than after
+// the pairing write, so the MTU exchange, service discovery and pairing
+// exchange already run at the short connection interval. This only tunes the
+// link: the token still decides what the central may do.
+static ble_addr_t paired_central = {};
+static bool paired_central_known = false;
+// Set by onConnect() for the loop, where the connection can be looked up.
+static volatile bool central_check_pending = false;
+
+static void nvs_read_pair_central() {
+  nvs_handle_t handle;
+  if (nvs_open(nvs_namespace, NVS_READONLY, &handle) != ESP_OK) {
+    return;
+  }
+  size_t length = sizeof(paired_central);
+  paired_central_known =
+      nvs_get_blob(handle, nvs_key_pair_central, &paired_central, &length) ==
+          ESP_OK &&
+      length == sizeof(paired_central);
+  nvs_close(handle);
+}
+
+static bool same_address(const ble_addr_t &a, const ble_addr_t &b) {
+  return a.type == b.type && memcmp(a.val, b.val, sizeof(a.val)) == 0;
+}
+
+// Caches the authenticated central's address, writing NVS only when it
+// changed so a routine reconnect costs no flash write.
+static void remember_central() {
+  ble_gap_conn_desc descriptor = {};
+  if (ble_gap_conn_find(ble_server->getConnId(), &descriptor) != 0 ||
+      (paired_central_known &&
+       same_address(descriptor.peer_id_addr, paired_central))) {
+    return;
+  }
+  nvs_handle_t handle;
+  if (nvs_open(nvs_namespace, NVS_READWRITE, &handle) != ESP_OK) {
+    return;
+  }
+  if (nvs_set_blob(handle, nvs_key_pair_central, &descriptor.peer_id_addr,
+                   sizeof(descriptor.peer_id_addr)) == ESP_OK &&
+      nvs_commit(handle) == ESP_OK) {
+    paired_central = descriptor.peer_id_addr;
+    paired_central_known = true;
+  }
+  nvs_close(handle);
+}
+
+static void recognize_central() {
+  if (!paired_central_known || !client_connected || ble_server == nullptr) {
+    return;
+  }
+  ble_gap_conn_desc descriptor = {};
+  if (ble_gap_conn_find(ble_server->getConnId(), &descriptor) == 0 &&
+      same_address(descriptor.peer_id_addr, paired_central)) {
+    DBG("[ble] known central, requesting the fast link\r\n");
+    enter_high_throughput_mode();
+  }
+}
+
 class server_callbacks : public BLEServerCallbacks {
   void onConnect(BLEServer *server) override {
+    transport_session_reset();
+    high_throughput_requested = false;
     client_connected = true;
+    central_check_pending = true;
+    loop_wake();
   }
 
   void onDisconnect(BLEServer *server) override {
     client_connected = false;
     connection_authenticated = false;
-    command_queue_clear();
-    if (pending_stream_file) {
+    live_subscribed = false;
+    // An active stream notices the disconnect and closes the file itself
+    // once its reader task has stopped using it.
+    if (pending_stream_file && !stream_in_progress) {
       pending_stream_file.close();
     }
     if (pending_recording_count > 0) {
@@ -851,23 +2762,40 @@ class server_callbacks : public BLEServerCallbacks {
     } else {
       sleep_requested = true;
     }
+    loop_wake();
   }
 };
 
 class command_callbacks : public BLECharacteristicCallbacks {
   void onWrite(BLECharacteristic *characteristic) override {
     String value = characteristic->getValue();
-    if (value.length() > 0) {
-      command_queue_push((uint8_t)value[0]);
+    size_t length = value.length();
+    if (length == 0) {
+      return;
     }
+    if (length - 1 > command_payload_max) {
+      DBG("[ble] command 0x%02x payload too long (%u)\r\n",
+          (uint8_t)value[0], (unsigned)(length - 1));
+      return;
+    }
+    ble_command command = {};
+    command.opcode = (uint8_t)value[0];
+    command.length = (uint8_t)(length - 1);
+    memcpy(command.payload, value.c_str() + 1, command.length);
+    command_queue.push(command);
+    loop_wake();
   }
 };
 
 class pairing_callbacks : public BLECharacteristicCallbacks {
+  // The status byte, then this connection's nonce for ENCRYPT. Clients that
+  // predate encryption read only the first byte.
   void onRead(BLECharacteristic *characteristic) override {
     uint8_t stored_token[pairing_token_length];
-    uint8_t status = nvs_read_pair_token(stored_token) ? 0x01 : 0x00;
-    characteristic->setValue(&status, 1);
+    uint8_t value[1 + transport_nonce_length];
+    value[0] = nvs_read_pair_token(stored_token) ? 0x01 : 0x00;
+    memcpy(value + 1, transport_pendant_nonce, transport_nonce_length);
+    characteristic->setValue(value, sizeof(value));
   }
 
   void onWrite(BLECharacteristic *characteristic) override {
@@ -891,6 +2819,8 @@ class pairing_callbacks : public BLECharacteristicCallbacks {
       }
       DBG("[ble] paired with new token\r\n");
       connection_authenticated = true;
+      remember_central();
+      enter_high_throughput_mode();
       ble_active_until_milliseconds = millis() + ble_keepalive_milliseconds;
       hard_sleep_deadline_milliseconds = millis() + 30000;
     } else {
@@ -901,13 +2831,18 @@ class pairing_callbacks : public BLECharacteristicCallbacks {
       }
       DBG("[ble] token verified\r\n");
       connection_authenticated = true;
+      remember_central();
+      enter_high_throughput_mode();
       ble_active_until_milliseconds = millis() + ble_keepalive_milliseconds;
       hard_sleep_deadline_milliseconds = millis() + 30000;
     }
+    // The sleep deadlines moved.
+    loop_wake();
   }
 };
 
 static void init_ble() {
+  nvs_read_pair_central();
   BLEDevice::init("Middle");
   BLEDevice::setPower(ESP_PWR_LVL_P9, ESP_BLE_PWR_TYPE_ADV);
   BLEDevice::setPower(ESP_PWR_LVL_P9, ESP_BLE_PWR_TYPE_DEFAULT);
@@ -937,7 +2872,14 @@ static void init_ble() {
       BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_WRITE);
   pairing_characteristic->setCallbacks(new pairing_callbacks());
 
-  update_file_count();
+  stats_characteristic = service->createCharacteristic(
+      characteristic_stats_uuid, BLECharacteristic::PROPERTY_READ);
+  device_stats_publish();
+
+  // The file count is filled in by start_ble_if_needed(); init_ble() may run
+  // while a recording is still updating the index.
+  uint16_t initial_file_count = 0;
+  file_count_characteristic->setValue(initial_file_count);
   uint32_t file_size = 0;
   file_info_characteristic->setValue(file_size);
 
@@ -949,13 +2891,63 @@ static void init_ble() {
 
 static bool ble_initialized = false;
 
+// Brings the BLE host stack and GATT table up on core 0 while core 1 records,
+// so advertising can start as soon as the file is finalized instead of
+// paying for init_ble() after the button is released. Nothing is transmitted
+// until advertising starts, so the radio stays quiet during capture. Runs
+// below the flash writer's priority so it only takes CPU the writer leaves.
+static SemaphoreHandle_t ble_bring_up_done = nullptr;
+
+static void ble_bring_up_task(void *) {
+  // init_ble() reads the pairing token, so NVS must be up first.
+  nvs_flash_init();
+  init_ble();
+  xSemaphoreGive(ble_bring_up_done);
+  vTaskDelete(nullptr);
+}
+
+static void ble_bring_up_start() {
+  if (ble_initialized || ble_bring_up_done != nullptr) {
+    return;
+  }
+  ble_bring_up_done = xSemaphoreCreateBinary();
+  if (ble_bring_up_done == nullptr) {
+    return;
+  }
+  if (xTaskCreatePinnedToCore(ble_bring_up_task, "ble_up", 6144, nullptr,
+                              tskIDLE_PRIORITY, nullptr, 0) != pdPASS) {
+    DBG("[ble] bring-up task creation failed\r\n");
+    vSemaphoreDelete(ble_bring_up_done);
+    ble_bring_up_done = nullptr;
+  }
+}
+
+// Waits for a bring-up started by ble_bring_up_start(), or initializes BLE
+// inline if none was started.
+static void ble_ensure_initialized() {
+  if (ble_initialized) {
+    return;
+  }
+  if (ble_bring_up_done != nullptr) {
+    xSemaphoreTake(ble_bring_up_done, portMAX_DELAY);
+    vSemaphoreDelete(ble_bring_up_done);
+    ble_bring_up_done = nullptr;
+  } else {
+    init_ble();
+  }
+  ble_initialized = true;
+}
+
 static void start_ble_if_needed() {
   update_file_count();
+  // Join a bring-up still in flight even with nothing to sync, so the device
+  // never goes to sleep with the host stack half-initialized.
+  if (pending_recording_count > 0 || ble_bring_up_done != nullptr) {
+    ble_ensure_initialized();
+  }
   if (pending_recording_count > 0) {
-    if (!ble_initialized) {
-      init_ble();
-      ble_initialized = true;
-    }
+    // Publish the count now that the characteristic exists.
+    update_file_count();
     uint16_t millivolts = read_battery_millivolts();
     voltage_characteristic->setValue(millivolts);
     DBG("[bat] Battery: %u mV\r\n", millivolts);
@@ -978,10 +2970,6 @@ void setup() {
   pinMode(pin_mic_power, OUTPUT);
   digitalWrite(pin_mic_power, LOW);
 
-  // NVS must be initialized before any NVS reads, including the pairing token
-  // check in init_ble(). nvs_flash_init() is safe to call on every boot.
-  nvs_flash_init();
-
   configure_button_wakeup();
   esp_sleep_wakeup_cause_t wakeup_cause = esp_sleep_get_wakeup_cause();
 
@@ -990,12 +2978,28 @@ void setup() {
     enter_deep_sleep();
   }
 
-  remove_empty_recordings();
+  device_stats_ensure();
+  power_management_init();
+  button_interrupt_init();
 
+  // Record before any other flash work so capture starts as early as
+  // possible; record_and_save() mounts LittleFS in parallel with sampling.
   int button = digitalRead(pin_button);
   if (button == LOW) {
-    record_and_save();
+    // A button wake almost always ends with a recording to sync, so bring BLE
+    // up alongside capture rather than after it.
+    ble_bring_up_start();
+    record_and_save(0);
   }
+
+  // NVS must be initialized before any NVS reads, including the pairing token
+  // check in init_ble(). nvs_flash_init() is safe to call on every boot, and
+  // concurrently with the bring-up task since NVS serializes its callers.
+  nvs_flash_init();
+
+  // Validates the RTC-resident recording index, rebuilding it with a single
+  // directory scan after a cold boot. A no-op if recording already did it.
+  recording_index_ensure();
 }
 
 void loop() {
@@ -1010,24 +3014,100 @@ void loop() {
     start_ble_if_needed();
   }
 
+  static unsigned long last_release_milliseconds = 0;
   int button_state = digitalRead(pin_button);
-  if (button_state != last_button_state) {
+  if (button_state != last_button_state &&
+      (button_state == HIGH ||
+       millis() - last_release_milliseconds >= button_debounce_milliseconds)) {
     last_button_state = button_state;
     if (button_state == LOW) {
-      record_and_save();
+      record_and_save(micros());
+      // record_and_save() returns once the button is released.
+      last_button_state = HIGH;
+      button_state = HIGH;
+      last_release_milliseconds = millis();
       start_ble_if_needed();
+    } else {
+      last_release_milliseconds = millis();
     }
   }
 
-  uint8_t command;
-  while ((command = command_queue_pop()) != 0) {
+  // Drop commands left over from a disconnected client. Done here rather than
+  // in onDisconnect() because only the consumer may move the queue's head.
+  if (!client_connected) {
+    command_queue.clear();
+  }
+
+  if (central_check_pending) {
+    central_check_pending = false;
+    recognize_central();
+  }
+  if (ble_advertising != nullptr) {
+    advertising_end_fast_phase();
+  }
+
+  ble_command command;
+  while (command_queue.pop(command)) {
     if (!connection_authenticated) {
       DBG("[ble] command rejected, not authenticated\r\n");
-    } else if (command == command_request_next) {
-      prepare_current_file();
-    } else if (command == command_start_stream) {
-      stream_prepared_file();
-    } else if (command == command_ack_received) {
+    } else if (command.opcode == command_request_next) {
+      // A transfer ends any live subscription, so a recording made while
+      // the client fetches files doesn't interleave with them.
+      live_subscribed = false;
+      prepare_current_file(0);
+    } else if (command.opcode == command_request_id) {
+      // REQUEST_NEXT for one recording, named by a uint32 LE ID. An ID that
+      // isn't on the pendant reports size 0.
+      live_subscribed = false;
+      uint32_t id = 0;
+      if (command.length >= sizeof(id)) {
+        memcpy(&id, command.payload, sizeof(id));
+      }
+      if (id == 0) {
+        uint32_t empty = 0;
+        file_info_characteristic->setValue(empty);
+      } else {
+        prepare_current_file(id);
+      }
+    } else if (command.opcode == command_encrypt) {
+      uint8_t token[pairing_token_length];
+      if (command.length < transport_nonce_length ||
+          !nvs_read_pair_token(token)) {
+        DBG("[ble] encrypt rejected\r\n");
+      } else if (transport_encryption_begin(token, sizeof(token),
+                                            command.payload)) {
+        DBG("[ble] transport encrypted\r\n");
+      } else {
+        DBG("[ble] session key derivation failed\r\n");
+      }
+      memset(token, 0, sizeof(token));
+    } else if (command.opcode == command_set_schedule) {
+      if (command.length >= 1) {
+        recording_schedule_set(command.payload[0]);
+      }
+    } else if (command.opcode == command_start_stream) {
+      stream_prepared_file(0);
+    } else if (command.opcode == command_start_stream_at) {
+      uint32_t offset = 0;
+      if (command.length >= sizeof(offset)) {
+        memcpy(&offset, command.payload, sizeof(offset));
+      }
+      stream_prepared_file(offset);
+    } else if (command.opcode == command_start_stream_framed) {
+      stream_prepared_ranges(command.payload, command.length);
+    } else if (command.opcode == command_stream_all) {
+      live_subscribed = false;
+      uint32_t resume[2] = {0, 0};
+      if (command.length >= sizeof(resume)) {
+        memcpy(resume, command.payload, sizeof(resume));
+      }
+      stream_all_recordings(resume[0], resume[1]);
+    } else if (command.opcode == command_benchmark) {
+      live_subscribed = false;
+      run_benchmark(command.payload, command.length);
+    } else if (command.opcode == command_ack_ids) {
+      acknowledge_recordings(command.payload, command.length);
+    } else if (command.opcode == command_ack_received) {
 
       // Close any file handle left open by prepare_current_file(). When the
       // client skips START_STREAM (e.g. because the file was 0 bytes),
@@ -1044,60 +3124,44 @@ void loop() {
 
       if (path_to_delete.length() == 0) {
       } else {
-        bool removed = LittleFS.remove(path_to_delete);
+        bool removed = recording_store_remove(path_to_delete);
         DBG("[ble] remove %s: %s\r\n",
             path_to_delete.c_str(), removed ? "OK" : "FAILED");
         if (removed) {
           current_stream_path = "";
+          recording_index_remove(
+              (uint32_t)parse_recording_id(path_to_delete.c_str()));
+        } else {
+          recording_index_rebuild();
         }
       }
       update_file_count();
-    } else if (command == command_sync_done) {
-    } else if (command == command_enter_bootloader) {
+    } else if (command.opcode == command_live_subscribe) {
+      DBG("[ble] live streaming subscribed\r\n");
+      live_subscribed = true;
+    } else if (command.opcode == command_sync_done) {
+      exit_high_throughput_mode();
+    } else if (command.opcode == command_enter_bootloader) {
       // Set the ROM download mode flag before restarting so the bootloader
       // stays in USB/UART download mode rather than booting the application.
       // This allows flashing without physical access to the boot button.
       REG_WRITE(RTC_CNTL_OPTION1_REG, RTC_CNTL_FORCE_DOWNLOAD_BOOT);
       esp_restart();
-    } else if (command == command_erase_pair_token) {
+    } else if (command.opcode == command_erase_pair_token) {
       DBG("[ble] erasing pair token\r\n");
       // Close any open stream handle before erasing — LittleFS.remove() fails
       // on a file that still has an open handle.
-      if (pending_stream_file) {
-        pending_stream_file.close();
-      }
-      current_stream_path = "";
+      stream_prepared_file_release();
       if (!nvs_erase_pair_token()) {
         // Do not delete recordings if the token erase failed — that would leave
         // the pendant in a state where recordings are gone but it is still paired.
         DBG("[ble] aborting erase: token erase failed\r\n");
       } else {
+        paired_central_known = false;
         DBG("[flash] deleting all recordings\r\n");
-        if (ensure_littlefs_ready()) {
-          // Loop until no recordings remain, collecting paths before deleting to
-          // avoid modifying the filesystem while iterating (same pattern as
-          // remove_empty_recordings). One pass may not be enough if there are
-          // more recordings than the buffer can hold.
-          bool found = true;
-          while (found) {
-            found = false;
-            File root = LittleFS.open("/");
-            File entry = root.openNextFile();
-            String to_remove[32];
-            int remove_count = 0;
-            while (entry && remove_count < 32) {
-              String name = String(entry.name());
-              if (parse_recording_id(name) >= 0) {
-                to_remove[remove_count++] = normalize_path(entry.name());
-                found = true;
-              }
-              entry = root.openNextFile();
-            }
-            for (int i = 0; i < remove_count; i++) {
-              bool removed = LittleFS.remove(to_remove[i]);
-              DBG("[flash] remove %s: %s\r\n", to_remove[i].c_str(), removed ? "OK" : "FAILED");
-            }
-          }
+        if (recording_store_ready()) {
+          recording_store_remove_all();
+          recording_index_rebuild();
           update_file_count();
         }
       }
@@ -1112,11 +3176,13 @@ void loop() {
   }
 
   if (sleep_requested ||
-      (!client_connected && command_queue_head == command_queue_tail && button_state == HIGH &&
+      (!client_connected && command_queue.empty() && button_state == HIGH &&
        !ble_window_active())) {
     sleep_requested = false;
     enter_deep_sleep();
   }
 
-  delay(20);
+  // A press ignored as bounce gets another look once the bounce is over.
+  loop_wait(button_state != last_button_state ? button_debounce_milliseconds
+                                              : loop_backstop_milliseconds);
 }
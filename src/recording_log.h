@@ -0,0 +1,455 @@
+// Append-only recording store on a raw flash partition, the alternative to
+// LittleFS (build with -DRECORDING_STORE=1). Standard C++ only: the flash and
+// the saved head/tail pointers come from a backend type, so this builds for
+// any target.
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// The partition is a ring of 4 KB segments, one flash sector each. A
+// recording starts on a segment boundary with a recording_log_record, then two
+// copies of the file's first `held_bytes` (its format header), then the rest
+// of the file, and takes as many whole segments as it needs, wrapping from the
+// end of the partition to the start. Flash bits only go from 1 to 0 without
+// an erase, so everything that changes later starts out erased (all ones):
+//
+// - `length` is programmed when the recording is finalized.
+// - `state` is cleared to mark a recording deleted.
+// - The file's header is held in RAM while recording, so the writer can
+//   rewrite it with the final sample count. The first copy is programmed as
+//   soon as it is complete, the second only if it changed by finalization;
+//   readers use the second when it is programmed.
+//
+// `head` and `tail` count segments from the start of the log's life, so they
+// never wrap; the physical segment is the count modulo the segment count.
+// Recordings in [tail, head) are live unless marked deleted. Only finalizing
+// moves the head forward and only deleting moves the tail, and the backend
+// saves both whenever they change. Every record stores the count it started
+// at, so a stale record from an earlier lap is never mistaken for a live one.
+//
+// Writing keeps one erased segment ahead of the data. After a reset
+// mid-recording, mount() finds the record at the head with no length, takes
+// the first erased segment as its end and finalizes it, so nothing recorded
+// up to the reset is lost.
+//
+// Backend requirements:
+//   uint32_t size() const;  // partition bytes, a multiple of 4 KB
+//   bool read(uint32_t address, void *data, size_t length);
+//   bool write(uint32_t address, const void *data, size_t length);
+//   bool erase_segment(uint32_t address);
+//   void save(uint32_t head, uint32_t tail);
+static const uint32_t recording_log_segment_bytes = 4096;
+static const uint32_t recording_log_magic = 0x474f4c4d; // "MLOG"
+static const uint32_t recording_log_erased = 0xffffffff;
+
+struct recording_log_record {
+  uint32_t magic;
+  uint32_t id;
+  // The head count this record started at.
+  uint32_t segment;
+  uint32_t length;
+  uint32_t state;
+  uint32_t reserved[3];
+};
+
+// A live recording: where it starts, and which header copy to read.
+struct recording_log_entry {
+  uint32_t segment;
+  uint32_t id;
+  uint32_t length;
+  bool final_header;
+};
+
+template <typename Backend, size_t held_bytes> class recording_log {
+public:
+  explicit recording_log(Backend &backend) : backend(backend) {}
+
+  // Takes the saved pointers (both 0 for an empty log) and recovers a record
+  // left at the head by a reset.
+  void mount(uint32_t saved_head, uint32_t saved_tail) {
+    segment_count = backend.size() / recording_log_segment_bytes;
+    head = saved_head;
+    tail = saved_tail;
+    if (head - tail > segment_count) {
+      head = tail = 0;
+    }
+    writing = false;
+    erased_until = head;
+    if (recover()) {
+      backend.save(head, tail);
+    }
+  }
+
+  uint32_t capacity_bytes() const {
+    return segment_count * recording_log_segment_bytes;
+  }
+
+  uint32_t used_bytes() const {
+    return (head - tail) * recording_log_segment_bytes;
+  }
+
+  // Starts a recording at the head. Returns false if the log is full or the
+  // flash fails. Only one recording is written at a time.
+  bool create(uint32_t id) {
+    if (writing || head - tail >= segment_count || !erase_through(head)) {
+      return false;
+    }
+    recording_log_record record;
+    memset(&record, 0xff, sizeof(record));
+    record.magic = recording_log_magic;
+    record.id = id;
+    record.segment = head;
+    if (!program(head, 0, &record, sizeof(record))) {
+      return false;
+    }
+    writing = true;
+    write_length = 0;
+    held_programmed = false;
+    held_changed = false;
+    return true;
+  }
+
+  uint32_t written() const { return write_length; }
+
+  // Appends to the recording being written. Returns the number of bytes
+  // taken; fewer than `length` means the log is full or the flash failed.
+  size_t append(const uint8_t *data, size_t length) {
+    if (!writing) {
+      return 0;
+    }
+    size_t held = 0;
+    while (held < length && write_length < held_bytes) {
+      held_buffer[write_length++] = data[held++];
+    }
+    if (write_length == held_bytes && !held_programmed) {
+      if (!program(head, sizeof(recording_log_record), held_buffer,
+                   held_bytes)) {
+        return 0;
+      }
+      held_programmed = true;
+    }
+    size_t rest = length - held;
+    if (rest == 0) {
+      return length;
+    }
+    uint32_t offset = data_offset(write_length);
+    uint32_t last = head + (offset + rest - 1) / recording_log_segment_bytes;
+    if (!erase_through(last) || !program(head, offset, data + held, rest)) {
+      return held;
+    }
+    write_length += rest;
+    return length;
+  }
+
+  // Replaces part of the file's header, which stays in RAM until finalize().
+  bool rewrite_header(uint32_t offset, const uint8_t *data, size_t length) {
+    if (!writing || offset + length > held_bytes ||
+        offset + length > write_length) {
+      return false;
+    }
+    memcpy(held_buffer + offset, data, length);
+    held_changed = held_programmed;
+    return true;
+  }
+
+  // Ends the recording being written and moves the head past it.
+  bool finalize() {
+    if (!writing) {
+      return false;
+    }
+    writing = false;
+    bool ok = true;
+    if (!held_programmed) {
+      ok = program(head, sizeof(recording_log_record), held_buffer,
+                   write_length);
+    } else if (held_changed) {
+      ok = program(head, sizeof(recording_log_record) + held_bytes,
+                   held_buffer, held_bytes);
+    }
+    ok = program(head, offsetof(recording_log_record, length), &write_length,
+                 sizeof(write_length)) &&
+         ok;
+    head += segments_for(write_length);
+    backend.save(head, tail);
+    return ok;
+  }
+
+  // Finds the live recording `id`.
+  bool find(uint32_t id, recording_log_entry &entry) {
+    uint32_t position = tail;
+    while (next(position, entry)) {
+      if (entry.id == id) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Calls `visit(entry)` for every live recording, oldest first.
+  template <typename Visit> void for_each(Visit visit) {
+    uint32_t position = tail;
+    recording_log_entry entry;
+    while (next(position, entry)) {
+      visit(entry);
+    }
+  }
+
+  // Reads file bytes `offset` onwards. Returns the number read, 0 at the end.
+  size_t read(const recording_log_entry &entry, uint32_t offset,
+              uint8_t *data, size_t length) {
+    if (offset >= entry.length) {
+      return 0;
+    }
+    if (length > entry.length - offset) {
+      length = entry.length - offset;
+    }
+    size_t done = 0;
+    if (offset < held_bytes) {
+      size_t count = held_bytes - offset;
+      if (count > length) {
+        count = length;
+      }
+      uint32_t copy = sizeof(recording_log_record) +
+                      (entry.final_header ? held_bytes : 0);
+      if (!fetch(entry.segment, copy + offset, data, count)) {
+        return 0;
+      }
+      done = count;
+    }
+    if (done < length &&
+        !fetch(entry.segment, data_offset(offset + done), data + done,
+               length - done)) {
+      return done;
+    }
+    return length;
+  }
+
+  // Marks `id` deleted, then moves the tail past deleted recordings. The
+  // newest recording's segments are reused straight away.
+  bool remove(uint32_t id) {
+    recording_log_entry entry;
+    if (!find(id, entry)) {
+      return false;
+    }
+    uint32_t deleted = 0;
+    if (!program(entry.segment, offsetof(recording_log_record, state),
+                 &deleted, sizeof(deleted))) {
+      return false;
+    }
+    if (entry.segment + segments_for(entry.length) == head) {
+      head = entry.segment;
+      erased_until = head;
+    }
+    recording_log_record record;
+    while (tail != head) {
+      if (!fetch_record(tail, record) ||
+          record.length == recording_log_erased) {
+        tail++;
+      } else if (record.state == recording_log_erased) {
+        break;
+      } else {
+        tail += segments_for(record.length);
+      }
+    }
+    backend.save(head, tail);
+    return true;
+  }
+
+  // Marks every live recording deleted and empties the log.
+  void remove_all() {
+    uint32_t deleted = 0;
+    for_each([&](const recording_log_entry &entry) {
+      program(entry.segment, offsetof(recording_log_record, state), &deleted,
+              sizeof(deleted));
+    });
+    tail = head;
+    backend.save(head, tail);
+  }
+
+private:
+  // Flash offset of file byte `offset` (at least held_bytes) from the start
+  // of its record.
+  static uint32_t data_offset(uint32_t offset) {
+    return sizeof(recording_log_record) + 2 * held_bytes + offset - held_bytes;
+  }
+
+  static uint32_t segments_for(uint32_t length) {
+    uint32_t bytes = length > held_bytes ? data_offset(length)
+                                         : data_offset(held_bytes);
+    return (bytes + recording_log_segment_bytes - 1) /
+           recording_log_segment_bytes;
+  }
+
+  uint32_t address(uint32_t segment, uint32_t offset) const {
+    uint32_t size = segment_count * recording_log_segment_bytes;
+    return ((segment % segment_count) * recording_log_segment_bytes + offset) %
+           size;
+  }
+
+  // Reads or programs `length` bytes at `offset` into the record starting at
+  // `segment`, splitting where the ring wraps.
+  template <typename Operation>
+  bool split(uint32_t segment, uint32_t offset, size_t length,
+             Operation operation) {
+    uint32_t size = segment_count * recording_log_segment_bytes;
+    size_t done = 0;
+    while (done < length) {
+      uint32_t start = address(segment, offset + done);
+      size_t count = length - done;
+      if (count > size - start) {
+        count = size - start;
+      }
+      if (!operation(start, done, count)) {
+        return false;
+      }
+      done += count;
+    }
+    return true;
+  }
+
+  bool program(uint32_t segment, uint32_t offset, const void *data,
+               size_t length) {
+    const uint8_t *bytes = (const uint8_t *)data;
+    return split(segment, offset, length,
+                 [&](uint32_t start, size_t done, size_t count) {
+                   return backend.write(start, bytes + done, count);
+                 });
+  }
+
+  bool fetch(uint32_t segment, uint32_t offset, void *data, size_t length) {
+    uint8_t *bytes = (uint8_t *)data;
+    return split(segment, offset, length,
+                 [&](uint32_t start, size_t done, size_t count) {
+                   return backend.read(start, bytes + done, count);
+                 });
+  }
+
+  bool fetch_record(uint32_t segment, recording_log_record &record) {
+    return fetch(segment, 0, &record, sizeof(record)) &&
+           record.magic == recording_log_magic && record.segment == segment;
+  }
+
+  // Erases every segment up to and including `last`, plus the one after it
+  // when that isn't the tail's. Fails if `last` would overwrite the tail.
+  bool erase_through(uint32_t last) {
+    uint32_t limit = tail + segment_count;
+    if (last >= limit) {
+      return false;
+    }
+    uint32_t target = (last + 2 < limit) ? last + 2 : limit;
+    while (erased_until < target) {
+      if (!backend.erase_segment(address(erased_until, 0))) {
+        return false;
+      }
+      erased_until++;
+    }
+    return true;
+  }
+
+  // Advances `position` to the next live recording at or after it.
+  bool next(uint32_t &position, recording_log_entry &entry) {
+    recording_log_record record;
+    while (position < head) {
+      if (!fetch_record(position, record) ||
+          record.length == recording_log_erased) {
+        position++;
+        continue;
+      }
+      uint32_t start = position;
+      position += segments_for(record.length);
+      if (record.state != recording_log_erased) {
+        continue;
+      }
+      uint32_t first_word_of_final_header = 0;
+      fetch(start, sizeof(recording_log_record) + held_bytes,
+            &first_word_of_final_header, sizeof(first_word_of_final_header));
+      entry.segment = start;
+      entry.id = record.id;
+      entry.length = record.length;
+      entry.final_header = first_word_of_final_header != recording_log_erased;
+      return true;
+    }
+    return false;
+  }
+
+  bool segment_erased(uint32_t segment) {
+    // Every 512-byte ADPCM block starts with a step index byte under 0x80,
+    // so any 1 KB of recorded data holds a byte that isn't all ones.
+    uint32_t window[128];
+    for (uint32_t offset = 0; offset < 1024; offset += sizeof(window)) {
+      if (!fetch(segment, offset, window, sizeof(window))) {
+        return false;
+      }
+      for (uint32_t word : window) {
+        if (word != recording_log_erased) {
+          return false;
+        }
+      }
+    }
+    return true;
+  }
+
+  // Finalizes records at the head that a reset left unsaved: with a length
+  // but no saved head, or with no length at all.
+  bool recover() {
+    bool moved = false;
+    recording_log_record record;
+    while (head - tail < segment_count && fetch_record(head, record) &&
+           record.state == recording_log_erased) {
+      uint32_t length = record.length;
+      if (length == recording_log_erased) {
+        length = recover_length();
+        program(head, offsetof(recording_log_record, length), &length,
+                sizeof(length));
+      }
+      head += segments_for(length);
+      erased_until = head;
+      moved = true;
+    }
+    return moved;
+  }
+
+  // Length of the unfinished record at the head: its data runs up to the
+  // first erased segment, and within the last segment up to the last byte
+  // that isn't erased.
+  uint32_t recover_length() {
+    uint32_t last = head;
+    while (last + 1 < tail + segment_count && !segment_erased(last + 1)) {
+      last++;
+    }
+    uint32_t end = (last - head + 1) * recording_log_segment_bytes;
+    uint8_t chunk[64];
+    uint32_t floor = data_offset(held_bytes);
+    while (end > floor) {
+      uint32_t count = (end - floor < sizeof(chunk)) ? end - floor
+                                                     : sizeof(chunk);
+      if (!fetch(head, end - count, chunk, count)) {
+        break;
+      }
+      size_t kept = count;
+      while (kept > 0 && chunk[kept - 1] == 0xff) {
+        kept--;
+      }
+      if (kept > 0) {
+        end = end - count + kept;
+        break;
+      }
+      end -= count;
+    }
+    return end > floor ? held_bytes + end - floor : held_bytes;
+  }
+
+  Backend &backend;
+  uint32_t segment_count = 0;
+  uint32_t head = 0;
+  uint32_t tail = 0;
+  // Segments before this count are known to be erased.
+  uint32_t erased_until = 0;
+  bool writing = false;
+  uint32_t write_length = 0;
+  bool held_programmed = false;
+  bool held_changed = false;
+  uint8_t held_buffer[held_bytes];
+};
@@ -0,0 +1,29 @@
+// Recording filenames on LittleFS: "rec_<id>.ima", or ".raw" for the legacy
+// format. Plain C strings so this builds for any target.
+#pragma once
+
+#include <string.h>
+
+// Returns the ID in a recording filename (the leading slash is optional), or
+// -1 if the name isn't a recording.
+inline long parse_recording_id(const char *name) {
+  if (name[0] == '/') {
+    name++;
+  }
+  if (strncmp(name, "rec_", 4) != 0) {
+    return -1;
+  }
+  const char *digits = name + 4;
+  const char *dot = strchr(digits, '.');
+  if (dot == nullptr || (strcmp(dot, ".ima") != 0 && strcmp(dot, ".raw") != 0)) {
+    return -1;
+  }
+  if (dot == digits) {
+    return -1;
+  }
+  long id = 0;
+  for (const char *c = digits; c < dot && *c >= '0' && *c <= '9'; c++) {
+    id = id * 10 + (*c - '0');
+  }
+  return id;
+}
@@ -0,0 +1,136 @@
+// Lock-free ring shared between the sampling loop and the flash writer, and
+// used for the BLE command queue. Standard C++ only.
+#pragma once
+
+#include <atomic>
+#include <stddef.h>
+#include <string.h>
+
+// Lock-free single-producer single-consumer ring. The capacity must be a power
+// of two so indices wrap with a mask instead of a modulo. Head and tail are
+// free-running counters: the producer publishes the tail with a release store
+// after copying data in, and the consumer reads it with an acquire load before
+// reading that data (and vice versa for the head), so the two sides can run on
+// different cores without volatile or explicit barriers. Writes that don't fit
+// are dropped whole and counted rather than partially applied.
+//
+// spsc_ring<T, N> owns its storage; spsc_ring<T> (capacity 0) uses storage
+// handed to attach() at run time, for buffers sized from free memory.
+template <typename T> class spsc_ring_base {
+public:
+  size_t capacity() const { return mask + 1; }
+
+  // Only safe while neither side is running.
+  void reset() {
+    read_index.store(0, std::memory_order_relaxed);
+    write_index.store(0, std::memory_order_relaxed);
+    drop_count.store(0, std::memory_order_relaxed);
+  }
+
+  size_t size() const {
+    return write_index.load(std::memory_order_acquire) -
+           read_index.load(std::memory_order_acquire);
+  }
+
+  bool empty() const { return size() == 0; }
+
+  // Consumer: discards everything currently queued.
+  void clear() {
+    read_index.store(write_index.load(std::memory_order_acquire),
+                     std::memory_order_release);
+  }
+
+  uint32_t dropped() const { return drop_count.load(std::memory_order_relaxed); }
+
+  // Producer: appends all of `data` or none of it.
+  bool push_span(const T *data, size_t count) {
+    size_t tail = write_index.load(std::memory_order_relaxed);
+    size_t head = read_index.load(std::memory_order_acquire);
+    if (count > mask + 1 - (tail - head)) {
+      drop_count.fetch_add(count, std::memory_order_relaxed);
+      return false;
+    }
+    size_t offset = tail & mask;
+    size_t first = mask + 1 - offset;
+    if (first > count) {
+      first = count;
+    }
+    memcpy(&storage[offset], data, first * sizeof(T));
+    memcpy(&storage[0], data + first, (count - first) * sizeof(T));
+    write_index.store(tail + count, std::memory_order_release);
+    return true;
+  }
+
+  bool push(const T &value) { return push_span(&value, 1); }
+
+  // Consumer: returns the longest readable run starting at the head and its
+  // length in `count` (0 when empty). The data stays valid until commit().
+  const T *peek_contiguous(size_t &count) const {
+    size_t head = read_index.load(std::memory_order_relaxed);
+    size_t tail = write_index.load(std::memory_order_acquire);
+    size_t offset = head & mask;
+    count = tail - head;
+    if (count > mask + 1 - offset) {
+      count = mask + 1 - offset;
+    }
+    return &storage[offset];
+  }
+
+  // Consumer: releases `count` elements returned by peek_contiguous().
+  void commit(size_t count) {
+    read_index.store(read_index.load(std::memory_order_relaxed) + count,
+                     std::memory_order_release);
+  }
+
+  bool pop(T &value) {
+    size_t count = 0;
+    const T *data = peek_contiguous(count);
+    if (count == 0) {
+      return false;
+    }
+    value = *data;
+    commit(1);
+    return true;
+  }
+
+protected:
+  spsc_ring_base(T *storage, size_t mask) : storage(storage), mask(mask) {}
+
+  T *storage;
+  size_t mask;
+
+private:
+  std::atomic<size_t> read_index{0};
+  std::atomic<size_t> write_index{0};
+  std::atomic<uint32_t> drop_count{0};
+};
+
+template <typename T, size_t capacity_elements = 0>
+class spsc_ring : public spsc_ring_base<T> {
+  static_assert((capacity_elements & (capacity_elements - 1)) == 0,
+                "spsc_ring capacity must be a power of two");
+
+public:
+  spsc_ring() : spsc_ring_base<T>(buffer, capacity_elements - 1) {}
+  spsc_ring(const spsc_ring &) = delete;
+  spsc_ring &operator=(const spsc_ring &) = delete;
+
+private:
+  T buffer[capacity_elements];
+};
+
+// Holds nothing until attach(); push_span() drops everything before that.
+template <typename T> class spsc_ring<T, 0> : public spsc_ring_base<T> {
+public:
+  spsc_ring() : spsc_ring_base<T>(nullptr, (size_t)-1) {}
+
+  // `capacity` must be a power of two. Only safe while neither side is
+  // running; also resets the ring.
+  void attach(T *storage, size_t capacity) {
+    this->storage = storage;
+    this->mask = capacity - 1;
+    this->reset();
+  }
+
+  bool attached() const { return this->storage != nullptr; }
+};
@@ -0,0 +1,69 @@
+#include "transport_crypto.h"
+
+#include <esp_random.h>
+#include <mbedtls/aes.h>
+#include <mbedtls/md.h>
+
+#include "firmware.h"
+
+static const size_t transport_key_length = 16;
+static const char transport_key_label[] = "middle transport";
+
+uint8_t transport_pendant_nonce[transport_nonce_length];
+static mbedtls_aes_context transport_aes;
+volatile bool transport_encrypted = false;
+
+void transport_session_reset() {
+  transport_encrypted = false;
+  mbedtls_aes_free(&transport_aes);
+  esp_fill_random(transport_pendant_nonce, sizeof(transport_pendant_nonce));
+}
+
+bool transport_encryption_begin(const uint8_t *token, size_t token_length,
+                                const uint8_t *client_nonce) {
+  uint8_t message[sizeof(transport_key_label) - 1 + 2 * transport_nonce_length];
+  memcpy(message, transport_key_label, sizeof(transport_key_label) - 1);
+  memcpy(message + sizeof(transport_key_label) - 1, transport_pendant_nonce,
+         transport_nonce_length);
+  memcpy(message + sizeof(transport_key_label) - 1 + transport_nonce_length,
+         client_nonce, transport_nonce_length);
+  uint8_t digest[32];
+  int rc = mbedtls_md_hmac(mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), token,
+                           token_length, message, sizeof(message), digest);
+  if (rc == 0) {
+    mbedtls_aes_init(&transport_aes);
+    rc = mbedtls_aes_setkey_enc(&transport_aes, digest,
+                                transport_key_length * 8);
+  }
+  memset(digest, 0, sizeof(digest));
+  transport_encrypted = rc == 0;
+  return transport_encrypted;
+}
+
+void transport_crypt(uint32_t id, uint32_t offset, uint8_t *data,
+                     size_t length) {
+  if (!transport_encrypted || length == 0) {
+    return;
+  }
+  uint32_t start = micros();
+  uint8_t counter[16] = {};
+  uint32_t block = offset / 16;
+  for (int i = 0; i < 4; i++) {
+    counter[3 - i] = (uint8_t)(id >> (8 * i));
+    counter[15 - i] = (uint8_t)(block >> (8 * i));
+  }
+  uint8_t stream_block[16];
+  size_t stream_offset = offset % 16;
+  if (stream_offset != 0) {
+    // Start part-way into the block: its keystream is already used up to
+    // `stream_offset`, and the next call continues with the following block.
+    mbedtls_aes_crypt_ecb(&transport_aes, MBEDTLS_AES_ENCRYPT, counter,
+                          stream_block);
+    for (int i = 15; i >= 0 && ++counter[i] == 0; i--) {
+    }
+  }
+  mbedtls_aes_crypt_ctr(&transport_aes, length, &stream_offset, counter,
+                        stream_block, data, data);
+  stats.encrypted_chunks++;
+  stats.encrypt_microseconds += micros() - start;
+}
@@ -0,0 +1,37 @@
+// Transport encryption, opt-in per connection. The pairing characteristic's
+// read value carries a fresh random nonce after the status byte. Once
+// authenticated, a client that wants encryption writes ENCRYPT with a nonce
+// of its own, and both sides derive the session key as the first 16 bytes of
+// HMAC-SHA256(pairing token, "middle transport" || pendant nonce || client
+// nonce). From then on every recording byte sent on the audio characteristic
+// is AES-128-CTR encrypted. The counter block is the big-endian recording
+// ID, four zero bytes and the big-endian file offset / 16, so any byte can be
+// encrypted on its own: ranges, resumes and retransmissions need no state,
+// and a counter only ever covers the same file byte. Framing (sequence
+// numbers, frame headers, window and frame CRCs) stays in the clear, and the
+// CRCs cover the plaintext. CTR gives confidentiality only; the pairing
+// token still decides who may connect.
+//
+// mbedtls runs AES and SHA on the ESP32-S3's crypto engines. Stream data is
+// encrypted in the reader task on core 0 as it is read, so the notify loop
+// never waits on it.
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+static const size_t transport_nonce_length = 16;
+
+extern uint8_t transport_pendant_nonce[transport_nonce_length];
+extern volatile bool transport_encrypted;
+
+// Called on every connection, so a session key is never reused.
+void transport_session_reset();
+
+bool transport_encryption_begin(const uint8_t *token, size_t token_length,
+                                const uint8_t *client_nonce);
+
+// Encrypts `length` bytes of recording `id` found at `offset` in its file,
+// in place. Does nothing unless the session is encrypted.
+void transport_crypt(uint32_t id, uint32_t offset, uint8_t *data,
+                     size_t length);
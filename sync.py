@@ -3,7 +3,9 @@
 # requires-python = ">=3.8"
 # dependencies = [
 #     "bleak",
+#     "cryptography",
 #     "lameenc",
+#     "numpy",
 #     "openai",
 #     "tqdm",
 # ]
@@ -18,19 +20,32 @@ can delete them from flash.
 """
 import argparse
 import asyncio
+import bisect
+import hashlib
+import hmac
 import os
 import secrets
 import struct
 import time
+import wave
+import zlib
 from datetime import datetime
 from pathlib import Path
 
 from bleak import BleakClient, BleakScanner
 from bleak.exc import BleakError
 import lameenc
+import numpy as np
 from openai import AuthenticationError, OpenAI, OpenAIError
 from tqdm import tqdm
 
+# Only transport encryption needs cryptography, so without it sync.py still
+# runs with --no-encryption.
+try:
+    from cryptography.hazmat.primitives.ciphers import Cipher, algorithms, modes
+except ImportError:
+    Cipher = None
+
 SERVICE_UUID = "19b10000-e8f2-537e-4f6c-d104768a1214"
 CHARACTERISTIC_FILE_COUNT_UUID = "19b10001-e8f2-537e-4f6c-d104768a1214"
 CHARACTERISTIC_FILE_INFO_UUID = "19b10002-e8f2-537e-4f6c-d104768a1214"
@@ -38,6 +53,31 @@ CHARACTERISTIC_AUDIO_DATA_UUID = "19b10003-e8f2-537e-4f6c-d104768a1214"
 CHARACTERISTIC_COMMAND_UUID = "19b10004-e8f2-537e-4f6c-d104768a1214"
 CHARACTERISTIC_VOLTAGE_UUID = "19b10005-e8f2-537e-4f6c-d104768a1214"
 CHARACTERISTIC_PAIRING_UUID = "19b10006-e8f2-537e-4f6c-d104768a1214"
+CHARACTERISTIC_STATS_UUID = "19b10007-e8f2-537e-4f6c-d104768a1214"
+
+# Fields of the Stats characteristic, each a uint32 LE, in firmware order.
+# Newer firmware may append fields; older firmware lacks the characteristic.
+STATS_FIELDS = [
+    "recordings",
+    "ring_high_water_bytes",
+    "ring_dropped_bytes",
+    "flash_max_stall_microseconds",
+    "i2s_read_errors",
+    "notify_retries",
+    "notify_failures",
+    "stream_bytes_per_second",
+    "wake_to_first_sample_microseconds",
+    "wake_to_first_kept_sample_microseconds",
+    "capture_buffer_bytes",
+    "idle_milliseconds",
+    "recording_milliseconds",
+    "streaming_milliseconds",
+    "streamed_bytes",
+    "live_recordings",
+    "live_abandoned",
+    "encrypted_chunks",
+    "encrypt_microseconds",
+]
 
 COMMAND_REQUEST_NEXT = bytes([0x01])
 COMMAND_ACK_RECEIVED = bytes([0x02])
@@ -45,18 +85,138 @@ COMMAND_SYNC_DONE = bytes([0x03])
 COMMAND_START_STREAM = bytes([0x04])
 COMMAND_ENTER_BOOTLOADER = bytes([0x05])
 COMMAND_ERASE_PAIRING = bytes([0x06])
+COMMAND_STREAM_ALL = bytes([0x07])
+COMMAND_ACK_IDS = 0x08
+COMMAND_START_STREAM_FRAMED = 0x0A
+COMMAND_LIVE_SUBSCRIBE = bytes([0x0B])
+COMMAND_SET_SCHEDULE = 0x0C
+COMMAND_REQUEST_ID = 0x0D
+COMMAND_ENCRYPT = 0x0E
+COMMAND_BENCHMARK = 0x0F
+
+# SET_SCHEDULE takes one policy byte: the order REQUEST_NEXT and STREAM_ALL
+# hand out recordings in. The pendant keeps it until it loses power.
+# "weighted" is smallest first, with older recordings gradually promoted.
+# REQUEST_ID is REQUEST_NEXT for one uint32 LE recording ID; an ID that isn't
+# on the pendant reports size 0 and must not be acknowledged.
+SCHEDULE_POLICIES = {"oldest": 0, "newest": 1, "smallest": 2, "weighted": 3}
+
+# Transport encryption. Firmware that has it appends a per-connection nonce to
+# the pairing status byte. After authenticating, ENCRYPT carries the client's
+# nonce, and the session key is the first 16 bytes of HMAC-SHA256(token,
+# TRANSPORT_KEY_LABEL + pendant nonce + client nonce). Recording bytes are
+# then AES-128-CTR encrypted with a counter block of the big-endian recording
+# ID, four zero bytes and the big-endian file offset / 16. Framing and CRCs
+# stay in the clear, and the CRCs cover the plaintext.
+TRANSPORT_NONCE_SIZE = 16
+TRANSPORT_KEY_SIZE = 16
+TRANSPORT_KEY_LABEL = b"middle transport"
+
+# STREAM_ALL sends each pending recording as a frame: uint32 LE recording ID,
+# uint32 LE size, the file bytes, then a uint32 LE CRC-32 of those bytes. A
+# header with ID 0 and size 0 ends the batch. STREAM_ALL optionally takes a
+# uint32 LE recording ID and offset to resume from; that recording's frame
+# then carries only the bytes from the offset on. ACK_IDS takes up to
+# BULK_ACK_MAX_IDS uint32 LE IDs per write.
+BULK_FRAME_HEADER_SIZE = 8
+BULK_FRAME_TRAILER_SIZE = 4
+BULK_ACK_MAX_IDS = 16
+
+# START_STREAM_FRAMED takes up to FRAMED_RANGES_PER_COMMAND pairs of uint32
+# LE offset and length (0 = to the end), streamed in order. Each
+# notification starts with a uint32 LE sequence number counted in bytes,
+# i.e. the file offset of its data. Packets with sequence
+# FRAMED_WINDOW_SEQUENCE close a window: uint32 LE offset, length and CRC-32
+# of the window's bytes. Gaps and failed windows are requested again as
+# ranges; gaps closer than FRAMED_COALESCE_BYTES are merged, and a round
+# sends few enough commands for the pendant's queue to hold them.
+FRAMED_PACKET_HEADER_SIZE = 4
+FRAMED_WINDOW_SEQUENCE = 0xFFFFFFFF
+FRAMED_WINDOW_PACKET_SIZE = 16
+FRAMED_WINDOW_MAX_BYTES = 4096
+FRAMED_RANGES_PER_COMMAND = 8
+FRAMED_COMMANDS_PER_ROUND = 4
+FRAMED_COALESCE_BYTES = 256
+FRAMED_MAX_RETRANSMIT_ROUNDS = 10
+
+# After LIVE_SUBSCRIBE, each recording made while connected also arrives as it
+# is captured: packets that start with a uint32 LE file offset, from just past
+# the header, then one end packet: LIVE_END_SEQUENCE, uint32 LE recording ID,
+# file size and CRC-32 of the bytes after the header, then the header itself.
+# When that is longer than a notification, the rest of the header follows in
+# the next notifications as bare bytes.
+# LIVE_ABORT_SEQUENCE instead means the live copy was given up on; the flash
+# copy, if there is one, syncs as usual.
+LIVE_END_SEQUENCE = 0xFFFFFFFF
+LIVE_ABORT_SEQUENCE = 0xFFFFFFFE
+LIVE_END_PACKET_SIZE = 16
+
+# BENCHMARK takes a kind byte and a uint32 LE byte count (0 for the
+# firmware's default). The link kind streams that many bytes of random data
+# the way a recording is streamed, each packet starting with a uint32 LE
+# sequence number counted in bytes and the uint32 LE microsecond time the
+# pendant sent it. The flash kind only reads the stored recordings. Both end
+# with a packet of BENCHMARK_RESULT_SEQUENCE and BENCHMARK_RESULT_FIELDS,
+# each a uint32 LE. Below an MTU of 47 the result continues in the next
+# notifications as bare bytes.
+BENCHMARK_KIND_LINK = 0
+BENCHMARK_KIND_FLASH = 1
+BENCHMARK_DEFAULT_BYTES = 256 * 1024
+BENCHMARK_PACKET_HEADER_SIZE = 8
+BENCHMARK_RESULT_SEQUENCE = 0xFFFFFFFF
+BENCHMARK_RESULT_FIELDS = (
+    "kind",
+    "bytes",
+    "packets",
+    "microseconds",
+    "longest_microseconds",
+    "retries",
+    "failures",
+    "interval",
+    "mtu",
+    "phy",
+)
+BLE_PHY_NAMES = {1: "1M", 2: "2M", 3: "Coded"}
 
 SAMPLE_RATE = 16000
 NUMBER_OF_CHANNELS = 1
-# File header is a 4-byte little-endian uint32 sample count.
-IMA_HEADER_SIZE = 4
+# Version 1 files start with a bare little-endian uint32 sample count and hold
+# one continuous nibble stream. Version 2 files start with IMA_V2_MAGIC, a
+# version byte, a codec byte, uint16 samples per block and uint32 sample
+# count, followed by blocks that each carry their own decoder state. Version 3
+# adds silence blocks: a block whose reserved byte is IMA_BLOCK_SILENCE holds a
+# uint32 count of zero samples instead of audio. Version 4 is version 3 with
+# a uint32 sample rate after the header, for firmware built with a rate other
+# than SAMPLE_RATE.
+IMA_V1_HEADER_SIZE = 4
+IMA_V2_MAGIC = b"MDLA"
+IMA_V2_HEADER_SIZE = 12
+IMA_V4_HEADER_SIZE = 16
+IMA_BLOCK_HEADER_SIZE = 4
+IMA_BLOCK_SILENCE = 0x01
+IMA_DEFAULT_SAMPLES_PER_BLOCK = 1016
+# Codec IDs from the version 2 header. IMA ADPCM is the only one so far.
+CODEC_IMA_ADPCM = 0
+ADPCM_STEP_TABLE = [
+    7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37,
+    41, 45, 50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143, 157, 173,
+    190, 209, 230, 253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658,
+    724, 796, 876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066,
+    2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871, 5358, 5894, 6484,
+    7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899, 15289, 16818, 18500,
+    20350, 22385, 24623, 27086, 29794, 32767,
+]
+ADPCM_INDEX_TABLE = [-1, -1, -1, -1, 2, 4, 6, 8, -1, -1, -1, -1, 2, 4, 6, 8]
 MP3_BIT_RATE_KILOBITS_PER_SECOND = 64
 TRANSCRIPTION_MODEL = "gpt-4o-transcribe"
 OPENAI_API_KEY_ENV_NAME = "OPENAI_API_KEY"
 
 RECORDINGS_DIRECTORY = Path(__file__).parent / "recordings"
+# Bytes of interrupted transfers, keyed by recording ID, so the next attempt
+# (even after a reconnect) resumes instead of starting over.
+PARTIAL_DIRECTORY = RECORDINGS_DIRECTORY / ".partial"
 
-# How often to scan for the pendant.
+# Longest single scan for the pendant before starting another.
 SCAN_INTERVAL_SECONDS = 5
 MAX_FILE_TRANSFER_ATTEMPTS = 3
 TRANSFER_STALL_TIMEOUT_SECONDS = 2.0
@@ -67,82 +227,186 @@ def log(message: str) -> None:
     print(f"[{timestamp}] {message}")
 
 
-ADPCM_STEP_TABLE = [
-    7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37,
-    41, 45, 50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143, 157, 173,
-    190, 209, 230, 253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658,
-    724, 796, 876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066,
-    2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871, 5358, 5894, 6484,
-    7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899, 15289, 16818, 18500,
-    20350, 22385, 24623, 27086, 29794, 32767,
-]
-
-ADPCM_INDEX_TABLE = [-1, -1, -1, -1, 2, 4, 6, 8, -1, -1, -1, -1, 2, 4, 6, 8]
-
-
-def decode_ima_adpcm(data: bytes, sample_count: int) -> bytes:
-    """Decode IMA ADPCM packed nibbles to signed 16-bit little-endian PCM.
-
-    Each byte contains two nibbles (low nibble first). The decoder mirrors
-    the encoder in the firmware exactly.
-    """
+# Every (step index, nibble) pair mapped to its signed delta and the row of
+# the next step index, so each sample is one table lookup instead of the step
+# arithmetic. Row r of the tables is step index r // 16.
+_transitions = []
+for _step_index, _step in enumerate(ADPCM_STEP_TABLE):
+    for _nibble in range(16):
+        _delta = _step >> 3
+        if _nibble & 4:
+            _delta += _step
+        if _nibble & 2:
+            _delta += _step >> 1
+        if _nibble & 1:
+            _delta += _step >> 2
+        _transitions.append((
+            -_delta if _nibble & 8 else _delta,
+            max(0, min(88, _step_index + ADPCM_INDEX_TABLE[_nibble])) * 16,
+        ))
+ADPCM_DELTAS = np.array([delta for delta, _ in _transitions], dtype=np.int32)
+ADPCM_NEXT_ROWS = np.array([row for _, row in _transitions], dtype=np.int32)
+
+
+def unpack_nibbles(packed: np.ndarray) -> np.ndarray:
+    """Split packed ADPCM bytes along their last axis into nibbles, low
+    nibble first."""
+    nibbles = np.empty(packed.shape[:-1] + (packed.shape[-1] * 2,), np.int32)
+    nibbles[..., 0::2] = packed & 0x0F
+    nibbles[..., 1::2] = packed >> 4
+    return nibbles
+
+
+def decode_ima_blocks(
+    nibbles: np.ndarray, predicted_samples: np.ndarray, rows: np.ndarray
+) -> np.ndarray:
+    """Decode one row of nibbles per block to int16 samples, starting each
+    block from its own predicted sample and step index row. Each sample
+    depends on the one before it, so this steps through the positions in a
+    block and decodes that position in every block at once."""
+    # Position-major, so each step reads and writes contiguous memory.
+    nibbles = np.ascontiguousarray(nibbles.T)
+    samples = np.empty(nibbles.shape, np.int16)
+    for position in range(nibbles.shape[0]):
+        transitions = rows + nibbles[position]
+        predicted_samples = np.clip(
+            predicted_samples + ADPCM_DELTAS[transitions], -32768, 32767
+        )
+        samples[position] = predicted_samples
+        rows = ADPCM_NEXT_ROWS[transitions]
+    return samples.T
+
+
+def decode_ima_stream(data: bytes, sample_count: int) -> bytes:
+    """Decode a version 1 file's single nibble stream. Nothing in it restarts
+    the decoder, so there are no blocks to decode side by side."""
+    sample_count = min(sample_count, len(data) * 2)
+    nibbles = unpack_nibbles(np.frombuffer(data, np.uint8))[:sample_count]
+    deltas = ADPCM_DELTAS.tolist()
+    next_rows = ADPCM_NEXT_ROWS.tolist()
+    samples = []
     predicted_sample = 0
-    step_index = 0
-    output = bytearray(sample_count * 2)
-    write_position = 0
-
-    for i in range(sample_count):
-        byte_index = i // 2
-        if byte_index >= len(data):
-            break
-
-        if i % 2 == 0:
-            nibble = data[byte_index] & 0x0F
-        else:
-            nibble = (data[byte_index] >> 4) & 0x0F
-
-        step = ADPCM_STEP_TABLE[step_index]
-        delta = step >> 3
-        if nibble & 4:
-            delta += step
-        if nibble & 2:
-            delta += step >> 1
-        if nibble & 1:
-            delta += step >> 2
-
-        if nibble & 8:
-            predicted_sample -= delta
-        else:
-            predicted_sample += delta
-
-        predicted_sample = max(-32768, min(32767, predicted_sample))
+    row = 0
+    for nibble in nibbles.tolist():
+        predicted_sample = max(
+            -32768, min(32767, predicted_sample + deltas[row + nibble])
+        )
+        samples.append(predicted_sample)
+        row = next_rows[row + nibble]
+    return np.array(samples, "<i2").tobytes()
 
-        sample_le = predicted_sample & 0xFFFF
-        output[write_position] = sample_le & 0xFF
-        output[write_position + 1] = (sample_le >> 8) & 0xFF
-        write_position += 2
 
-        step_index += ADPCM_INDEX_TABLE[nibble]
-        step_index = max(0, min(88, step_index))
+def decode_ima_file(ima_data: bytes) -> tuple[bytes, int]:
+    """Decode a version 1, 2, 3 or 4 .ima file to signed 16-bit LE PCM,
+    returning the PCM and its sample rate."""
+    if not ima_data.startswith(IMA_V2_MAGIC):
+        sample_count = struct.unpack("<I", ima_data[:IMA_V1_HEADER_SIZE])[0]
+        pcm = decode_ima_stream(ima_data[IMA_V1_HEADER_SIZE:], sample_count)
+        return pcm, SAMPLE_RATE
 
-    return bytes(output[:write_position])
+    version, codec, samples_per_block, sample_count = struct.unpack(
+        "<BBHI", ima_data[len(IMA_V2_MAGIC):IMA_V2_HEADER_SIZE]
+    )
+    if version not in (2, 3, 4):
+        raise ValueError(f"Unsupported .ima format version {version}.")
+    if codec != CODEC_IMA_ADPCM:
+        raise ValueError(f"Unsupported codec {codec}.")
+    sample_rate = SAMPLE_RATE
+    header_size = IMA_V2_HEADER_SIZE
+    if version == 4:
+        if len(ima_data) < IMA_V4_HEADER_SIZE:
+            raise ValueError("Truncated version 4 .ima header.")
+        (sample_rate,) = struct.unpack_from("<I", ima_data, IMA_V2_HEADER_SIZE)
+        header_size = IMA_V4_HEADER_SIZE
+
+    # Walk the block headers first: each block's sample count depends on the
+    # silence before it, but its samples only on its own state and nibbles.
+    # A damaged block only affects its own samples.
+    packed_size = samples_per_block // 2
+    block_size = IMA_BLOCK_HEADER_SIZE + packed_size
+    # (sample count, index into the audio blocks, or -1 for silence)
+    spans: list[tuple[int, int]] = []
+    packed = bytearray()
+    predicted_samples: list[int] = []
+    step_indexes: list[int] = []
+    remaining = sample_count
+    for offset in range(header_size, len(ima_data), block_size):
+        if remaining <= 0:
+            break
+        block = ima_data[offset:offset + block_size]
+        if len(block) <= IMA_BLOCK_HEADER_SIZE:
+            break
+        predicted_sample, step_index, flags = struct.unpack("<hBB", block[:4])
+        if version != 2 and flags & IMA_BLOCK_SILENCE:
+            if len(block) < IMA_BLOCK_HEADER_SIZE + 4:
+                break
+            silent_samples = min(struct.unpack("<I", block[4:8])[0], remaining)
+            spans.append((silent_samples, -1))
+            remaining -= silent_samples
+            continue
+        block_samples = min(samples_per_block, remaining)
+        # A truncated last block is padded out and its missing samples dropped.
+        spans.append((
+            min(block_samples, (len(block) - IMA_BLOCK_HEADER_SIZE) * 2),
+            len(predicted_samples),
+        ))
+        packed += block[IMA_BLOCK_HEADER_SIZE:].ljust(packed_size, b"\0")
+        predicted_samples.append(predicted_sample)
+        step_indexes.append(min(step_index, 88))
+        remaining -= block_samples
+
+    if not predicted_samples:
+        return bytes(2 * sum(count for count, _ in spans)), sample_rate
+    samples = decode_ima_blocks(
+        unpack_nibbles(
+            np.frombuffer(bytes(packed), np.uint8).reshape(-1, packed_size)
+        ),
+        np.array(predicted_samples, np.int32),
+        np.array(step_indexes, np.int32) * 16,
+    ).astype("<i2")
+    return b"".join(
+        samples[audio_block, :count].tobytes()
+        if audio_block >= 0 else bytes(count * 2)
+        for count, audio_block in spans
+    ), sample_rate
+
+
+def estimate_sample_count(file_size: int) -> int:
+    """Approximate sample count of a version 2 file from its byte size."""
+    block_size = IMA_BLOCK_HEADER_SIZE + IMA_DEFAULT_SAMPLES_PER_BLOCK // 2
+    payload_size = max(0, file_size - IMA_V2_HEADER_SIZE)
+    full_blocks, remainder = divmod(payload_size, block_size)
+    return (
+        full_blocks * IMA_DEFAULT_SAMPLES_PER_BLOCK
+        + max(0, remainder - IMA_BLOCK_HEADER_SIZE) * 2
+    )
 
 
 def encode_mp3_from_ima(ima_data: bytes) -> bytes:
-    """Decode an IMA ADPCM file (with 4-byte sample count header) to MP3."""
-    sample_count = struct.unpack("<I", ima_data[:IMA_HEADER_SIZE])[0]
-    adpcm_payload = ima_data[IMA_HEADER_SIZE:]
-    pcm16 = decode_ima_adpcm(adpcm_payload, sample_count)
+    """Decode an .ima file to MP3 at the file's own sample rate."""
+    pcm16, sample_rate = decode_ima_file(ima_data)
 
     encoder = lameenc.Encoder()
     encoder.set_bit_rate(MP3_BIT_RATE_KILOBITS_PER_SECOND)
-    encoder.set_in_sample_rate(SAMPLE_RATE)
+    encoder.set_in_sample_rate(sample_rate)
     encoder.set_channels(NUMBER_OF_CHANNELS)
     encoder.set_quality(2)
 
     return encoder.encode(pcm16) + encoder.flush()
 
 
+def write_wav_from_ima(ima_path: Path) -> Path:
+    """Decode an .ima file to a 16-bit mono WAV beside it."""
+    pcm16, sample_rate = decode_ima_file(ima_path.read_bytes())
+    wav_path = ima_path.with_suffix(".wav")
+    with wave.open(str(wav_path), "wb") as wav_file:
+        wav_file.setnchannels(NUMBER_OF_CHANNELS)
+        wav_file.setsampwidth(2)
+        wav_file.setframerate(sample_rate)
+        wav_file.writeframes(pcm16)
+    return wav_path
+
+
 def create_openai_client() -> OpenAI | None:
     api_key = os.getenv(OPENAI_API_KEY_ENV_NAME)
     if not api_key:
@@ -174,17 +438,769 @@ def transcribe_mp3_file(openai_client: OpenAI, filepath: Path) -> Path:
     return transcript_path
 
 
+def save_recording(audio_data: bytes, index: int) -> Path:
+    """Convert a downloaded IMA ADPCM file to MP3 and save it."""
+    timestamp = datetime.now().strftime("%Y%m%d_%H%M%S")
+    filename = f"recording_{timestamp}_{index}.mp3"
+    filepath = RECORDINGS_DIRECTORY / filename
+
+    mp3_data = encode_mp3_from_ima(audio_data)
+    filepath.write_bytes(mp3_data)
+    log(
+        f"Saved {filepath} (MP3 {len(mp3_data)} bytes from "
+        f"IMA ADPCM {len(audio_data)} bytes)."
+    )
+    return filepath
+
+
+def transcribe_recording(openai_client: OpenAI, filepath: Path) -> bool:
+    """Transcribe a saved recording. Returns False if the remaining
+    transcriptions should be skipped."""
+    log(f"Transcribing {filepath.name} with {TRANSCRIPTION_MODEL}...")
+    try:
+        transcript_path = transcribe_mp3_file(openai_client, filepath)
+        log(f"Saved transcript: {transcript_path}")
+    except AuthenticationError:
+        log("Skipping remaining transcriptions: invalid API key.")
+        return False
+    except OpenAIError as error:
+        log(f"Transcription failed for {filepath.name}: {error}")
+        return False
+    return True
+
+
+def partial_path(recording_id: int) -> Path:
+    return PARTIAL_DIRECTORY / f"rec_{recording_id:06d}.part"
+
+
+def load_partial(recording_id: int) -> bytes:
+    """Return the bytes saved from an interrupted transfer, or b""."""
+    try:
+        return partial_path(recording_id).read_bytes()
+    except FileNotFoundError:
+        return b""
+
+
+def oldest_partial() -> tuple[int, bytes] | None:
+    """Return the lowest-ID partial transfer on disk, if any."""
+    recording_ids = sorted(
+        int(path.stem[len("rec_"):])
+        for path in PARTIAL_DIRECTORY.glob("rec_*.part")
+    )
+    if not recording_ids:
+        return None
+    return recording_ids[0], load_partial(recording_ids[0])
+
+
+def save_partial(recording_id: int, data: bytes) -> None:
+    if not data:
+        return
+    PARTIAL_DIRECTORY.mkdir(parents=True, exist_ok=True)
+    partial_path(recording_id).write_bytes(data)
+    log(f"Saved {len(data)} bytes of recording {recording_id} for resuming.")
+
+
+def discard_partials(recording_id: int | None = None) -> None:
+    """Delete one partial transfer, or all of them if no ID is given."""
+    pattern = "rec_*.part" if recording_id is None else partial_path(recording_id).name
+    for path in PARTIAL_DIRECTORY.glob(pattern):
+        path.unlink(missing_ok=True)
+
+
+class TransportCipher:
+    """Decrypts recording bytes from an encrypted session. CTR is its own
+    inverse, and any byte can be decrypted on its own given its recording
+    ID and file offset."""
+
+    def __init__(
+        self, token: bytes, pendant_nonce: bytes, client_nonce: bytes
+    ) -> None:
+        digest = hmac.new(
+            token,
+            TRANSPORT_KEY_LABEL + pendant_nonce + client_nonce,
+            hashlib.sha256,
+        ).digest()
+        self.key = digest[:TRANSPORT_KEY_SIZE]
+
+    def crypt(self, recording_id: int, offset: int, data: bytes) -> bytes:
+        counter = struct.pack(">I4xQ", recording_id, offset // 16)
+        skip = offset % 16
+        decryptor = Cipher(algorithms.AES(self.key), modes.CTR(counter)).decryptor()
+        return decryptor.update(bytes(skip) + bytes(data))[skip:]
+
+
+def transport_crypt(
+    cipher: TransportCipher | None, recording_id: int, offset: int, data: bytes
+) -> bytes:
+    """Decrypt `data` if the session is encrypted."""
+    if cipher is None:
+        return data
+    return cipher.crypt(recording_id, offset, data)
+
+
+class BulkFrameParser:
+    """Splits the STREAM_ALL byte stream into recordings as it arrives.
+    `resume_prefix` is prepended to the frame for `resume_id`, which only
+    carries the bytes the previous attempt didn't get."""
+
+    def __init__(
+        self,
+        resume_id: int = 0,
+        resume_prefix: bytes = b"",
+        cipher: TransportCipher | None = None,
+    ) -> None:
+        self.resume_id = resume_id
+        self.resume_prefix = resume_prefix
+        self.cipher = cipher
+        self.buffer = bytearray()
+        self.recordings: list[tuple[int, bytes]] = []
+        self.corrupt_ids: list[int] = []
+        self.total_bytes = 0
+        self.finished = False
+
+    def feed(self, data: bytes) -> None:
+        self.buffer += data
+        self.total_bytes += len(data)
+        while not self.finished and len(self.buffer) >= BULK_FRAME_HEADER_SIZE:
+            recording_id, size = struct.unpack_from("<II", self.buffer)
+            if recording_id == 0 and size == 0:
+                self.finished = True
+                return
+            frame_end = BULK_FRAME_HEADER_SIZE + size + BULK_FRAME_TRAILER_SIZE
+            if len(self.buffer) < frame_end:
+                return
+            payload = self.decrypt(
+                recording_id,
+                self.buffer[BULK_FRAME_HEADER_SIZE:BULK_FRAME_HEADER_SIZE + size],
+            )
+            (checksum,) = struct.unpack_from(
+                "<I", self.buffer, BULK_FRAME_HEADER_SIZE + size
+            )
+            if zlib.crc32(payload) == checksum:
+                if recording_id == self.resume_id:
+                    payload = self.resume_prefix + payload
+                self.recordings.append((recording_id, payload))
+            else:
+                self.corrupt_ids.append(recording_id)
+            del self.buffer[:frame_end]
+
+    def interrupted_frame(self) -> tuple[int, bytes] | None:
+        """Return the ID and bytes so far of a frame cut off mid-transfer."""
+        if self.finished or len(self.buffer) < BULK_FRAME_HEADER_SIZE:
+            return None
+        recording_id, size = struct.unpack_from("<II", self.buffer)
+        data = self.decrypt(
+            recording_id,
+            self.buffer[BULK_FRAME_HEADER_SIZE:BULK_FRAME_HEADER_SIZE + size],
+        )
+        if recording_id == self.resume_id:
+            data = self.resume_prefix + data
+        return recording_id, data
+
+    def decrypt(self, recording_id: int, data: bytes) -> bytes:
+        """A resumed frame starts at the resume offset in its file."""
+        offset = len(self.resume_prefix) if recording_id == self.resume_id else 0
+        return transport_crypt(self.cipher, recording_id, offset, bytes(data))
+
+
+class FramedReceiver:
+    """Reassembles a START_STREAM_FRAMED transfer. Bytes only count as
+    received once a window CRC covering them matches. A window that arrives
+    with gaps is kept, so only the gaps need sending again."""
+
+    def __init__(
+        self,
+        size: int,
+        prefix: bytes = b"",
+        cipher: TransportCipher | None = None,
+        recording_id: int = 0,
+    ) -> None:
+        self.cipher = cipher
+        self.recording_id = recording_id
+        self.data = bytearray(size)
+        self.data[:len(prefix)] = prefix
+        # 1 where bytes arrived but no matching window CRC has covered them.
+        self.arrived = bytearray(size)
+        self.verified = bytearray(size)
+        self.verified[:len(prefix)] = b"\x01" * len(prefix)
+        self.verified_bytes = len(prefix)
+        # (offset, length, crc) of windows still waiting for gaps, by offset.
+        self.windows: list[tuple[int, int, int]] = []
+        # End of the latest window packet, to tell when a request is done.
+        self.last_window_end = -1
+
+    def feed(self, packet: bytes) -> None:
+        if len(packet) < FRAMED_PACKET_HEADER_SIZE:
+            return
+        (sequence,) = struct.unpack_from("<I", packet)
+        if sequence == FRAMED_WINDOW_SEQUENCE:
+            if len(packet) < FRAMED_WINDOW_PACKET_SIZE:
+                return
+            window = struct.unpack_from("<III", packet, 4)
+            self.last_window_end = window[0] + window[1]
+            if window[0] + window[1] <= len(self.data):
+                bisect.insort(self.windows, window)
+                self.check_windows(window[0], window[0] + window[1])
+            return
+        payload = packet[FRAMED_PACKET_HEADER_SIZE:]
+        end = sequence + len(payload)
+        # Never overwrite checked bytes with a retransmitted copy.
+        if end > len(self.data) or self.verified.find(0, sequence, end) < 0:
+            return
+        self.data[sequence:end] = transport_crypt(
+            self.cipher, self.recording_id, sequence, payload
+        )
+        self.arrived[sequence:end] = b"\x01" * len(payload)
+        self.check_windows(sequence, end)
+
+    def check_windows(self, start: int, end: int) -> None:
+        """Settle every stored window overlapping [start, end) that has no
+        gaps left: verify it, or forget its bytes if the CRC fails."""
+        first = bisect.bisect_left(self.windows, (start - FRAMED_WINDOW_MAX_BYTES,))
+        last = bisect.bisect_left(self.windows, (end,))
+        for window in self.windows[first:last]:
+            offset, length, checksum = window
+            window_end = offset + length
+            if window_end <= start:
+                continue
+            unchecked = self.verified.find(0, offset, window_end)
+            if unchecked >= 0 and self.arrived.find(0, unchecked, window_end) >= 0:
+                continue
+            self.windows.remove(window)
+            if unchecked < 0:
+                continue
+            if zlib.crc32(self.data[offset:window_end]) == checksum:
+                self.verified_bytes += self.verified.count(0, offset, window_end)
+                self.verified[offset:window_end] = b"\x01" * length
+            else:
+                self.arrived[offset:window_end] = bytes(length)
+
+    def complete(self) -> bool:
+        return self.verified_bytes == len(self.data)
+
+    def verified_prefix(self) -> int:
+        """Length of the leading run of checked bytes."""
+        end = self.verified.find(0)
+        return len(self.data) if end < 0 else end
+
+    def missing_ranges(self, limit: int) -> list[tuple[int, int]]:
+        """Return up to `limit` (offset, length) runs that need sending
+        again: the gaps inside stored windows, and every other unchecked
+        byte."""
+        ranges: list[tuple[int, int]] = []
+
+        def add(start: int, end: int) -> None:
+            if start >= end:
+                return
+            if ranges and start - (ranges[-1][0] + ranges[-1][1]) < FRAMED_COALESCE_BYTES:
+                ranges[-1] = (ranges[-1][0], end - ranges[-1][0])
+            else:
+                ranges.append((start, end - start))
+
+        position = self.verified.find(0)
+        while position >= 0 and len(ranges) <= limit:
+            run_end = self.verified.find(1, position)
+            if run_end < 0:
+                run_end = len(self.data)
+            for offset, length, _ in self.windows:
+                window_end = min(offset + length, run_end)
+                if window_end <= position or offset >= run_end:
+                    continue
+                if offset > position:
+                    add(position, offset)
+                    position = offset
+                gap = self.arrived.find(0, position, window_end)
+                while gap >= 0:
+                    gap_end = self.arrived.find(1, gap, window_end)
+                    if gap_end < 0:
+                        gap_end = window_end
+                    add(gap, gap_end)
+                    gap = self.arrived.find(0, gap_end, window_end)
+                position = window_end
+            add(position, run_end)
+            position = self.verified.find(0, run_end)
+        return ranges[:limit]
+
+
+class LiveReceiver:
+    """Reassembles recordings streamed live while they are being made. A
+    recording only counts once its end packet arrives with nothing missing
+    and a matching CRC."""
+
+    def __init__(self, cipher: TransportCipher | None = None) -> None:
+        self.cipher = cipher
+        self.reset()
+
+    def reset(self) -> None:
+        self.payload = bytearray()
+        self.broken = False
+        # Offset of the first payload byte, which is the file's header size.
+        self.header_size: int | None = None
+        # An end packet split across notifications, until the header is in.
+        self.end: bytearray | None = None
+
+    def feed(self, packet: bytes) -> tuple[int, bytes | None] | None:
+        """Return (recording ID, file bytes) when a recording ends, with None
+        for the bytes if it arrived damaged, and (0, None) if the pendant
+        abandoned it."""
+        if self.end is not None:
+            self.end += packet
+            return self.finish()
+        if len(packet) < FRAMED_PACKET_HEADER_SIZE:
+            return None
+        (sequence,) = struct.unpack_from("<I", packet)
+        if sequence == LIVE_ABORT_SEQUENCE:
+            self.reset()
+            return 0, None
+        if sequence == LIVE_END_SEQUENCE:
+            if self.header_size is None and (
+                len(packet) < LIVE_END_PACKET_SIZE + IMA_V2_HEADER_SIZE
+            ):
+                self.reset()
+                return 0, None
+            if self.header_size is None:
+                self.header_size = len(packet) - LIVE_END_PACKET_SIZE
+            self.end = bytearray(packet)
+            return self.finish()
+        # A recording's first packet also recovers from a lost end packet.
+        if sequence in (IMA_V2_HEADER_SIZE, IMA_V4_HEADER_SIZE):
+            self.reset()
+            self.header_size = sequence
+        if (
+            self.header_size is None
+            or sequence != self.header_size + len(self.payload)
+        ):
+            self.broken = True
+            return None
+        self.payload += packet[FRAMED_PACKET_HEADER_SIZE:]
+        return None
+
+    def finish(self) -> tuple[int, bytes | None] | None:
+        """Complete the recording once the end packet holds the whole
+        header."""
+        assert self.end is not None and self.header_size is not None
+        packet = self.end
+        if len(packet) < LIVE_END_PACKET_SIZE + self.header_size:
+            return None
+        if len(packet) != LIVE_END_PACKET_SIZE + self.header_size:
+            self.reset()
+            return 0, None
+        recording_id, size, checksum = struct.unpack_from("<III", packet, 4)
+        # The ID only arrives now, so the whole recording is decrypted here:
+        # the header from offset 0, the payload after it.
+        header = transport_crypt(
+            self.cipher, recording_id, 0, bytes(packet[LIVE_END_PACKET_SIZE:])
+        )
+        payload = transport_crypt(
+            self.cipher, recording_id, len(header), bytes(self.payload)
+        )
+        intact = (
+            not self.broken
+            and len(header) + len(payload) == size
+            and zlib.crc32(payload) == checksum
+        )
+        data = header + payload if intact else None
+        self.reset()
+        return recording_id, data
+
+
+class BenchmarkReceiver:
+    """Collects a BENCHMARK run: each packet's size, the pendant's send time
+    and the time it arrived here, then the pendant's own result."""
+
+    def __init__(self) -> None:
+        self.packets: list[tuple[int, int, int, float]] = []
+        self.result: dict[str, int] | None = None
+        # The result packet so far, while it arrives split.
+        self.result_bytes: bytearray | None = None
+
+    def feed(self, packet: bytes, arrived: float) -> None:
+        if self.result_bytes is not None:
+            self.result_bytes += packet
+            self.finish_result()
+            return
+        if len(packet) < BENCHMARK_PACKET_HEADER_SIZE:
+            return
+        sequence, sent = struct.unpack_from("<II", packet)
+        if sequence == BENCHMARK_RESULT_SEQUENCE:
+            self.result_bytes = bytearray(packet)
+            self.finish_result()
+            return
+        self.packets.append((sequence, len(packet), sent, arrived))
+
+    def finish_result(self) -> None:
+        assert self.result_bytes is not None
+        if len(self.result_bytes) >= 4 + 4 * len(BENCHMARK_RESULT_FIELDS):
+            values = struct.unpack_from(
+                f"<{len(BENCHMARK_RESULT_FIELDS)}I", self.result_bytes, 4
+            )
+            self.result = dict(zip(BENCHMARK_RESULT_FIELDS, values))
+            self.result_bytes = None
+
+    def latencies(self) -> list[float]:
+        """Microseconds from send to arrival, less the fastest packet's, as
+        the two clocks share no epoch. Includes the host's BLE stack."""
+        if not self.packets:
+            return []
+        _, _, first_sent, first_arrived = self.packets[0]
+        delays = [
+            (arrived - first_arrived) * 1_000_000
+            - ((sent - first_sent) & 0xFFFFFFFF)
+            for _, _, sent, arrived in self.packets
+        ]
+        fastest = min(delays)
+        return [delay - fastest for delay in delays]
+
+
+def percentile(values: list[float], percent: float) -> float:
+    ordered = sorted(values)
+    index = round(percent / 100 * (len(ordered) - 1))
+    return ordered[min(len(ordered) - 1, index)]
+
+
+def log_benchmark(receiver: BenchmarkReceiver) -> None:
+    result = receiver.result
+    assert result is not None
+    phy = "/".join(
+        BLE_PHY_NAMES.get(value, str(value))
+        for value in (result["phy"] & 0xFF, result["phy"] >> 8)
+    )
+    link = (
+        f"{phy} PHY, {result['interval'] * 1.25:.2f} ms interval, "
+        f"MTU {result['mtu']}"
+    )
+    seconds = result["microseconds"] / 1_000_000
+    if result["kind"] == BENCHMARK_KIND_FLASH:
+        if result["packets"] == 0:
+            log("Flash benchmark: no recordings on the pendant to read.")
+            return
+        log(
+            f"Flash benchmark: {result['bytes']} bytes in {result['packets']} "
+            f"reads, {result['bytes'] / seconds / 1024:.1f} KB/s, "
+            f"{result['microseconds'] / result['packets']:.0f} us per read "
+            f"on average, slowest {result['longest_microseconds']} us."
+        )
+        return
+    if not receiver.packets or seconds <= 0:
+        log(f"Link benchmark: no packets arrived ({link}).")
+        return
+    received = sum(size for _, size, _, _ in receiver.packets)
+    arrival_seconds = receiver.packets[-1][3] - receiver.packets[0][3]
+    log(f"Link benchmark over {link}:")
+    log(
+        f"  sent {result['bytes']} bytes in {result['packets']} packets, "
+        f"{result['bytes'] / seconds / 1024:.1f} KB/s at the pendant"
+    )
+    if arrival_seconds > 0:
+        log(
+            f"  received {received} bytes in {len(receiver.packets)} packets, "
+            f"{received / arrival_seconds / 1024:.1f} KB/s here"
+        )
+    if result["interval"] > 0:
+        events = seconds * 1_000_000 / (result["interval"] * 1250)
+        if events > 0:
+            log(f"  {result['packets'] / events:.1f} packets per connection event")
+    log(
+        f"  {result['retries'] / max(result['packets'], 1):.3f} pool waits "
+        f"per packet, {result['failures']} failed notifications, "
+        f"longest gap between sends {result['longest_microseconds']} us"
+    )
+    latencies = receiver.latencies()
+    log(
+        "  latency above the fastest packet: "
+        + ", ".join(
+            f"p{percent} {percentile(latencies, percent) / 1000:.1f} ms"
+            for percent in (50, 90, 99)
+        )
+        + f", max {max(latencies) / 1000:.1f} ms"
+    )
+
+
+async def run_benchmark(
+    client: BleakClient, kind: int, size: int
+) -> BenchmarkReceiver | None:
+    """Run one BENCHMARK and return what arrived, or None if the pendant
+    never finished it, e.g. because its firmware predates the command."""
+    receiver = BenchmarkReceiver()
+    packet_received = asyncio.Event()
+
+    def on_audio_data(_sender: int, data: bytearray) -> None:
+        receiver.feed(bytes(data), time.monotonic())
+        packet_received.set()
+
+    # A flash run sends nothing until it has read everything.
+    timeout = (
+        TRANSFER_STALL_TIMEOUT_SECONDS
+        if kind == BENCHMARK_KIND_LINK
+        else TRANSFER_TOTAL_TIMEOUT_SECONDS
+    )
+    await client.start_notify(CHARACTERISTIC_AUDIO_DATA_UUID, on_audio_data)
+    try:
+        await client.write_gatt_char(
+            CHARACTERISTIC_COMMAND_UUID,
+            bytes([COMMAND_BENCHMARK, kind]) + struct.pack("<I", size),
+        )
+        while receiver.result is None:
+            packet_received.clear()
+            await asyncio.wait_for(packet_received.wait(), timeout=timeout)
+    except TimeoutError:
+        return None
+    finally:
+        await client.stop_notify(CHARACTERISTIC_AUDIO_DATA_UUID)
+    return receiver
+
+
+async def receive_framed(
+    client: BleakClient,
+    receiver: FramedReceiver,
+    chunk_received: asyncio.Event,
+    transfer_start: float,
+) -> None:
+    """Stream the prepared file in framed mode, then request whatever is
+    missing or corrupt until the receiver is complete. A round ends when the
+    window closing its last range arrives, or on a stall. Raises
+    TimeoutError if it can't finish."""
+    ranges = [(receiver.verified_prefix(), 0)]
+    for round_number in range(FRAMED_MAX_RETRANSMIT_ROUNDS + 1):
+        if round_number > 0:
+            ranges = receiver.missing_ranges(
+                FRAMED_RANGES_PER_COMMAND * FRAMED_COMMANDS_PER_ROUND
+            )
+            log(
+                f"Re-requesting {len(ranges)} range(s), "
+                f"{sum(length for _, length in ranges)} bytes."
+            )
+        last_offset, last_length = ranges[-1]
+        round_end = len(receiver.data) if last_length == 0 else last_offset + last_length
+        receiver.last_window_end = -1
+        for start in range(0, len(ranges), FRAMED_RANGES_PER_COMMAND):
+            batch = ranges[start:start + FRAMED_RANGES_PER_COMMAND]
+            await client.write_gatt_char(
+                CHARACTERISTIC_COMMAND_UUID,
+                bytes([COMMAND_START_STREAM_FRAMED])
+                + b"".join(struct.pack("<II", *pair) for pair in batch),
+            )
+        try:
+            while not receiver.complete() and receiver.last_window_end != round_end:
+                elapsed = time.monotonic() - transfer_start
+                remaining_total = TRANSFER_TOTAL_TIMEOUT_SECONDS - elapsed
+                if remaining_total <= 0:
+                    raise TimeoutError("Transfer exceeded total timeout.")
+                chunk_received.clear()
+                await asyncio.wait_for(
+                    chunk_received.wait(),
+                    timeout=min(TRANSFER_STALL_TIMEOUT_SECONDS, remaining_total),
+                )
+        except TimeoutError:
+            if time.monotonic() - transfer_start >= TRANSFER_TOTAL_TIMEOUT_SECONDS:
+                raise
+        if receiver.complete():
+            return
+    raise TimeoutError("Retransmission rounds exhausted.")
+
+
+async def stream_all_recordings(
+    client: BleakClient, file_count: int, cipher: TransportCipher | None = None
+) -> BulkFrameParser | None:
+    """Fetch every pending recording with a single STREAM_ALL command.
+    Returns None if the pendant sends nothing, i.e. its firmware predates
+    the command."""
+    partial = oldest_partial()
+    command = COMMAND_STREAM_ALL
+    if partial is not None:
+        resume_id, resume_prefix = partial
+        log(f"Resuming recording {resume_id} at byte {len(resume_prefix)}.")
+        command += struct.pack("<II", resume_id, len(resume_prefix))
+        parser = BulkFrameParser(resume_id, resume_prefix, cipher)
+    else:
+        parser = BulkFrameParser(cipher=cipher)
+    chunk_received = asyncio.Event()
+    progress = tqdm(
+        total=file_count, desc="Recordings", unit="file", leave=False
+    )
+
+    def on_audio_data(_sender: int, data: bytearray) -> None:
+        parser.feed(data)
+        completed = len(parser.recordings) + len(parser.corrupt_ids)
+        if completed > progress.n:
+            progress.update(completed - progress.n)
+        chunk_received.set()
+
+    await client.start_notify(CHARACTERISTIC_AUDIO_DATA_UUID, on_audio_data)
+    transfer_start = time.monotonic()
+    try:
+        log("Sending STREAM_ALL command.")
+        await client.write_gatt_char(CHARACTERISTIC_COMMAND_UUID, command)
+        total_timeout = TRANSFER_TOTAL_TIMEOUT_SECONDS * file_count
+        while not parser.finished:
+            remaining_total = total_timeout - (time.monotonic() - transfer_start)
+            if remaining_total <= 0:
+                raise TimeoutError("Transfer exceeded total timeout.")
+            chunk_received.clear()
+            await asyncio.wait_for(
+                chunk_received.wait(),
+                timeout=min(TRANSFER_STALL_TIMEOUT_SECONDS, remaining_total),
+            )
+    except TimeoutError as error:
+        if parser.total_bytes == 0:
+            return None
+        log(f"Bulk transfer stalled at {parser.total_bytes} bytes ({error}).")
+        interrupted = parser.interrupted_frame()
+        if interrupted is not None:
+            save_partial(*interrupted)
+    finally:
+        await client.stop_notify(CHARACTERISTIC_AUDIO_DATA_UUID)
+        progress.close()
+
+    elapsed = time.monotonic() - transfer_start
+    speed = parser.total_bytes / elapsed / 1024 if elapsed > 0 else 0
+    log(
+        f"Bulk transfer: {len(parser.recordings)} recording(s), "
+        f"{parser.total_bytes} bytes in {elapsed:.2f}s ({speed:.1f} KB/s)."
+    )
+    if parser.corrupt_ids:
+        log(
+            f"Checksum mismatch for recording(s) {parser.corrupt_ids}, "
+            "leaving them on the pendant."
+        )
+    # A finished batch held every pending recording, so any partial left is
+    # either assembled now or stale (e.g. the pendant couldn't resume it).
+    if parser.finished:
+        discard_partials()
+    return parser
+
+
+async def sync_recordings_bulk(
+    client: BleakClient,
+    openai_client: OpenAI | None,
+    file_count: int,
+    cipher: TransportCipher | None = None,
+) -> tuple[int, list[Path]] | None:
+    """Download everything with STREAM_ALL, save it, then ACK the saved
+    recordings in batches. Returns None if the pendant doesn't support
+    STREAM_ALL."""
+    parser = await stream_all_recordings(client, file_count, cipher)
+    if parser is None:
+        log("STREAM_ALL unsupported, falling back to per-file transfers.")
+        return None
+
+    saved_recordings: list[Path] = []
+    acknowledged_ids: list[int] = []
+    for index, (recording_id, audio_data) in enumerate(parser.recordings):
+        # Empty files are corrupt or aborted recordings; ACK them so the
+        # pendant deletes them, without saving anything.
+        if audio_data:
+            saved_recordings.append(save_recording(audio_data, index))
+        acknowledged_ids.append(recording_id)
+
+    synced = 0
+    for start in range(0, len(acknowledged_ids), BULK_ACK_MAX_IDS):
+        batch = acknowledged_ids[start:start + BULK_ACK_MAX_IDS]
+        log(f"Sending ACK_IDS for {len(batch)} recording(s).")
+        try:
+            await client.write_gatt_char(
+                CHARACTERISTIC_COMMAND_UUID,
+                bytes([COMMAND_ACK_IDS]) + struct.pack(f"<{len(batch)}I", *batch),
+            )
+        except Exception as error:
+            log(f"ACK_IDS write failed ({error}).")
+            break
+        synced += len(batch)
+
+    if openai_client is not None:
+        for filepath in saved_recordings:
+            if not transcribe_recording(openai_client, filepath):
+                break
+
+    return synced, saved_recordings
+
+
+async def receive_live(
+    client: BleakClient,
+    openai_client: OpenAI | None,
+    currents: tuple[float, float, float] | None = None,
+    cipher: TransportCipher | None = None,
+) -> None:
+    """Stay connected and take each recording live as it is made, until the
+    pendant disconnects. A recording that arrives intact is saved, ACKed and
+    transcribed right away; anything else is fetched from flash."""
+    receiver = LiveReceiver(cipher)
+    finished: asyncio.Queue = asyncio.Queue()
+    index = 0
+
+    def on_audio_data(_sender: int, data: bytearray) -> None:
+        result = receiver.feed(bytes(data))
+        if result is not None:
+            finished.put_nowait(result)
+
+    async def subscribe() -> None:
+        await client.start_notify(CHARACTERISTIC_AUDIO_DATA_UUID, on_audio_data)
+        log("Sending LIVE_SUBSCRIBE command, waiting for recordings.")
+        await client.write_gatt_char(
+            CHARACTERISTIC_COMMAND_UUID, COMMAND_LIVE_SUBSCRIBE
+        )
+
+    await subscribe()
+    try:
+        while client.is_connected:
+            try:
+                recording_id, audio_data = await asyncio.wait_for(
+                    finished.get(), timeout=1.0
+                )
+            except TimeoutError:
+                continue
+            if audio_data is None:
+                # Fetching ends the subscription on the pendant, so nothing
+                # arrives live in the middle of the transfer.
+                log("Live stream incomplete, fetching the recording from flash.")
+                await client.stop_notify(CHARACTERISTIC_AUDIO_DATA_UUID)
+                await sync_recordings(
+                    client, openai_client, currents, cipher=cipher
+                )
+                receiver.reset()
+                await subscribe()
+                continue
+            log(f"Received recording {recording_id} live ({len(audio_data)} bytes).")
+            RECORDINGS_DIRECTORY.mkdir(parents=True, exist_ok=True)
+            filepath = save_recording(audio_data, index)
+            index += 1
+            await client.write_gatt_char(
+                CHARACTERISTIC_COMMAND_UUID,
+                bytes([COMMAND_ACK_IDS]) + struct.pack("<I", recording_id),
+            )
+            await send_sync_done(client)
+            if openai_client is not None:
+                transcribe_recording(openai_client, filepath)
+    finally:
+        if client.is_connected:
+            await client.stop_notify(CHARACTERISTIC_AUDIO_DATA_UUID)
+
+
+async def send_sync_done(client: BleakClient) -> None:
+    log("Sending SYNC_DONE command.")
+    try:
+        await client.write_gatt_char(
+            CHARACTERISTIC_COMMAND_UUID, COMMAND_SYNC_DONE
+        )
+    except Exception as error:
+        log(f"SYNC_DONE write failed ({error}).")
+
+
 async def perform_pairing_handshake(
     client: BleakClient,
     token_hex: str | None,
-) -> bool:
-    """Perform the pairing handshake before any file operations.
-
-    Returns True if pairing succeeded, False if it failed (e.g. pendant is
-    claimed but no token was provided).
+    encrypt: bool = True,
+) -> tuple[bool, TransportCipher | None]:
+    """Perform the pairing handshake before any file operations, then turn
+    on transport encryption if `encrypt` is set and the firmware has it.
+
+    Returns whether pairing succeeded (it fails e.g. when the pendant is
+    claimed but no token was provided) and the session's cipher, or None if
+    the transfer stays in the clear.
     """
     raw_status = await client.read_gatt_char(CHARACTERISTIC_PAIRING_UUID)
     status = raw_status[0]
+    pendant_nonce = bytes(raw_status[1:1 + TRANSPORT_NONCE_SIZE])
 
     if status == 0x00:
         # Pendant is unclaimed: claim it now.
@@ -198,23 +1214,94 @@ async def perform_pairing_handshake(
         # Pendant is already claimed: authenticate with the provided token.
         if token_hex is None:
             log("Pendant is claimed. Provide --token <hex> to authenticate.")
-            return False
+            return False, None
         token = bytes.fromhex(token_hex)
         await client.write_gatt_char(CHARACTERISTIC_PAIRING_UUID, token)
         log("Token verified.")
     else:
         log(f"Unexpected pairing status byte: {status:#04x}")
-        return False
-
-    return True
+        return False, None
+
+    if not encrypt:
+        return True, None
+    if len(pendant_nonce) != TRANSPORT_NONCE_SIZE:
+        log("Transport encryption unavailable (older firmware).")
+        return True, None
+    client_nonce = secrets.token_bytes(TRANSPORT_NONCE_SIZE)
+    await client.write_gatt_char(
+        CHARACTERISTIC_COMMAND_UUID, bytes([COMMAND_ENCRYPT]) + client_nonce
+    )
+    log("Transport encryption on.")
+    return True, TransportCipher(token, pendant_nonce, client_nonce)
+
+
+def log_energy(stats: dict[str, int], currents: tuple[float, float, float]) -> None:
+    """Estimate energy use from the time spent in each power profile and the
+    bench-measured current (mA) of the idle, recording and streaming
+    profiles. Idle time is charged to syncing, since that is what keeps the
+    pendant awake between recordings."""
+    idle_current, recording_current, streaming_current = currents
+    milliamp_hours_per_millisecond = 1 / 3_600_000
+    recording_milliamp_hours = (
+        recording_current
+        * stats["recording_milliseconds"]
+        * milliamp_hours_per_millisecond
+    )
+    sync_milliamp_hours = (
+        idle_current * stats["idle_milliseconds"]
+        + streaming_current * stats["streaming_milliseconds"]
+    ) * milliamp_hours_per_millisecond
+    recorded_minutes = stats["recording_milliseconds"] / 60_000
+    synced_megabytes = stats["streamed_bytes"] / 1_000_000
+    summary = (
+        f"Energy since cold boot: {recording_milliamp_hours:.2f} mAh recording "
+        f"({recorded_minutes:.1f} min), {sync_milliamp_hours:.2f} mAh awake "
+        f"for sync ({synced_megabytes:.2f} MB)"
+    )
+    if recorded_minutes > 0:
+        total = recording_milliamp_hours + sync_milliamp_hours
+        summary += f", {total / recorded_minutes:.3f} mAh per recorded minute"
+    if synced_megabytes > 0:
+        summary += f", {sync_milliamp_hours / synced_megabytes:.3f} mAh per synced MB"
+    log(summary + ".")
+
+
+async def log_device_stats(
+    client: BleakClient, currents: tuple[float, float, float] | None = None
+) -> None:
+    """Print the pendant's performance counters, if it has them."""
+    try:
+        raw = await client.read_gatt_char(CHARACTERISTIC_STATS_UUID)
+    except BleakError:
+        log("Device stats unavailable (older firmware).")
+        return
+    values = struct.unpack(f"<{len(raw) // 4}I", raw[: len(raw) // 4 * 4])
+    log(
+        "Device stats: "
+        + ", ".join(
+            f"{name}={value}" for name, value in zip(STATS_FIELDS, values)
+        )
+    )
+    stats = dict(zip(STATS_FIELDS, values))
+    if currents is not None and "streamed_bytes" in stats:
+        log_energy(stats, currents)
+    if stats.get("encrypted_chunks"):
+        microseconds = stats["encrypt_microseconds"] / stats["encrypted_chunks"]
+        log(
+            f"Transport encryption: {stats['encrypted_chunks']} chunk(s), "
+            f"{microseconds:.1f} us per chunk."
+        )
 
 
 async def sync_recordings(
     client: BleakClient,
     openai_client: OpenAI | None,
+    currents: tuple[float, float, float] | None = None,
+    recording_ids: list[int] | None = None,
+    cipher: TransportCipher | None = None,
 ) -> tuple[int, list[Path]]:
-    """Download all pending recordings from the pendant. Returns the number
-    of files synced."""
+    """Download all pending recordings from the pendant, or only
+    `recording_ids` if given. Returns the number of files synced."""
     try:
         raw_voltage = await client.read_gatt_char(CHARACTERISTIC_VOLTAGE_UUID)
         millivolts = struct.unpack("<H", raw_voltage)[0]
@@ -222,24 +1309,50 @@ async def sync_recordings(
     except BleakError:
         log("Voltage info unavailable (older firmware).")
 
+    await log_device_stats(client, currents)
+
     raw = await client.read_gatt_char(CHARACTERISTIC_FILE_COUNT_UUID)
     file_count = struct.unpack("<H", raw)[0]
     log(f"Pendant reports {file_count} pending recording(s).")
 
+    if recording_ids:
+        file_count = len(recording_ids)
     if file_count == 0:
         return 0, []
 
     RECORDINGS_DIRECTORY.mkdir(parents=True, exist_ok=True)
+
     synced = 0
     saved_recordings: list[Path] = []
 
+    bulk_result = None
+    if not recording_ids:
+        bulk_result = await sync_recordings_bulk(
+            client, openai_client, file_count, cipher
+        )
+    if bulk_result is not None:
+        synced, saved_recordings = bulk_result
+        # Whatever the batch couldn't deliver intact is still on the pendant.
+        # Fetch it one file at a time, where framed mode repairs just the
+        # damaged ranges. Give the pendant a moment to process the ACKs.
+        await asyncio.sleep(0.1)
+        raw = await client.read_gatt_char(CHARACTERISTIC_FILE_COUNT_UUID)
+        file_count = struct.unpack("<H", raw)[0]
+        if file_count == 0:
+            await send_sync_done(client)
+            return bulk_result
+        log(f"{file_count} recording(s) left after the batch.")
+
     skip_transcription = False
+    # Keep filenames distinct from any saved by the batch in the same second.
+    first_index = len(saved_recordings)
 
     for i in range(file_count):
         log(f"Requesting file {i + 1}/{file_count}...")
 
         audio_data = b""
         expected_size = 0
+        recording_id = None
         chunk_count = 0
         transfer_elapsed = 0.0
 
@@ -253,6 +1366,7 @@ async def sync_recordings(
             received_chunks: list[bytearray] = []
             chunk_received = asyncio.Event()
             expected_size = 0
+            framed: FramedReceiver | None = None
             chunk_count = 0
             received_total_bytes = 0
             transfer_progress = None
@@ -260,11 +1374,16 @@ async def sync_recordings(
             def on_audio_data(_sender: int, data: bytearray) -> None:
                 nonlocal chunk_count
                 nonlocal received_total_bytes
-                received_chunks.append(data)
                 chunk_count += 1
-                received_total_bytes += len(data)
+                if framed is not None:
+                    framed.feed(data)
+                    received_bytes = framed.verified_bytes
+                else:
+                    received_chunks.append(data)
+                    received_total_bytes += len(data)
+                    received_bytes = received_total_bytes
                 if transfer_progress is not None and expected_size > 0:
-                    target_bytes = min(received_total_bytes, expected_size)
+                    target_bytes = min(received_bytes, expected_size)
                     delta = target_bytes - transfer_progress.n
                     if delta > 0:
                         transfer_progress.update(delta)
@@ -276,16 +1395,29 @@ async def sync_recordings(
 
             transfer_start = time.monotonic()
             try:
-                log("Sending REQUEST_NEXT command.")
-                await client.write_gatt_char(
-                    CHARACTERISTIC_COMMAND_UUID, COMMAND_REQUEST_NEXT
-                )
+                if recording_ids:
+                    log(f"Sending REQUEST_ID for recording {recording_ids[i]}.")
+                    await client.write_gatt_char(
+                        CHARACTERISTIC_COMMAND_UUID,
+                        bytes([COMMAND_REQUEST_ID])
+                        + struct.pack("<I", recording_ids[i]),
+                    )
+                else:
+                    log("Sending REQUEST_NEXT command.")
+                    await client.write_gatt_char(
+                        CHARACTERISTIC_COMMAND_UUID, COMMAND_REQUEST_NEXT
+                    )
 
                 # The pendant sets file info after receiving REQUEST_NEXT,
                 # before streaming. Give it a moment to update the value.
                 await asyncio.sleep(0.1)
                 raw = await client.read_gatt_char(CHARACTERISTIC_FILE_INFO_UUID)
-                expected_size = struct.unpack("<I", raw)[0]
+                expected_size = struct.unpack_from("<I", raw)[0]
+                # Older firmware reports only the size. Without the ID there
+                # is no way to match a partial download, and no framed mode,
+                # so the file is streamed plainly from the start.
+                if len(raw) >= 8:
+                    recording_id = struct.unpack_from("<I", raw, 4)[0]
 
                 # Empty files are corrupt or aborted recordings. Skip them
                 # immediately rather than retrying.
@@ -293,10 +1425,10 @@ async def sync_recordings(
                     log(f"File {i + 1}/{file_count} is empty, skipping.")
                     break
 
-                # The file contains a 4-byte header plus ADPCM nibbles, so
-                # we can't directly divide by sample rate for duration.
-                # We'll compute it after decoding. Show raw size for now.
-                adpcm_sample_count = (expected_size - IMA_HEADER_SIZE) * 2
+                # The file contains a header plus ADPCM blocks, so we can't
+                # directly divide by sample rate for duration. Estimate it
+                # from the block layout for now.
+                adpcm_sample_count = estimate_sample_count(expected_size)
                 duration_seconds = adpcm_sample_count / SAMPLE_RATE
                 log(
                     f"File size: {expected_size} bytes "
@@ -309,44 +1441,81 @@ async def sync_recordings(
                     unit_scale=True,
                     leave=False,
                 )
-                if received_total_bytes > 0:
-                    transfer_progress.update(min(received_total_bytes, expected_size))
-
-                log("Sending START_STREAM command.")
-                await client.write_gatt_char(
-                    CHARACTERISTIC_COMMAND_UUID, COMMAND_START_STREAM
-                )
+                if recording_id is not None:
+                    resume_prefix = load_partial(recording_id)
+                    if len(resume_prefix) >= expected_size:
+                        resume_prefix = b""
+                    framed = FramedReceiver(
+                        expected_size, resume_prefix, cipher, recording_id
+                    )
+                    transfer_progress.update(framed.verified_bytes)
+                    log(
+                        f"Sending START_STREAM_FRAMED from byte "
+                        f"{framed.verified_prefix()}."
+                    )
+                    await receive_framed(
+                        client, framed, chunk_received, transfer_start
+                    )
+                else:
+                    if received_total_bytes > 0:
+                        transfer_progress.update(
+                            min(received_total_bytes, expected_size)
+                        )
 
-                while received_total_bytes < expected_size:
-                    elapsed = time.monotonic() - transfer_start
-                    remaining_total = TRANSFER_TOTAL_TIMEOUT_SECONDS - elapsed
-                    if remaining_total <= 0:
-                        raise TimeoutError("Transfer exceeded total timeout.")
-
-                    chunk_received.clear()
-                    await asyncio.wait_for(
-                        chunk_received.wait(),
-                        timeout=min(
-                            TRANSFER_STALL_TIMEOUT_SECONDS,
-                            remaining_total,
-                        ),
+                    log("Sending START_STREAM command.")
+                    await client.write_gatt_char(
+                        CHARACTERISTIC_COMMAND_UUID, COMMAND_START_STREAM
                     )
+
+                    while received_total_bytes < expected_size:
+                        elapsed = time.monotonic() - transfer_start
+                        remaining_total = TRANSFER_TOTAL_TIMEOUT_SECONDS - elapsed
+                        if remaining_total <= 0:
+                            raise TimeoutError("Transfer exceeded total timeout.")
+
+                        chunk_received.clear()
+                        await asyncio.wait_for(
+                            chunk_received.wait(),
+                            timeout=min(
+                                TRANSFER_STALL_TIMEOUT_SECONDS,
+                                remaining_total,
+                            ),
+                        )
             except TimeoutError as error:
+                received_bytes = (
+                    framed.verified_bytes if framed is not None
+                    else received_total_bytes
+                )
                 log(
-                    f"Transfer stalled at {received_total_bytes}/{expected_size} "
+                    f"Transfer stalled at {received_bytes}/{expected_size} "
                     f"bytes ({error})."
                 )
+                if framed is not None:
+                    save_partial(
+                        recording_id, bytes(framed.data[:framed.verified_prefix()])
+                    )
             finally:
                 await client.stop_notify(CHARACTERISTIC_AUDIO_DATA_UUID)
                 if transfer_progress is not None:
                     transfer_progress.close()
 
-            if received_total_bytes >= expected_size and expected_size > 0:
+            if framed is not None and framed.complete():
+                transfer_elapsed = time.monotonic() - transfer_start
+                audio_data = bytes(framed.data)
+                discard_partials(recording_id)
+                break
+            if framed is None and received_total_bytes >= expected_size > 0:
                 transfer_elapsed = time.monotonic() - transfer_start
                 audio_data = b"".join(received_chunks)
                 audio_data = audio_data[:expected_size]
                 break
 
+        # A requested ID that isn't there also reports size 0. ACKing then
+        # would delete whichever recording is next, so leave it.
+        if expected_size == 0 and recording_ids:
+            log(f"Recording {recording_ids[i]} is not on the pendant.")
+            continue
+
         # Handle empty files: ACK to delete from pendant and continue.
         if expected_size == 0:
             await client.write_gatt_char(
@@ -368,16 +1537,7 @@ async def sync_recordings(
             f"({speed:.1f} KB/s)."
         )
 
-        timestamp = datetime.now().strftime("%Y%m%d_%H%M%S")
-        filename = f"recording_{timestamp}_{i}.mp3"
-        filepath = RECORDINGS_DIRECTORY / filename
-
-        mp3_data = encode_mp3_from_ima(audio_data)
-        filepath.write_bytes(mp3_data)
-        log(
-            f"Saved {filepath} (MP3 {len(mp3_data)} bytes from "
-            f"IMA ADPCM {len(audio_data)} bytes)."
-        )
+        filepath = save_recording(audio_data, first_index + i)
         saved_recordings.append(filepath)
 
         log("Sending ACK_RECEIVED command.")
@@ -394,52 +1554,52 @@ async def sync_recordings(
         if openai_client is None or skip_transcription:
             continue
 
-        log(f"Transcribing {filepath.name} with {TRANSCRIPTION_MODEL}...")
-        try:
-            transcript_path = transcribe_mp3_file(openai_client, filepath)
-            log(f"Saved transcript: {transcript_path}")
-        except AuthenticationError:
-            log("Skipping remaining transcriptions: invalid API key.")
-            skip_transcription = True
-        except OpenAIError as error:
-            log(f"Transcription failed for {filepath.name}: {error}")
+        if not transcribe_recording(openai_client, filepath):
             skip_transcription = True
 
-    log("Sending SYNC_DONE command.")
-    try:
-        await client.write_gatt_char(
-            CHARACTERISTIC_COMMAND_UUID, COMMAND_SYNC_DONE
-        )
-    except Exception as error:
-        log(f"SYNC_DONE write failed ({error}).")
+    await send_sync_done(client)
     return synced, saved_recordings
 
 
-async def main(token_hex: str | None = None, bootloader: bool = False, reset: bool = False) -> None:
+async def main(
+    token_hex: str | None = None,
+    bootloader: bool = False,
+    reset: bool = False,
+    currents: tuple[float, float, float] | None = None,
+    live: bool = False,
+    schedule: str | None = None,
+    recording_ids: list[int] | None = None,
+    encrypt: bool = True,
+    benchmark: int | None = None,
+) -> None:
     log("Middle BLE sync client started.")
     log(f"Scanning for pendant (service {SERVICE_UUID})...")
 
     scan_count = 0
     while True:
         scan_count += 1
-        devices = await BleakScanner.discover(
+        # Stop at the first advertisement instead of scanning out the whole
+        # interval: the pendant only stays awake for a few seconds.
+        device = await BleakScanner.find_device_by_filter(
+            lambda _device, _advertisement: True,
             timeout=SCAN_INTERVAL_SECONDS,
             service_uuids=[SERVICE_UUID],
         )
 
-        if not devices:
+        if device is None:
             if scan_count % 10 == 0:
                 log(f"Still scanning... ({scan_count} scans, no pendant found)")
             continue
 
-        device = devices[0]
         log(f"Found pendant: {device.name} ({device.address}).")
         log("Connecting...")
 
         try:
             async with BleakClient(device, timeout=10) as client:
                 log(f"Connected (MTU: {client.mtu_size}).")
-                paired = await perform_pairing_handshake(client, token_hex)
+                paired, cipher = await perform_pairing_handshake(
+                    client, token_hex, encrypt
+                )
                 if not paired:
                     log("Pairing failed, disconnecting.")
                     continue
@@ -451,14 +1611,37 @@ async def main(token_hex: str | None = None, bootloader: bool = False, reset: bo
                     log("Device is entering bootloader mode.")
                     return
 
+                if benchmark is not None:
+                    for kind in (BENCHMARK_KIND_LINK, BENCHMARK_KIND_FLASH):
+                        receiver = await run_benchmark(client, kind, benchmark)
+                        if receiver is None:
+                            log("Benchmark unsupported or stalled.")
+                            break
+                        log_benchmark(receiver)
+                    await send_sync_done(client)
+                    return
+
+                if schedule is not None:
+                    log(f"Setting the transfer schedule to {schedule}.")
+                    await client.write_gatt_char(
+                        CHARACTERISTIC_COMMAND_UUID,
+                        bytes([COMMAND_SET_SCHEDULE, SCHEDULE_POLICIES[schedule]]),
+                    )
+
                 openai_client = create_openai_client()
                 log(f"Recordings will be saved to: {RECORDINGS_DIRECTORY}")
                 synced, saved_recordings = await sync_recordings(
                     client,
                     openai_client,
+                    currents,
+                    recording_ids,
+                    cipher,
                 )
                 log(f"Sync complete, {synced} file(s) transferred.")
 
+                if live:
+                    await receive_live(client, openai_client, currents, cipher)
+
                 if reset:
                     await client.write_gatt_char(
                         CHARACTERISTIC_COMMAND_UUID, COMMAND_ERASE_PAIRING
@@ -498,8 +1681,76 @@ if __name__ == "__main__":
         action="store_true",
         help="Sync recordings, erase pairing, and exit. Requires --token.",
     )
+    parser.add_argument(
+        "--currents",
+        type=str,
+        default=None,
+        metavar="IDLE,RECORDING,STREAMING",
+        help=(
+            "Bench-measured current in mA of each power profile. Prints energy "
+            "per recorded minute and per synced MB from the device stats."
+        ),
+    )
+    parser.add_argument(
+        "--live",
+        action="store_true",
+        help=(
+            "Stay connected after syncing and receive each new recording "
+            "while it is being made."
+        ),
+    )
+    parser.add_argument(
+        "--schedule",
+        choices=list(SCHEDULE_POLICIES),
+        default=None,
+        help=(
+            "Order the pendant sends recordings in, kept until it loses "
+            "power. The default is oldest first."
+        ),
+    )
+    parser.add_argument(
+        "--id",
+        type=int,
+        action="append",
+        dest="recording_ids",
+        metavar="ID",
+        help="Fetch only this recording. Can be given more than once.",
+    )
+    parser.add_argument(
+        "--no-encryption",
+        action="store_true",
+        help="Transfer recordings in the clear, e.g. to measure what encryption costs.",
+    )
+    parser.add_argument(
+        "--decode",
+        type=Path,
+        nargs="+",
+        metavar="IMA",
+        help="Decode .ima files to WAV files beside them instead of syncing.",
+    )
+    parser.add_argument(
+        "--benchmark",
+        type=int,
+        nargs="?",
+        const=BENCHMARK_DEFAULT_BYTES,
+        metavar="BYTES",
+        help=(
+            "Measure the BLE link with BYTES of synthetic data, then the "
+            "pendant's flash read speed, instead of syncing."
+        ),
+    )
     args = parser.parse_args()
 
+    currents = None
+    if args.currents is not None:
+        try:
+            currents = tuple(float(value) for value in args.currents.split(","))
+        except ValueError:
+            currents = ()
+        if len(currents) != 3:
+            print("Error: --currents takes three comma-separated numbers.")
+            raise SystemExit(1)
+
     if args.token is not None:
         if len(args.token) != 32 or not all(
             character in "0123456789abcdefABCDEF" for character in args.token
@@ -511,8 +1762,50 @@ if __name__ == "__main__":
         print("Error: --bootloader and --reset are mutually exclusive.")
         raise SystemExit(1)
 
+    if args.live and (args.bootloader or args.reset):
+        print("Error: --live can't be combined with --bootloader or --reset.")
+        raise SystemExit(1)
+
+    if args.benchmark is not None and (
+        args.live or args.bootloader or args.reset or args.recording_ids
+    ):
+        print(
+            "Error: --benchmark can't be combined with --live, --bootloader, "
+            "--reset or --id."
+        )
+        raise SystemExit(1)
+
     if args.reset and args.token is None:
         print("Error: --reset requires --token.")
         raise SystemExit(1)
 
-    asyncio.run(main(token_hex=args.token, bootloader=args.bootloader, reset=args.reset))
+    if args.decode is not None:
+        for ima_path in args.decode:
+            try:
+                log(f"Wrote {write_wav_from_ima(ima_path)}")
+            except (OSError, ValueError, struct.error) as error:
+                print(f"Error: {ima_path}: {error}")
+                raise SystemExit(1)
+        raise SystemExit(0)
+
+    if Cipher is None and not args.no_encryption:
+        print(
+            "Error: transport encryption needs the cryptography package. Run "
+            "sync.py with uv, which installs it, or `pip install cryptography`; "
+            "--no-encryption transfers in the clear without it."
+        )
+        raise SystemExit(1)
+
+    asyncio.run(
+        main(
+            token_hex=args.token,
+            bootloader=args.bootloader,
+            reset=args.reset,
+            currents=currents,
+            live=args.live,
+            schedule=args.schedule,
+            recording_ids=args.recording_ids,
+            encrypt=not args.no_encryption,
+            benchmark=args.benchmark,
+        )
+    )
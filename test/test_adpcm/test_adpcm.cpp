@@ -0,0 +1,349 @@
+// Encoder and decoder tests for src/adpcm.h: the batch encoder against the
+// scalar one, and encode -> decode round trips for every file format
+// version, checked against a decoder written from the IMA spec below.
+
+#include <math.h>
+#include <unity.h>
+#include <vector>
+
+#include "adpcm.h"
+#include "capture_pipeline.h"
+
+// The IMA ADPCM tables as the spec gives them, kept apart from adpcm.h so a
+// change to either copy fails here.
+static const int32_t spec_step_table[89] = {
+    7,     8,     9,     10,    11,    12,    13,    14,    16,    17,
+    19,    21,    23,    25,    28,    31,    34,    37,    41,    45,
+    50,    55,    60,    66,    73,    80,    88,    97,    107,   118,
+    130,   143,   157,   173,   190,   209,   230,   253,   279,   307,
+    337,   371,   408,   449,   494,   544,   598,   658,   724,   796,
+    876,   963,   1060,  1166,  1282,  1411,  1552,  1707,  1878,  2066,
+    2272,  2499,  2749,  3024,  3327,  3660,  4026,  4428,  4871,  5358,
+    5894,  6484,  7132,  7845,  8630,  9493,  10442, 11487, 12635, 13899,
+    15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767};
+static const int32_t spec_index_table[16] = {-1, -1, -1, -1, 2, 4, 6, 8,
+                                             -1, -1, -1, -1, 2, 4, 6, 8};
+
+static uint32_t read_u32(const uint8_t *data) {
+  return data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t)data[3] << 24);
+}
+
+// Appends up to `count` samples decoded from `data` to `out`.
+static void reference_decode_nibbles(const uint8_t *data, size_t size,
+                                     size_t count, int32_t predicted,
+                                     int32_t index, std::vector<int16_t> &out) {
+  for (size_t i = 0; i < count && i / 2 < size; i++) {
+    int32_t nibble = (i & 1) ? data[i / 2] >> 4 : data[i / 2] & 0x0F;
+    int32_t step = spec_step_table[index];
+    int32_t difference = step >> 3;
+    if (nibble & 4) {
+      difference += step;
+    }
+    if (nibble & 2) {
+      difference += step >> 1;
+    }
+    if (nibble & 1) {
+      difference += step >> 2;
+    }
+    predicted += (nibble & 8) ? -difference : difference;
+    if (predicted > 32767) {
+      predicted = 32767;
+    } else if (predicted < -32768) {
+      predicted = -32768;
+    }
+    out.push_back((int16_t)predicted);
+    index += spec_index_table[nibble];
+    index = index < 0 ? 0 : (index > 88 ? 88 : index);
+  }
+}
+
+// Decodes a whole .ima file of any version the way the format comment in
+// adpcm.h describes it, without using anything from adpcm.h.
+static std::vector<int16_t> reference_decode_file(const std::vector<uint8_t> &file) {
+  std::vector<int16_t> out;
+  if (file.size() < 4 || memcmp(file.data(), "MDLA", 4) != 0) {
+    reference_decode_nibbles(file.data() + 4, file.size() - 4,
+                             read_u32(file.data()), 0, 0, out);
+    return out;
+  }
+  uint8_t version = file[4];
+  size_t block_size = 4 + (file[6] | (file[7] << 8)) / 2;
+  size_t remaining = read_u32(file.data() + 8);
+  for (size_t offset = version == 4 ? 16 : 12;
+       remaining > 0 && offset + 4 < file.size(); offset += block_size) {
+    const uint8_t *block = file.data() + offset;
+    size_t available = file.size() - offset;
+    if (available > block_size) {
+      available = block_size;
+    }
+    if (version >= 3 && (block[3] & 0x01)) {
+      size_t silent = read_u32(block + 4);
+      silent = silent < remaining ? silent : remaining;
+      out.insert(out.end(), silent, 0);
+      remaining -= silent;
+      continue;
+    }
+    size_t count = remaining < block_size * 2 - 8 ? remaining : block_size * 2 - 8;
+    reference_decode_nibbles(block + 4, available - 4, count,
+                             (int16_t)(block[0] | (block[1] << 8)), block[2],
+                             out);
+    remaining -= count;
+  }
+  return out;
+}
+
+// Speech-like test signal: two tones, loud bursts that clip, and noise
+// from a fixed LCG so every run sees the same samples.
+static std::vector<int16_t> test_signal(size_t count) {
+  std::vector<int16_t> samples(count);
+  uint32_t seed = 12345;
+  for (size_t i = 0; i < count; i++) {
+    seed = seed * 1103515245 + 12345;
+    double t = i / 16000.0;
+    double value = 6000 * sin(2 * M_PI * 220 * t) + 2500 * sin(2 * M_PI * 1870 * t) +
+                   (int32_t)((seed >> 16) & 0x3FF) - 512;
+    if (i % 5000 < 300) {
+      value *= 8;
+    }
+    value = value > 32767 ? 32767 : (value < -32768 ? -32768 : value);
+    samples[i] = (int16_t)value;
+  }
+  return samples;
+}
+
+// What a decoder must reproduce: the encoder's own prediction after each
+// sample.
+static std::vector<int16_t> encoder_reconstruction(const std::vector<int16_t> &samples,
+                                                   adpcm_state state = {0, 0}) {
+  std::vector<int16_t> out;
+  for (int16_t sample : samples) {
+    adpcm_encode_sample(sample, state);
+    out.push_back(state.predicted_sample);
+  }
+  return out;
+}
+
+// Block-encodes `samples` into `file` in uneven chunks, as the sampling loop
+// does, and flushes the trailing nibble.
+static void append_blocks(const int16_t *samples, size_t count,
+                          adpcm_block_encoder &encoder,
+                          std::vector<uint8_t> &file) {
+  uint8_t out[adpcm_encoded_bytes_max(333)];
+  for (size_t done = 0; done < count;) {
+    size_t chunk = count - done < 333 ? count - done : 333;
+    size_t written = adpcm_encode_frames<i2s_slot_mono16>(samples + done, chunk,
+                                                          encoder, out);
+    TEST_ASSERT_LESS_OR_EQUAL(adpcm_encoded_bytes_max(chunk), written);
+    file.insert(file.end(), out, out + written);
+    done += chunk;
+  }
+}
+
+static void finish_blocks(adpcm_block_encoder &encoder,
+                          std::vector<uint8_t> &file) {
+  if (encoder.nibble_pending) {
+    file.push_back(encoder.packed_byte);
+    encoder.nibble_pending = false;
+  }
+}
+
+static std::vector<uint8_t> header_bytes(uint32_t sample_count, uint8_t version,
+                                         uint32_t sample_rate = 0) {
+  recording_header_with_rate header = {
+      make_recording_header(sample_count, version), sample_rate};
+  const uint8_t *bytes = (const uint8_t *)&header;
+  return std::vector<uint8_t>(bytes, bytes + recording_header_bytes(version));
+}
+
+static void check_decodes_to(const std::vector<uint8_t> &file,
+                             const std::vector<int16_t> &expected) {
+  long total = recording_sample_count(file.data(), file.size());
+  TEST_ASSERT_EQUAL(expected.size(), total);
+  std::vector<int16_t> decoded(total);
+  TEST_ASSERT_EQUAL(total, recording_decode(file.data(), file.size(),
+                                            decoded.data()));
+  TEST_ASSERT_EQUAL_INT16_ARRAY(expected.data(), decoded.data(), expected.size());
+  std::vector<int16_t> reference = reference_decode_file(file);
+  TEST_ASSERT_EQUAL(expected.size(), reference.size());
+  TEST_ASSERT_EQUAL_INT16_ARRAY(expected.data(), reference.data(),
+                                expected.size());
+}
+
+template <typename slot_format>
+static void check_batch_matches_scalar() {
+  std::vector<int16_t> samples = test_signal(5000);
+  std::vector<typename slot_format::word> frames(samples.size() *
+                                                 slot_format::words_per_frame);
+  for (size_t i = 0; i < samples.size(); i++) {
+    typename slot_format::word word = samples[i];
+    if (sizeof(word) == 4) {
+      // 24-bit data left-justified, with low bits the >> 16 must discard.
+      word = (typename slot_format::word)(((uint32_t)(uint16_t)samples[i] << 16) |
+                                          0xA500);
+    }
+    frames[i * slot_format::words_per_frame] = word;
+    if (slot_format::stereo) {
+      frames[i * 2 + 1] = (typename slot_format::word)0x7FFF0000;
+    }
+  }
+  adpcm_block_encoder batch = {};
+  adpcm_block_encoder scalar = {};
+  uint8_t batch_out[adpcm_encoded_bytes_max(777)];
+  uint8_t scalar_out[adpcm_encoded_bytes_max(777)];
+  for (size_t done = 0; done < samples.size();) {
+    size_t chunk = samples.size() - done < 777 ? samples.size() - done : 777;
+    const typename slot_format::word *in =
+        frames.data() + done * slot_format::words_per_frame;
+    size_t batch_bytes = adpcm_encode_frames<slot_format>(in, chunk, batch, batch_out);
+    size_t scalar_bytes =
+        adpcm_encode_frames_scalar<slot_format>(in, chunk, scalar, scalar_out);
+    TEST_ASSERT_EQUAL(scalar_bytes, batch_bytes);
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(scalar_out, batch_out, batch_bytes);
+    done += chunk;
+  }
+  TEST_ASSERT_EQUAL(scalar.state.predicted_sample, batch.state.predicted_sample);
+  TEST_ASSERT_EQUAL(scalar.state.step_index, batch.state.step_index);
+  TEST_ASSERT_EQUAL(scalar.nibble_pending, batch.nibble_pending);
+}
+
+void setUp() {}
+void tearDown() {}
+
+static void test_batch_matches_scalar_stereo32() {
+  check_batch_matches_scalar<i2s_slot_stereo32>();
+}
+
+static void test_batch_matches_scalar_mono32() {
+  check_batch_matches_scalar<i2s_slot_mono32>();
+}
+
+static void test_batch_matches_scalar_mono16() {
+  check_batch_matches_scalar<i2s_slot_mono16>();
+}
+
+// A pinned vector, so a change that alters the bitstream in both the encoder
+// and the decoders still fails.
+static void test_known_vector() {
+  const int16_t samples[8] = {0, 1000, 3000, -2000, 32767, 32767, -32768, 5};
+  const uint8_t expected[adpcm_block_header_bytes + 4] = {
+      0x00, 0x00, 0x00, 0x00, 0x70, 0xF7, 0x77, 0x1F};
+  adpcm_block_encoder encoder = {};
+  uint8_t out[adpcm_encoded_bytes_max(8)];
+  size_t written = adpcm_encode_frames<i2s_slot_mono16>(samples, 8, encoder, out);
+  TEST_ASSERT_EQUAL(sizeof(expected), written);
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(expected, out, written);
+}
+
+static void test_version1_round_trip() {
+  std::vector<int16_t> samples = test_signal(3001);
+  std::vector<uint8_t> file(recording_v1_header_bytes);
+  uint32_t count = samples.size();
+  memcpy(file.data(), &count, sizeof(count));
+  adpcm_state state = {0, 0};
+  for (size_t i = 0; i < samples.size(); i += 2) {
+    uint8_t byte = adpcm_encode_sample(samples[i], state);
+    if (i + 1 < samples.size()) {
+      byte |= adpcm_encode_sample(samples[i + 1], state) << 4;
+    }
+    file.push_back(byte);
+  }
+  check_decodes_to(file, encoder_reconstruction(samples));
+  TEST_ASSERT_EQUAL(recording_default_sample_rate,
+                    recording_sample_rate(file.data(), file.size()));
+}
+
+static void test_version2_round_trip() {
+  // Three full blocks and an odd-length partial one.
+  std::vector<int16_t> samples = test_signal(3 * adpcm_samples_per_block + 101);
+  std::vector<uint8_t> file = header_bytes(samples.size(), recording_format_version);
+  adpcm_block_encoder encoder = {};
+  append_blocks(samples.data(), samples.size(), encoder, file);
+  finish_blocks(encoder, file);
+  // The odd last sample is padded out to a whole byte.
+  TEST_ASSERT_EQUAL(samples.size() + 1,
+                    adpcm_samples_in_payload(file.size() - sizeof(recording_header)));
+  check_decodes_to(file, encoder_reconstruction(samples));
+}
+
+static void test_version3_silence_round_trip() {
+  std::vector<int16_t> samples = test_signal(4 * adpcm_samples_per_block);
+  size_t before = 2 * adpcm_samples_per_block;
+  const uint32_t silent = 12345;
+  std::vector<uint8_t> file =
+      header_bytes(samples.size() + silent, recording_format_version_gated);
+  adpcm_block_encoder encoder = {};
+  append_blocks(samples.data(), before, encoder, file);
+  uint8_t block[adpcm_block_bytes] = {};
+  block[3] = adpcm_block_silence;
+  memcpy(block + adpcm_block_header_bytes, &silent, sizeof(silent));
+  file.insert(file.end(), block, block + sizeof(block));
+  append_blocks(samples.data() + before, samples.size() - before, encoder, file);
+  finish_blocks(encoder, file);
+
+  std::vector<int16_t> expected = encoder_reconstruction(samples);
+  expected.insert(expected.begin() + before, silent, 0);
+  check_decodes_to(file, expected);
+}
+
+static void test_version4_round_trip() {
+  std::vector<int16_t> samples = test_signal(2 * adpcm_samples_per_block + 7);
+  std::vector<uint8_t> file =
+      header_bytes(samples.size(), recording_format_version_rate, 24000);
+  TEST_ASSERT_EQUAL(sizeof(recording_header_with_rate), file.size());
+  adpcm_block_encoder encoder = {};
+  append_blocks(samples.data(), samples.size(), encoder, file);
+  finish_blocks(encoder, file);
+  check_decodes_to(file, encoder_reconstruction(samples));
+  TEST_ASSERT_EQUAL(24000, recording_sample_rate(file.data(), file.size()));
+}
+
+static void test_truncated_file_decodes_short() {
+  std::vector<int16_t> samples = test_signal(2 * adpcm_samples_per_block);
+  std::vector<uint8_t> file = header_bytes(samples.size(), recording_format_version);
+  adpcm_block_encoder encoder = {};
+  append_blocks(samples.data(), samples.size(), encoder, file);
+  file.resize(sizeof(recording_header) + adpcm_block_bytes + 100);
+  std::vector<int16_t> decoded(samples.size());
+  long written = recording_decode(file.data(), file.size(), decoded.data());
+  TEST_ASSERT_EQUAL(adpcm_samples_per_block + (100 - adpcm_block_header_bytes) * 2,
+                    written);
+  std::vector<int16_t> expected = encoder_reconstruction(samples);
+  TEST_ASSERT_EQUAL_INT16_ARRAY(expected.data(), decoded.data(), (size_t)written);
+}
+
+static void test_rejects_unknown_files() {
+  std::vector<uint8_t> file = header_bytes(10, 9);
+  TEST_ASSERT_EQUAL(-1, recording_sample_count(file.data(), file.size()));
+  file = header_bytes(10, recording_format_version);
+  file[5] = codec_ima_adpcm + 1;
+  TEST_ASSERT_EQUAL(-1, recording_sample_count(file.data(), file.size()));
+  file = header_bytes(10, recording_format_version_rate, 8000);
+  TEST_ASSERT_EQUAL(-1, recording_sample_count(file.data(), file.size() - 1));
+  TEST_ASSERT_EQUAL(-1, recording_sample_count(file.data(), 3));
+}
+
+static void test_samples_in_payload() {
+  TEST_ASSERT_EQUAL(0, adpcm_samples_in_payload(0));
+  TEST_ASSERT_EQUAL(0, adpcm_samples_in_payload(adpcm_block_header_bytes));
+  TEST_ASSERT_EQUAL(2, adpcm_samples_in_payload(adpcm_block_header_bytes + 1));
+  TEST_ASSERT_EQUAL(adpcm_samples_per_block,
+                    adpcm_samples_in_payload(adpcm_block_bytes));
+  TEST_ASSERT_EQUAL(2 * adpcm_samples_per_block + 20,
+                    adpcm_samples_in_payload(2 * adpcm_block_bytes + 14));
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_batch_matches_scalar_stereo32);
+  RUN_TEST(test_batch_matches_scalar_mono32);
+  RUN_TEST(test_batch_matches_scalar_mono16);
+  RUN_TEST(test_known_vector);
+  RUN_TEST(test_version1_round_trip);
+  RUN_TEST(test_version2_round_trip);
+  RUN_TEST(test_version3_silence_round_trip);
+  RUN_TEST(test_version4_round_trip);
+  RUN_TEST(test_truncated_file_decodes_short);
+  RUN_TEST(test_rejects_unknown_files);
+  RUN_TEST(test_samples_in_payload);
+  return UNITY_END();
+}
@@ -0,0 +1,147 @@
+// Microbenchmarks for the hot paths in src/: the ADPCM encoder per sample and
+// per 512-frame I2S buffer (batch and scalar), the block decoder, and SPSC
+// ring throughput. They print their timings (`pio test -e native -v` shows
+// them) and only assert that the work was done, since absolute numbers depend
+// on the machine. Compare runs on the same machine before and after a change.
+//
+// The same suite runs on the pendant with `pio test -e bench`, which is the
+// measurement that decides firmware defaults such as ADPCM_BATCH_ENCODE.
+
+#include <chrono>
+#include <stdio.h>
+#include <unity.h>
+#include <vector>
+
+#include "adpcm.h"
+#include "capture_pipeline.h"
+#include "spsc_ring.h"
+
+static const size_t buffer_frames = 512;
+static const size_t benchmark_buffers = 4000;
+
+static double seconds_since(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start)
+      .count();
+}
+
+static void report(const char *what, double value, const char *unit) {
+  char line[128];
+  snprintf(line, sizeof(line), "%-36s %10.2f %s", what, value, unit);
+  TEST_MESSAGE(line);
+}
+
+// One buffer of stereo frames, as the default pipeline reads them.
+static std::vector<int32_t> stereo_buffer() {
+  std::vector<int32_t> frames(buffer_frames * 2);
+  uint32_t seed = 1;
+  for (size_t i = 0; i < buffer_frames; i++) {
+    seed = seed * 1664525 + 1013904223;
+    frames[2 * i] = (int32_t)(seed & 0xFFFFFF00) >> 2;
+  }
+  return frames;
+}
+
+template <size_t (*encode)(const int32_t *, size_t, adpcm_block_encoder &,
+                           uint8_t *)>
+static double time_encoder(const std::vector<int32_t> &frames, uint32_t &sum) {
+  uint8_t out[adpcm_encoded_bytes_max(buffer_frames)];
+  adpcm_block_encoder encoder = {};
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < benchmark_buffers; i++) {
+    size_t written = encode(frames.data(), buffer_frames, encoder, out);
+    sum += out[written - 1] + written;
+  }
+  return seconds_since(start);
+}
+
+void setUp() {}
+void tearDown() {}
+
+static void test_encoder_speed() {
+  std::vector<int32_t> frames = stereo_buffer();
+  uint32_t sum = 0;
+  double batch = time_encoder<adpcm_encode_frames<i2s_slot_stereo32>>(frames, sum);
+  double scalar =
+      time_encoder<adpcm_encode_frames_scalar<i2s_slot_stereo32>>(frames, sum);
+  double samples = (double)benchmark_buffers * buffer_frames;
+  report("encode batch", batch * 1e9 / samples, "ns/sample");
+  report("encode batch, 512-frame buffer", batch * 1e6 / benchmark_buffers,
+         "us/buffer");
+  report("encode scalar", scalar * 1e9 / samples, "ns/sample");
+  report("encode scalar, 512-frame buffer", scalar * 1e6 / benchmark_buffers,
+         "us/buffer");
+  TEST_ASSERT_GREATER_THAN(0, sum);
+}
+
+static void test_decoder_speed() {
+  std::vector<int32_t> frames = stereo_buffer();
+  std::vector<uint8_t> file(sizeof(recording_header));
+  adpcm_block_encoder encoder = {};
+  uint8_t out[adpcm_encoded_bytes_max(buffer_frames)];
+  for (size_t i = 0; i < 64; i++) {
+    size_t written = adpcm_encode_frames<i2s_slot_stereo32>(
+        frames.data(), buffer_frames, encoder, out);
+    file.insert(file.end(), out, out + written);
+  }
+  uint32_t sample_count = 64 * buffer_frames;
+  recording_header header = make_recording_header(sample_count);
+  memcpy(file.data(), &header, sizeof(header));
+
+  std::vector<int16_t> samples(sample_count);
+  const size_t rounds = 60;
+  uint32_t sum = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < rounds; i++) {
+    sum += recording_decode(file.data(), file.size(), samples.data());
+    sum += (uint16_t)samples[sample_count - 1 - i];
+  }
+  double elapsed = seconds_since(start);
+  report("decode", elapsed * 1e9 / (rounds * sample_count), "ns/sample");
+  TEST_ASSERT_GREATER_THAN(0, sum);
+}
+
+// Single-threaded, so it measures the copies and index updates rather than
+// cross-core traffic: 4 KB writes, as the flash writer drains them.
+static void test_ring_throughput() {
+  static spsc_ring<uint8_t, 32768> ring;
+  static uint8_t chunk[4096];
+  const size_t rounds = 20000;
+  size_t moved = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < rounds; i++) {
+    chunk[0] = (uint8_t)i;
+    ring.push_span(chunk, sizeof(chunk));
+    while (!ring.empty()) {
+      size_t count = 0;
+      ring.peek_contiguous(count);
+      ring.commit(count);
+      moved += count;
+    }
+  }
+  double elapsed = seconds_since(start);
+  report("ring push_span + drain, 4 KB", moved / elapsed / 1e6, "MB/s");
+  TEST_ASSERT_EQUAL(rounds * sizeof(chunk), moved);
+  TEST_ASSERT_EQUAL(0, ring.dropped());
+}
+
+static int run_benchmarks() {
+  UNITY_BEGIN();
+  RUN_TEST(test_encoder_speed);
+  RUN_TEST(test_decoder_speed);
+  RUN_TEST(test_ring_throughput);
+  return UNITY_END();
+}
+
+#ifdef ARDUINO
+#include <Arduino.h>
+
+void setup() {
+  // Give the USB serial port time to enumerate before the first result.
+  delay(2000);
+  run_benchmarks();
+}
+
+void loop() {}
+#else
+int main() { return run_benchmarks(); }
+#endif
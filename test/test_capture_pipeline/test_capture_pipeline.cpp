@@ -0,0 +1,113 @@
+// Tests for src/capture_pipeline.h: the slot formats' sample extraction and
+// the sizes a pipeline derives from its slot, rate and codec.
+
+#include <unity.h>
+
+#include "adpcm.h"
+#include "capture_pipeline.h"
+
+// The firmware's codec lives in main.cpp next to its Arduino state; this is
+// the same shape around a test-owned encoder.
+struct test_adpcm_codec {
+  static adpcm_block_encoder encoder;
+  static constexpr uint8_t id = codec_ima_adpcm;
+
+  static void begin() { encoder = {}; }
+
+  template <typename slot_format>
+  static size_t encode(const typename slot_format::word *frames,
+                       size_t frame_count, uint8_t *out) {
+    return adpcm_encode_frames<slot_format>(frames, frame_count, encoder, out);
+  }
+
+  static constexpr size_t encoded_bytes_max(size_t frame_count) {
+    return adpcm_encoded_bytes_max(frame_count);
+  }
+
+  static constexpr uint32_t encoded_bytes_per_second(uint32_t rate) {
+    return rate / 2 + rate / adpcm_samples_per_block * adpcm_block_header_bytes;
+  }
+};
+adpcm_block_encoder test_adpcm_codec::encoder;
+
+typedef capture_pipeline<i2s_slot_stereo32, 16000, test_adpcm_codec, 256>
+    stereo_pipeline;
+typedef capture_pipeline<i2s_slot_mono16, 16000, test_adpcm_codec, 512>
+    mono16_pipeline;
+
+void setUp() {}
+void tearDown() {}
+
+static void test_slot_samples() {
+  // Left-justified 24-bit data: the top 16 bits are the sample.
+  const int32_t stereo[4] = {(int32_t)0xFFFE1234, 0x7FFFFFFF, 0x00051234, 0};
+  TEST_ASSERT_EQUAL(-2, i2s_slot_stereo32::sample(stereo, 0));
+  TEST_ASSERT_EQUAL(5, i2s_slot_stereo32::sample(stereo, 1));
+  const int32_t mono[2] = {(int32_t)0x80000000, 0x7FFF00FF};
+  TEST_ASSERT_EQUAL(-32768, i2s_slot_mono32::sample(mono, 0));
+  TEST_ASSERT_EQUAL(32767, i2s_slot_mono32::sample(mono, 1));
+  const int16_t mono16[2] = {-1234, 4321};
+  TEST_ASSERT_EQUAL(4321, i2s_slot_mono16::sample(mono16, 1));
+}
+
+static void test_derived_sizes() {
+  TEST_ASSERT_EQUAL(8, stereo_pipeline::frame_bytes);
+  TEST_ASSERT_EQUAL(512, stereo_pipeline::read_words);
+  TEST_ASSERT_EQUAL(2048, stereo_pipeline::read_bytes);
+  TEST_ASSERT_EQUAL(16, stereo_pipeline::read_milliseconds);
+  TEST_ASSERT_EQUAL(2, mono16_pipeline::frame_bytes);
+  TEST_ASSERT_EQUAL(1024, mono16_pipeline::read_bytes);
+  TEST_ASSERT_EQUAL(32, mono16_pipeline::read_milliseconds);
+  TEST_ASSERT_EQUAL(adpcm_encoded_bytes_max(512),
+                    mono16_pipeline::encoded_bytes_max);
+  TEST_ASSERT_EQUAL(8000, mono16_pipeline::samples_in_milliseconds(500));
+}
+
+// A pipeline encodes exactly what its codec does with the same frames, and
+// stays within encoded_bytes_max for a full read.
+static void test_encode_goes_through_the_codec() {
+  mono16_pipeline::word frames[mono16_pipeline::read_words];
+  for (size_t i = 0; i < mono16_pipeline::read_words; i++) {
+    frames[i] = (int16_t)(i * 97);
+  }
+  uint8_t through_pipeline[mono16_pipeline::encoded_bytes_max];
+  test_adpcm_codec::begin();
+  size_t pipeline_bytes = mono16_pipeline::encode(
+      frames, mono16_pipeline::read_frames, through_pipeline);
+  TEST_ASSERT_LESS_OR_EQUAL(mono16_pipeline::encoded_bytes_max, pipeline_bytes);
+
+  uint8_t direct[mono16_pipeline::encoded_bytes_max];
+  adpcm_block_encoder encoder = {};
+  size_t direct_bytes = adpcm_encode_frames<i2s_slot_mono16>(
+      frames, mono16_pipeline::read_frames, encoder, direct);
+  TEST_ASSERT_EQUAL(direct_bytes, pipeline_bytes);
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(direct, through_pipeline, direct_bytes);
+}
+
+// Stereo frames carry the microphone in the left slot only; whatever is in
+// the right slot must not change the output.
+static void test_stereo_ignores_right_slot() {
+  int32_t quiet[2 * 64] = {};
+  int32_t noisy[2 * 64] = {};
+  for (size_t i = 0; i < 64; i++) {
+    quiet[2 * i] = noisy[2 * i] = (int32_t)((i * 1000) << 16);
+    noisy[2 * i + 1] = (int32_t)(0x55550000u ^ (i << 20));
+  }
+  uint8_t a[adpcm_encoded_bytes_max(64)];
+  uint8_t b[adpcm_encoded_bytes_max(64)];
+  test_adpcm_codec::begin();
+  size_t a_bytes = stereo_pipeline::encode(quiet, 64, a);
+  test_adpcm_codec::begin();
+  size_t b_bytes = stereo_pipeline::encode(noisy, 64, b);
+  TEST_ASSERT_EQUAL(a_bytes, b_bytes);
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(a, b, a_bytes);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_slot_samples);
+  RUN_TEST(test_derived_sizes);
+  RUN_TEST(test_encode_goes_through_the_codec);
+  RUN_TEST(test_stereo_ignores_right_slot);
+  return UNITY_END();
+}
@@ -0,0 +1,183 @@
+// Shared golden vectors in test/golden/: each .ima file there has a .pcm
+// twin holding its decoded samples as signed 16-bit LE. This suite checks
+// that the encoder still writes exactly those .ima bytes and that
+// recording_decode() turns them into exactly that PCM. The same pairs are
+// checked against ImaAdpcmDecoder.kt (android/app/src/test) and against
+// tools/ima_to_wav and sync.py (tools/check_golden.sh), so every decoder
+// agrees on one fixed bitstream.
+//
+// After an intentional format change, regenerate the files with
+// MIDDLE_WRITE_GOLDEN=1 set and review the diff.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <unity.h>
+#include <vector>
+
+#include "adpcm.h"
+#include "capture_pipeline.h"
+
+#ifndef GOLDEN_DIR
+#define GOLDEN_DIR "test/golden/"
+#endif
+
+// A deterministic signal in integer arithmetic only, so it doesn't depend on
+// the host's libm: a triangle sweep that hits both rails, plus LCG noise.
+static std::vector<int16_t> golden_signal(size_t count) {
+  std::vector<int16_t> samples(count);
+  uint32_t seed = 12345;
+  int32_t phase = 0;
+  for (size_t i = 0; i < count; i++) {
+    seed = seed * 1664525 + 1013904223;
+    phase += 40 + (int32_t)(i / 8);
+    int32_t triangle = (phase & 0x1FFFF) - 0x10000;
+    if (triangle < 0) {
+      triangle = -triangle;
+    }
+    int32_t value = (triangle - 0x8000) * 5 / 4 + (int32_t)(seed >> 22) - 512;
+    if (value > 32767) {
+      value = 32767;
+    } else if (value < -32768) {
+      value = -32768;
+    }
+    samples[i] = (int16_t)value;
+  }
+  return samples;
+}
+
+static void append_encoded(const int16_t *samples, size_t count,
+                           adpcm_block_encoder &encoder,
+                           std::vector<uint8_t> &file) {
+  uint8_t out[adpcm_encoded_bytes_max(512)];
+  for (size_t done = 0; done < count;) {
+    size_t chunk = count - done < 512 ? count - done : 512;
+    size_t written = adpcm_encode_frames_scalar<i2s_slot_mono16>(
+        samples + done, chunk, encoder, out);
+    file.insert(file.end(), out, out + written);
+    done += chunk;
+  }
+}
+
+static void append_trailing_nibble(adpcm_block_encoder &encoder,
+                                   std::vector<uint8_t> &file) {
+  if (encoder.nibble_pending) {
+    file.push_back(encoder.packed_byte);
+    encoder.nibble_pending = false;
+  }
+}
+
+// Version 3 at the default rate: two audio blocks, a silence block as the
+// voice activity gate writes it, then a partial block with an odd sample
+// count, so the trailing nibble is exercised too.
+static const uint32_t v3_silent_samples = 1500;
+static const size_t v3_tail_samples = 301;
+
+static std::vector<uint8_t> golden_v3() {
+  std::vector<int16_t> samples =
+      golden_signal(2 * adpcm_samples_per_block + v3_tail_samples);
+  uint32_t sample_count = samples.size() + v3_silent_samples;
+  recording_header header =
+      make_recording_header(sample_count, recording_format_version_gated);
+  const uint8_t *header_bytes = (const uint8_t *)&header;
+  std::vector<uint8_t> file(header_bytes, header_bytes + sizeof(header));
+  adpcm_block_encoder encoder = {};
+  append_encoded(samples.data(), 2 * adpcm_samples_per_block, encoder, file);
+  uint8_t block[adpcm_block_bytes] = {};
+  block[3] = adpcm_block_silence;
+  memcpy(block + adpcm_block_header_bytes, &v3_silent_samples,
+         sizeof(v3_silent_samples));
+  file.insert(file.end(), block, block + sizeof(block));
+  append_encoded(samples.data() + 2 * adpcm_samples_per_block, v3_tail_samples,
+                 encoder, file);
+  append_trailing_nibble(encoder, file);
+  return file;
+}
+
+// Version 4 at 24 kHz: one full block and a short second one.
+static std::vector<uint8_t> golden_v4() {
+  std::vector<int16_t> samples = golden_signal(adpcm_samples_per_block + 78);
+  recording_header_with_rate header = {
+      make_recording_header(samples.size(), recording_format_version_rate),
+      24000};
+  const uint8_t *header_bytes = (const uint8_t *)&header;
+  std::vector<uint8_t> file(header_bytes, header_bytes + sizeof(header));
+  adpcm_block_encoder encoder = {};
+  append_encoded(samples.data(), samples.size(), encoder, file);
+  append_trailing_nibble(encoder, file);
+  return file;
+}
+
+// Empty if the file can't be read, which the size checks then report.
+static std::vector<uint8_t> read_golden(const char *name) {
+  std::string path = std::string(GOLDEN_DIR) + name;
+  std::vector<uint8_t> data;
+  FILE *file = fopen(path.c_str(), "rb");
+  if (file == nullptr) {
+    return data;
+  }
+  uint8_t buffer[4096];
+  size_t count;
+  while ((count = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+    data.insert(data.end(), buffer, buffer + count);
+  }
+  fclose(file);
+  return data;
+}
+
+static void write_golden(const char *name, const uint8_t *data, size_t size) {
+  std::string path = std::string(GOLDEN_DIR) + name;
+  FILE *file = fopen(path.c_str(), "wb");
+  TEST_ASSERT_NOT_NULL_MESSAGE(file, path.c_str());
+  TEST_ASSERT_EQUAL(size, fwrite(data, 1, size, file));
+  fclose(file);
+}
+
+static void decode(const std::vector<uint8_t> &ima,
+                   std::vector<int16_t> &samples) {
+  long count = recording_sample_count(ima.data(), ima.size());
+  TEST_ASSERT_GREATER_THAN(0, count);
+  samples.resize(count);
+  TEST_ASSERT_EQUAL(count, recording_decode(ima.data(), ima.size(),
+                                            samples.data()));
+}
+
+static void check_golden(const char *ima_name, const char *pcm_name,
+                         const std::vector<uint8_t> &encoded) {
+  std::vector<int16_t> samples;
+  if (getenv("MIDDLE_WRITE_GOLDEN") != nullptr) {
+    decode(encoded, samples);
+    write_golden(ima_name, encoded.data(), encoded.size());
+    write_golden(pcm_name, (const uint8_t *)samples.data(),
+                 samples.size() * sizeof(int16_t));
+  }
+  std::vector<uint8_t> ima = read_golden(ima_name);
+  TEST_ASSERT_EQUAL(encoded.size(), ima.size());
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(encoded.data(), ima.data(), ima.size());
+
+  std::vector<uint8_t> pcm = read_golden(pcm_name);
+  decode(ima, samples);
+  TEST_ASSERT_EQUAL(pcm.size(), samples.size() * sizeof(int16_t));
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(pcm.data(), (const uint8_t *)samples.data(),
+                                pcm.size());
+}
+
+void setUp() {}
+void tearDown() {}
+
+static void test_version3_golden() {
+  check_golden("gated_v3.ima", "gated_v3.pcm", golden_v3());
+}
+
+static void test_version4_golden() {
+  check_golden("rate_v4.ima", "rate_v4.pcm", golden_v4());
+  std::vector<uint8_t> ima = read_golden("rate_v4.ima");
+  TEST_ASSERT_EQUAL(24000, recording_sample_rate(ima.data(), ima.size()));
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_version3_golden);
+  RUN_TEST(test_version4_golden);
+  return UNITY_END();
+}
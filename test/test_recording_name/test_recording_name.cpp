@@ -0,0 +1,34 @@
+// Tests for parse_recording_id() in src/recording_name.h.
+
+#include <unity.h>
+
+#include "recording_name.h"
+
+void setUp() {}
+void tearDown() {}
+
+static void test_accepts_recordings() {
+  TEST_ASSERT_EQUAL(42, parse_recording_id("/rec_000042.ima"));
+  TEST_ASSERT_EQUAL(42, parse_recording_id("rec_000042.ima"));
+  TEST_ASSERT_EQUAL(7, parse_recording_id("rec_7.raw"));
+  TEST_ASSERT_EQUAL(0, parse_recording_id("rec_000000.ima"));
+  TEST_ASSERT_EQUAL(123456789, parse_recording_id("/rec_123456789.ima"));
+}
+
+static void test_rejects_other_files() {
+  TEST_ASSERT_EQUAL(-1, parse_recording_id("/rec_.ima"));
+  TEST_ASSERT_EQUAL(-1, parse_recording_id("/rec_000001"));
+  TEST_ASSERT_EQUAL(-1, parse_recording_id("/rec_000001.wav"));
+  TEST_ASSERT_EQUAL(-1, parse_recording_id("/rec_000001.ima.tmp"));
+  TEST_ASSERT_EQUAL(-1, parse_recording_id("/log_000001.ima"));
+  TEST_ASSERT_EQUAL(-1, parse_recording_id("//rec_000001.ima"));
+  TEST_ASSERT_EQUAL(-1, parse_recording_id(""));
+  TEST_ASSERT_EQUAL(-1, parse_recording_id("/"));
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_accepts_recordings);
+  RUN_TEST(test_rejects_other_files);
+  return UNITY_END();
+}
@@ -0,0 +1,129 @@
+// Tests for src/spsc_ring.h: ordering, wrap-around, whole-write drops, the
+// run-time sized ring, and a producer and consumer on separate threads.
+
+#include <thread>
+#include <unity.h>
+#include <vector>
+
+#include "spsc_ring.h"
+
+void setUp() {}
+void tearDown() {}
+
+static void test_push_pop_in_order() {
+  spsc_ring<uint32_t, 8> ring;
+  TEST_ASSERT_TRUE(ring.empty());
+  TEST_ASSERT_EQUAL(8, ring.capacity());
+  for (uint32_t i = 0; i < 5; i++) {
+    TEST_ASSERT_TRUE(ring.push(i));
+  }
+  TEST_ASSERT_EQUAL(5, ring.size());
+  uint32_t value = 0;
+  for (uint32_t i = 0; i < 5; i++) {
+    TEST_ASSERT_TRUE(ring.pop(value));
+    TEST_ASSERT_EQUAL(i, value);
+  }
+  TEST_ASSERT_FALSE(ring.pop(value));
+}
+
+static void test_span_wraps_and_peek_splits() {
+  spsc_ring<uint8_t, 16> ring;
+  uint8_t data[12];
+  for (size_t i = 0; i < sizeof(data); i++) {
+    data[i] = (uint8_t)i;
+  }
+  TEST_ASSERT_TRUE(ring.push_span(data, 10));
+  ring.commit(10);
+  // Starts at offset 10, so the 12 bytes wrap after 6.
+  TEST_ASSERT_TRUE(ring.push_span(data, sizeof(data)));
+  size_t count = 0;
+  const uint8_t *run = ring.peek_contiguous(count);
+  TEST_ASSERT_EQUAL(6, count);
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(data, run, count);
+  ring.commit(count);
+  run = ring.peek_contiguous(count);
+  TEST_ASSERT_EQUAL(6, count);
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(data + 6, run, count);
+  ring.commit(count);
+  TEST_ASSERT_TRUE(ring.empty());
+}
+
+static void test_full_write_is_dropped_whole() {
+  spsc_ring<uint8_t, 8> ring;
+  uint8_t data[8] = {1, 2, 3, 4, 5, 6, 7, 8};
+  TEST_ASSERT_TRUE(ring.push_span(data, 6));
+  TEST_ASSERT_FALSE(ring.push_span(data, 3));
+  TEST_ASSERT_EQUAL(6, ring.size());
+  TEST_ASSERT_EQUAL(3, ring.dropped());
+  TEST_ASSERT_TRUE(ring.push_span(data, 2));
+  TEST_ASSERT_EQUAL(8, ring.size());
+  ring.clear();
+  TEST_ASSERT_TRUE(ring.empty());
+  TEST_ASSERT_EQUAL(3, ring.dropped());
+  ring.reset();
+  TEST_ASSERT_EQUAL(0, ring.dropped());
+}
+
+static void test_attached_ring() {
+  spsc_ring<int16_t> ring;
+  TEST_ASSERT_FALSE(ring.attached());
+  int16_t sample = 7;
+  TEST_ASSERT_FALSE(ring.push(sample));
+  std::vector<int16_t> storage(64);
+  ring.attach(storage.data(), storage.size());
+  TEST_ASSERT_TRUE(ring.attached());
+  TEST_ASSERT_EQUAL(64, ring.capacity());
+  TEST_ASSERT_EQUAL(0, ring.dropped());
+  TEST_ASSERT_TRUE(ring.push(sample));
+  int16_t value = 0;
+  TEST_ASSERT_TRUE(ring.pop(value));
+  TEST_ASSERT_EQUAL(7, value);
+}
+
+// The sampling loop and flash writer pattern: odd-sized spans in, contiguous
+// runs out, on two threads. Every value must arrive once and in order.
+static void test_two_threads_keep_order() {
+  static spsc_ring<uint32_t, 1024> ring;
+  ring.reset();
+  const uint32_t total = 1000000;
+  std::thread producer([&]() {
+    uint32_t chunk[37];
+    for (uint32_t next = 0; next < total;) {
+      uint32_t count = total - next < 37 ? total - next : 37;
+      for (uint32_t i = 0; i < count; i++) {
+        chunk[i] = next + i;
+      }
+      while (!ring.push_span(chunk, count)) {
+        std::this_thread::yield();
+      }
+      next += count;
+    }
+  });
+  uint32_t expected = 0;
+  bool in_order = true;
+  while (expected < total && in_order) {
+    size_t count = 0;
+    const uint32_t *run = ring.peek_contiguous(count);
+    if (count == 0) {
+      std::this_thread::yield();
+    }
+    for (size_t i = 0; i < count; i++) {
+      in_order = in_order && run[i] == expected + i;
+    }
+    expected += count;
+    ring.commit(count);
+  }
+  producer.join();
+  TEST_ASSERT_TRUE(in_order);
+  TEST_ASSERT_EQUAL(total, expected);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_push_pop_in_order);
+  RUN_TEST(test_span_wraps_and_peek_splits);
+  RUN_TEST(test_full_write_is_dropped_whole);
+  RUN_TEST(test_attached_ring);
+  RUN_TEST(test_two_threads_keep_order);
+  return UNITY_END();
+}
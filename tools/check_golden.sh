@@ -0,0 +1,36 @@
+#!/bin/sh
+# Checks tools/ima_to_wav and sync.py's decoder against the golden vectors in
+# test/golden/: every .ima there must convert to a WAV whose samples are
+# exactly its .pcm twin. Run from the repository root:
+#
+#   sh tools/check_golden.sh
+#
+# Uses $CXX, or c++, to build ima_to_wav in a temporary directory, and uv to
+# run sync.py --decode.
+set -eu
+
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+"${CXX:-c++}" -O2 -std=c++17 -pthread -Isrc tools/ima_to_wav.cpp -o "$work/ima_to_wav"
+
+# Both write a plain 44-byte header before the samples.
+check() {
+  tail -c +45 "$2" > "$work/out.pcm"
+  if cmp -s "$work/out.pcm" "$3"; then
+    echo "ok   $1 $3"
+  else
+    echo "FAIL $1 $3"
+    status=1
+  fi
+}
+
+status=0
+for ima in test/golden/*.ima; do
+  pcm="${ima%.ima}.pcm"
+  "$work/ima_to_wav" - < "$ima" > "$work/out.wav"
+  check ima_to_wav "$work/out.wav" "$pcm"
+  cp "$ima" "$work/golden.ima"
+  uv run --quiet sync.py --decode "$work/golden.ima" > /dev/null
+  check sync.py "$work/golden.wav" "$pcm"
+done
+exit $status
@@ -0,0 +1,150 @@
+// Batch-converts pendant recordings (.ima, any version) to mono WAV at each
+// recording's sample rate, one file per thread, using the firmware's own codec in src/adpcm.h:
+//
+//   c++ -O2 -std=c++17 -pthread -Isrc tools/ima_to_wav.cpp -o ima_to_wav
+//   ./ima_to_wav [-j THREADS] recordings/*.ima
+//
+// Each input is written next to itself with a .wav suffix. With -j 0 (the
+// default) it uses one thread per core. An input of - reads one recording
+// from stdin and writes its WAV to stdout, which is how sync.py decodes.
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "adpcm.h"
+
+static bool read_stream(FILE *file, std::vector<uint8_t> &data) {
+  uint8_t buffer[65536];
+  size_t count;
+  while ((count = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+    data.insert(data.end(), buffer, buffer + count);
+  }
+  return !ferror(file);
+}
+
+static bool read_file(const std::string &path, std::vector<uint8_t> &data) {
+  if (path == "-") {
+    return read_stream(stdin, data);
+  }
+  FILE *file = fopen(path.c_str(), "rb");
+  if (file == nullptr) {
+    return false;
+  }
+  bool ok = read_stream(file, data);
+  fclose(file);
+  return ok;
+}
+
+static void put_u16(uint8_t *out, uint16_t value) { memcpy(out, &value, 2); }
+static void put_u32(uint8_t *out, uint32_t value) { memcpy(out, &value, 4); }
+
+static bool write_wav(const std::string &path, const int16_t *samples,
+                      size_t count, uint32_t sample_rate) {
+  uint32_t data_bytes = (uint32_t)(count * sizeof(int16_t));
+  uint8_t header[44];
+  memcpy(header, "RIFF", 4);
+  put_u32(header + 4, 36 + data_bytes);
+  memcpy(header + 8, "WAVEfmt ", 8);
+  put_u32(header + 16, 16);
+  put_u16(header + 20, 1);
+  put_u16(header + 22, 1);
+  put_u32(header + 24, sample_rate);
+  put_u32(header + 28, sample_rate * sizeof(int16_t));
+  put_u16(header + 32, sizeof(int16_t));
+  put_u16(header + 34, 16);
+  memcpy(header + 36, "data", 4);
+  put_u32(header + 40, data_bytes);
+
+  FILE *file = path == "-" ? stdout : fopen(path.c_str(), "wb");
+  if (file == nullptr) {
+    return false;
+  }
+  bool ok = fwrite(header, 1, sizeof(header), file) == sizeof(header) &&
+            fwrite(samples, sizeof(int16_t), count, file) == count;
+  if (file == stdout) {
+    return fflush(file) == 0 && ok;
+  }
+  return fclose(file) == 0 && ok;
+}
+
+static std::string wav_path(const std::string &path) {
+  if (path == "-") {
+    return path;
+  }
+  size_t dot = path.rfind('.');
+  size_t slash = path.find_last_of("/\\");
+  if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) {
+    return path + ".wav";
+  }
+  return path.substr(0, dot) + ".wav";
+}
+
+static bool convert(const std::string &path) {
+  std::vector<uint8_t> data;
+  if (!read_file(path, data)) {
+    fprintf(stderr, "%s: can't read\n", path.c_str());
+    return false;
+  }
+  long total = recording_sample_count(data.data(), data.size());
+  if (total < 0) {
+    fprintf(stderr, "%s: not a recording this tool can decode\n", path.c_str());
+    return false;
+  }
+  std::vector<int16_t> samples((size_t)total);
+  long decoded = recording_decode(data.data(), data.size(), samples.data());
+  if (!write_wav(wav_path(path), samples.data(), (size_t)decoded,
+                 recording_sample_rate(data.data(), data.size()))) {
+    fprintf(stderr, "%s: can't write %s\n", path.c_str(),
+            wav_path(path).c_str());
+    return false;
+  }
+  return true;
+}
+
+int main(int argc, char **argv) {
+  unsigned threads = 0;
+  std::vector<std::string> paths;
+  for (int i = 1; i < argc; i++) {
+    std::string argument = argv[i];
+    if (argument == "-j" && i + 1 < argc) {
+      threads = (unsigned)strtoul(argv[++i], nullptr, 10);
+    } else {
+      paths.push_back(argument);
+    }
+  }
+  if (paths.empty()) {
+    fprintf(stderr, "usage: %s [-j THREADS] FILE.ima...\n", argv[0]);
+    return 2;
+  }
+  if (threads == 0) {
+    threads = std::thread::hardware_concurrency();
+  }
+  if (threads == 0) {
+    threads = 1;
+  }
+  if (threads > paths.size()) {
+    threads = (unsigned)paths.size();
+  }
+
+  // Workers take the next unclaimed file until none are left.
+  std::atomic<size_t> next{0};
+  std::atomic<int> failures{0};
+  std::vector<std::thread> workers;
+  for (unsigned t = 0; t < threads; t++) {
+    workers.emplace_back([&]() {
+      for (size_t i = next++; i < paths.size(); i = next++) {
+        if (!convert(paths[i])) {
+          failures++;
+        }
+      }
+    });
+  }
+  for (std::thread &worker : workers) {
+    worker.join();
+  }
+  return failures > 0 ? 1 : 0;
+}